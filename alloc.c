@@ -3,27 +3,148 @@
 #include <stdalign.h>
 
 #define BUMP_PAGE_SIZE (1 << 20)
+// Larger allocations get a page of their own rather than wasting the rest of
+// a shared one.
+#define BUMP_LARGE_SIZE (BUMP_PAGE_SIZE / 4)
 
-void free_bump_list(struct bump_list** bump_p) {
-    while (*bump_p) {
-        struct bump_list* tmp = *bump_p;
-        *bump_p = tmp->next;
+static size_t last_serial;
+
+static void free_pages(struct bump_list* page) {
+    while (page) {
+        struct bump_list* tmp = page;
+        page = tmp->next;
+        free_pages(tmp->spare);
         free(tmp->base);
         free(tmp);
     }
 }
 
+void free_bump_list(struct bump_list** bump_p) {
+    free_pages(*bump_p);
+    *bump_p = NULL;
+}
+
+static struct bump_list* new_page(size_t size) {
+    struct bump_list* page = xmalloc(sizeof(*page));
+    page->base = xmalloc(size);
+    page->size = size;
+    page->is_large = 0;
+    page->spare = NULL;
+    return page;
+}
+
 void* bump_alloc(struct bump_list** bump_p, size_t size) {
+    size_t align = alignof(max_align_t);
+    size = (size + align - 1) / align * align;
+
     struct bump_list* bump = *bump_p;
-    if (!*bump_p || (*bump_p)->nused + size < BUMP_PAGE_SIZE) {
-        bump = xmalloc(sizeof(*bump));
-        bump->base = xmalloc(BUMP_PAGE_SIZE > size ? BUMP_PAGE_SIZE : size);
-        bump->nused = 0;
-        bump->next = *bump_p;
-        *bump_p = bump;
+    if (size > BUMP_LARGE_SIZE) {
+        // Slot the page in behind the current one, which keeps filling up.
+        struct bump_list* large = new_page(size);
+        large->nused = size;
+        large->serial = ++last_serial;
+        large->is_large = 1;
+        if (bump && !bump->is_large) {
+            large->next = bump->next;
+            bump->next = large;
+        } else {
+            large->next = bump;
+            *bump_p = large;
+        }
+        return large->base;
+    }
+
+    if (!bump || bump->is_large || bump->size - bump->nused < size) {
+        struct bump_list* page;
+        struct bump_list* spare = bump ? bump->spare : NULL;
+        if (spare) {
+            page = spare;
+            page->spare = spare->next;
+            bump->spare = NULL;
+        } else {
+            page = new_page(BUMP_PAGE_SIZE);
+        }
+        page->nused = 0;
+        page->serial = ++last_serial;
+        page->next = bump;
+        *bump_p = bump = page;
     }
     void* ret = bump->base + bump->nused;
-    size_t align = alignof(max_align_t);
-    bump->nused += (size + align - 1) / align * align;
+    bump->nused += size;
     return ret;
 }
+
+struct bump_mark bump_mark(struct bump_list* const* bump_p) {
+    struct bump_mark mark = { .page = *bump_p, .serial = last_serial };
+    if (mark.page)
+        mark.nused = mark.page->nused;
+    return mark;
+}
+
+// Unlink pages newer than serial from the front of *list_p. Shared pages are
+// pushed onto *spare_p and large pages are freed.
+static void unlink_newer(struct bump_list** list_p, size_t serial,
+                         struct bump_list** spare_p) {
+    while (*list_p && (*list_p)->serial > serial) {
+        struct bump_list* page = *list_p;
+        *list_p = page->next;
+        page->next = NULL;
+        if (page->is_large) {
+            free_pages(page);
+            continue;
+        }
+        struct bump_list* spare = page->spare;
+        page->spare = NULL;
+        page->next = *spare_p;
+        *spare_p = page;
+        // Earlier spares would otherwise be lost.
+        while (spare) {
+            struct bump_list* tmp = spare;
+            spare = tmp->next;
+            tmp->next = *spare_p;
+            *spare_p = tmp;
+        }
+    }
+}
+
+void bump_rewind(struct bump_list** bump_p, struct bump_mark mark) {
+    struct bump_list* spare = NULL;
+    unlink_newer(bump_p, mark.serial, &spare);
+    assert(*bump_p == mark.page);
+    if (!mark.page) {
+        free_pages(spare);
+        return;
+    }
+    // Large pages made while mark.page was current sit right behind it.
+    unlink_newer(&mark.page->next, mark.serial, &spare);
+    if (!mark.page->is_large)
+        mark.page->nused = mark.nused;
+    if (spare) {
+        struct bump_list* last = spare;
+        while (last->next)
+            last = last->next;
+        last->next = mark.page->spare;
+        mark.page->spare = spare;
+    }
+}
+
+void get_bump_stats(const struct bump_list* bump, struct bump_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (; bump; bump = bump->next) {
+        stats->num_pages++;
+        if (bump->is_large)
+            stats->num_large++;
+        stats->bytes_used += bump->nused;
+        stats->bytes_reserved += bump->size;
+    }
+}
+
+void report_bump_stats(const char* name, const struct bump_list* bump) {
+    if (!getenv("KNIT_ALLOC_STATS"))
+        return;
+    struct bump_stats stats;
+    get_bump_stats(bump, &stats);
+    fprintf(stderr, "%s: %zu pages (%zu large), %zu bytes used of %zu\n",
+            name, stats.num_pages, stats.num_large,
+            stats.bytes_used, stats.bytes_reserved);
+}
@@ -2,12 +2,42 @@
 
 #include "util.h"
 
+// A bump allocator: memory is carved out of pages that are only released all
+// at once (free_bump_list) or back to a mark (bump_rewind). Allocations are not
+// zeroed. The list pointer starts out NULL.
 struct bump_list {
     char* base;
     size_t nused;
+    size_t size;
+    size_t serial; // increases with each page put into use
+    unsigned is_large : 1;
+    // Pages released by bump_rewind() hang off the current page for reuse.
+    struct bump_list* spare;
     struct bump_list* next;
 };
 
 void free_bump_list(struct bump_list** bump_p);
 
 void* bump_alloc(struct bump_list** bump_p, size_t size);
+
+// Scratch allocations can be made between bump_mark() and bump_rewind(), which
+// releases everything allocated since the mark. Not thread-safe.
+struct bump_mark {
+    struct bump_list* page;
+    size_t nused;
+    size_t serial;
+};
+
+struct bump_mark bump_mark(struct bump_list* const* bump_p);
+void bump_rewind(struct bump_list** bump_p, struct bump_mark mark);
+
+struct bump_stats {
+    size_t num_pages;      // including pages for large allocations
+    size_t num_large;      // allocations too large to share a page
+    size_t bytes_used;
+    size_t bytes_reserved; // excluding spare pages
+};
+
+void get_bump_stats(const struct bump_list* bump, struct bump_stats* stats);
+// Print stats to stderr labeled with name if KNIT_ALLOC_STATS is set.
+void report_bump_stats(const char* name, const struct bump_list* bump);
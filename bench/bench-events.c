@@ -0,0 +1,96 @@
+// Measure the cost of waking for one ready fd among many idle ones, as the
+// scheduler does when one of many outstanding dispatches writes output. The
+// event loop is compared against polling every fd and scanning every pollfd,
+// which the scheduler did before and is kept here as a baseline.
+//
+// usage: bench-events (events|poll) [<num-fds>]
+
+#include "../event.h"
+
+#include <poll.h>
+#include <sys/resource.h>
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void die_usage(const char* arg0) {
+    fprintf(stderr, "usage: %s (events|poll) [<num-fds>]\n", arg0);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3)
+        die_usage(argv[0]);
+    int use_events;
+    if (!strcmp(argv[1], "events"))
+        use_events = 1;
+    else if (!strcmp(argv[1], "poll"))
+        use_events = 0;
+    else
+        die_usage(argv[0]);
+    size_t num_fds = argc == 3 ? strtoul(argv[2], NULL, 10) : 1000;
+    if (!num_fds)
+        die_usage(argv[0]);
+
+    // Each fd needs both ends of a pipe.
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        die_errno("getrlimit");
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        die_errno("getrlimit");
+    if (2 * num_fds + 16 > rl.rlim_cur) {
+        printf("%s: %zu fds exceeds the open file limit\n", argv[1], num_fds);
+        return 0;
+    }
+
+    int* writefds = xmalloc(num_fds * sizeof(*writefds));
+    struct event_source* srcs = xmalloc(num_fds * sizeof(*srcs));
+    struct pollfd* pfds = xmalloc(num_fds * sizeof(*pfds));
+    for (size_t i = 0; i < num_fds; i++) {
+        int fds[2];
+        if (pipe(fds) < 0)
+            die_errno("pipe");
+        writefds[i] = fds[1];
+        srcs[i].fd = pfds[i].fd = fds[0];
+        srcs[i].data = &srcs[i];
+        pfds[i].events = POLLIN;
+        if (use_events)
+            add_event_source(&srcs[i]);
+    }
+
+    // Wake each fd in turn, in an order unrelated to registration.
+    size_t num_events = 200000;
+    size_t stride = 7919 % num_fds ? 7919 : 1;
+    double start = now_ms();
+    for (size_t n = 0, k = 0; n < num_events; n++, k = (k + stride) % num_fds) {
+        char c = 0;
+        if (write(writefds[k], &c, 1) != 1)
+            die_errno("write");
+
+        int fd = -1;
+        if (use_events) {
+            struct event_source* ready[1];
+            if (wait_for_events(ready, 1) != 1)
+                die_errno("wait_for_events");
+            fd = ready[0]->fd;
+        } else {
+            if (poll(pfds, num_fds, -1) < 0)
+                die_errno("poll");
+            for (size_t i = 0; i < num_fds; i++)
+                if (pfds[i].revents)
+                    fd = pfds[i].fd;
+        }
+        if (fd != srcs[k].fd || read(fd, &c, 1) != 1)
+            die("woke the wrong fd");
+    }
+    double elapsed_ms = now_ms() - start;
+
+    printf("%s: %zu fds, %.0f ns/event\n",
+           argv[1], num_fds, elapsed_ms * 1e6 / num_events);
+    return 0;
+}
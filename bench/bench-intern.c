@@ -0,0 +1,171 @@
+// Compare object interning in the hash table against the 16-way trie it
+// replaced, which is kept here as a baseline. Each run interns distinct oids
+// and then looks them all up again in a different order.
+//
+// usage: bench-intern (table|trie) [<num-objects>]
+
+#include "../job.h"
+#include "../object.h"
+
+#include <sys/resource.h>
+
+#define TRIE_BITS_PER_LEVEL 4
+#define TRIE_LEVELS_PER_BYTE (8 / TRIE_BITS_PER_LEVEL)
+#define TRIE_BRANCHING_FACTOR (1 << TRIE_BITS_PER_LEVEL)
+#define TRIE_MAX_LEVELS (KNIT_HASH_RAWSZ * TRIE_LEVELS_PER_BYTE)
+
+struct object_trie {
+    int num_items;
+    union {
+        struct object* items[TRIE_BRANCHING_FACTOR];
+        struct object_trie* nodes[TRIE_BRANCHING_FACTOR];
+    };
+};
+
+static int trie_is_leaf(struct object_trie* trie) { return trie->num_items >= 0; }
+
+static size_t trie_child(size_t level, const struct object_id* oid) {
+    unsigned char byte = oid->hash[level / TRIE_LEVELS_PER_BYTE];
+    int shift = (level % TRIE_LEVELS_PER_BYTE) * TRIE_BITS_PER_LEVEL;
+    return (byte >> shift) % TRIE_BRANCHING_FACTOR;
+}
+
+static void trie_insert(struct object_trie** trie_p, size_t level, struct object* obj) {
+    assert(level < TRIE_MAX_LEVELS);
+    struct object_trie* trie;
+    if (!*trie_p) {
+        *trie_p = trie = xmalloc(sizeof(*trie));
+        memset(trie, 0, sizeof(*trie));
+    }
+    trie = *trie_p;
+    if (trie->num_items == TRIE_BRANCHING_FACTOR) {
+        struct object* items[TRIE_BRANCHING_FACTOR];
+        memcpy(items, trie->items, sizeof(items));
+        trie->num_items = -1;
+        memset(trie->nodes, 0, sizeof(trie->nodes));
+        for (int i = 0; i < TRIE_BRANCHING_FACTOR; i++)
+            trie_insert(trie_p, level, items[i]);
+    } else if (trie_is_leaf(trie)) {
+        trie->items[trie->num_items++] = obj;
+        return;
+    }
+    trie_insert(&trie->nodes[trie_child(level, &obj->oid)], level + 1, obj);
+}
+
+static struct object* trie_find(struct object_trie* trie, const struct object_id* oid) {
+    for (size_t level = 0; trie; level++) {
+        if (trie_is_leaf(trie)) {
+            for (int i = 0; i < trie->num_items; i++) {
+                struct object* leaf = trie->items[i];
+                if (!memcmp(leaf->oid.hash, oid->hash, KNIT_HASH_RAWSZ))
+                    return leaf;
+            }
+            break;
+        }
+        trie = trie->nodes[trie_child(level, oid)];
+    }
+    return NULL;
+}
+
+static struct object_trie* trie_root;
+
+static void* trie_intern(const struct object_id* oid, uint32_t typesig, size_t size) {
+    struct object* obj = trie_find(trie_root, oid);
+    if (obj)
+        return obj;
+    obj = xmalloc(size);
+    memset(obj, 0, size);
+    memcpy(obj->oid.hash, oid->hash, KNIT_HASH_RAWSZ);
+    obj->typesig = typesig;
+    trie_insert(&trie_root, 0, obj);
+    return obj;
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+static uint64_t xorshift64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static size_t gcd(size_t a, size_t b) {
+    while (b) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static long max_rss_kib() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+        die_errno("getrusage");
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+static void die_usage(const char* arg0) {
+    fprintf(stderr, "usage: %s (table|trie) [<num-objects>]\n", arg0);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3)
+        die_usage(argv[0]);
+    void* (*intern)(const struct object_id*, uint32_t, size_t);
+    if (!strcmp(argv[1], "table"))
+        intern = intern_object;
+    else if (!strcmp(argv[1], "trie"))
+        intern = trie_intern;
+    else
+        die_usage(argv[0]);
+    size_t num_objects = argc == 3 ? strtoul(argv[2], NULL, 10) : 500000;
+    if (!num_objects)
+        die_usage(argv[0]);
+
+    struct object_id* oids = xmalloc(num_objects * sizeof(*oids));
+    for (size_t i = 0; i < num_objects; i++) {
+        for (size_t j = 0; j < KNIT_HASH_RAWSZ; j += sizeof(uint64_t)) {
+            uint64_t r = xorshift64();
+            memcpy(&oids[i].hash[j], &r, sizeof(r));
+        }
+    }
+    long base_rss = max_rss_kib();
+
+    double start = now_ms();
+    for (size_t i = 0; i < num_objects; i++)
+        intern(&oids[i], OBJ_JOB, sizeof(struct job));
+    double insert_ms = now_ms() - start;
+    long rss = max_rss_kib() - base_rss;
+
+    // Look up with a stride coprime to num_objects so the order differs from
+    // insertion but every oid is visited.
+    size_t stride = 7919;
+    while (gcd(stride, num_objects) != 1)
+        stride++;
+    size_t num_lookups = 4 * num_objects;
+    start = now_ms();
+    for (size_t i = 0, k = 0; i < num_lookups; i++) {
+        if (!intern(&oids[k], OBJ_JOB, sizeof(struct job)))
+            die("lookup failed");
+        k = (k + stride) % num_objects;
+    }
+    double lookup_ms = now_ms() - start;
+
+    printf("%s: %zu objects, insert %.0f ns/op, lookup %.0f ns/op, %ld KiB\n",
+           argv[1], num_objects, insert_ms * 1e6 / num_objects,
+           lookup_ms * 1e6 / num_lookups, rss);
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Resolve the dependencies of every step in a session, as knit-resume-session
+// would when each step completes. A chain has each step depend on the one
+// before it; a fan-in has every step feed an input of one final step.
+//
+// usage: bench-resolve (chain|fanin) [<num-steps>]
+
+#include "../session.h"
+
+#include <sys/resource.h>
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static long max_rss_kib() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+        die_errno("getrusage");
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+static void set_resource(size_t input_pos, struct resource* res) {
+    struct session_input* si = &active_inputs[input_pos];
+    memcpy(si->res_hash, res->object.oid.hash, KNIT_HASH_RAWSZ);
+    si_setflag(si, SI_RESOURCE | SI_FINAL);
+}
+
+static void die_usage(const char* arg0) {
+    fprintf(stderr, "usage: %s (chain|fanin) [<num-steps>]\n", arg0);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3)
+        die_usage(argv[0]);
+    int is_chain;
+    if (!strcmp(argv[1], "chain"))
+        is_chain = 1;
+    else if (!strcmp(argv[1], "fanin"))
+        is_chain = 0;
+    else
+        die_usage(argv[0]);
+    size_t num_steps = argc == 3 ? strtoul(argv[2], NULL, 10) : 100000;
+    if (num_steps < 2)
+        die_usage(argv[0]);
+
+    struct resource* cmd = store_resource("true\0", 5);
+    struct resource* out = store_resource("", 0);
+    if (!cmd || !out)
+        exit(1);
+
+    // Build the session as knit-build-session would. Each step has a command
+    // input and, except the first, the output of a previous step.
+    if (new_session("bench-resolve") < 0)
+        exit(1);
+    for (size_t i = 0; i < num_steps; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "s%zu", i);
+        size_t step_pos = create_session_step(name);
+        set_resource(create_session_input(step_pos, ".knit/cmd"), cmd);
+        if (is_chain && i > 0) {
+            size_t input_pos = create_session_input(step_pos, "prev");
+            create_session_dependency(input_pos, i - 1, "out", SD_REQUIRED);
+        } else if (!is_chain && i == num_steps - 1) {
+            for (size_t j = 0; j < num_steps - 1; j++) {
+                snprintf(name, sizeof(name), "in%09zu", j);
+                size_t input_pos = create_session_input(step_pos, name);
+                create_session_dependency(input_pos, j, "out", SD_REQUIRED);
+            }
+        }
+    }
+    if (compile_job_for_step(0) < 0)
+        exit(1);
+    if (!is_chain)
+        for (size_t i = 1; i < num_steps - 1; i++)
+            if (compile_job_for_step(i) < 0)
+                exit(1);
+
+    struct resource_list outputs = {0};
+    resource_list_append(&outputs, "out", out);
+    long base_rss = max_rss_kib();
+
+    double start = now_ms();
+    for (size_t i = 0; i < num_steps; i++)
+        resolve_dependencies(i, &outputs);
+    double resolve_ms = now_ms() - start;
+    long rss = max_rss_kib() - base_rss;
+
+    if (!ss_hasflag(&active_steps[num_steps - 1], SS_JOB))
+        die("last step not resolved");
+    printf("%s: %zu steps, %zu deps, resolve %.0f ms, %ld KiB\n",
+           argv[1], num_steps, num_active_deps, resolve_ms, rss);
+    resource_list_clear(&outputs);
+    close_session();
+    return 0;
+}
@@ -0,0 +1,16 @@
+set -e
+
+PATH="$PWD:$PWD/..:$PATH"
+
+# Seconds elapsed while running a command, with millisecond resolution.
+elapsed() {
+    local start end
+    start=$(date +%s%N)
+    "$@" > /dev/null
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000000 )) | sed -E 's/^/000/; s/(...)$/.\1/; s/^0*([0-9])/\1/'
+}
+
+rm -rf tmp
+mkdir tmp
+cd tmp
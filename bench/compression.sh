@@ -0,0 +1,30 @@
+#!/bin/bash
+#
+# Compare the size and read throughput of raw and zlib compressed objects.
+# Reads are hot in the page cache, so this measures inflate overhead rather
+# than I/O savings.
+
+. bench-setup.sh
+
+count=${COUNT:-200}
+reads=${READS:-5}
+
+# Log-like text resources, similar to .knit/log outputs.
+mkdir data
+for i in $(seq $count); do
+    seq -f "step $i line %g: compiled object ok" 1000 > data/$i
+done
+
+for layout in none zlib; do
+    knit init $layout 2> /dev/null
+    echo "compression = $layout" > $layout/.knit/config
+    (cd $layout && for i in $(seq $count); do
+        knit-hash-object -t resource -w ../data/$i
+    done) > $layout.oids
+
+    kib=$(du -sk $layout/.knit/objects | cut -f1)
+    secs=$(elapsed bash -c "cd $layout && for r in \$(seq $reads); do
+        xargs -n1 knit-cat-file resource < ../$layout.oids
+    done")
+    echo "$layout: ${kib} KiB, $((count * reads)) reads in ${secs}s"
+done
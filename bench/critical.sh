@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Run a DAG with skewed durations on a few job slots: many short steps come
+# first in the plan, and a chain of long steps after them. The first run
+# records durations; later runs change every job, so the scheduler has only
+# the history of step names to estimate the critical path by.
+
+. bench-setup.sh
+
+unset MAKEFLAGS
+
+shorts=${SHORTS:-10}
+short_time=${SHORT_TIME:-0.2}
+chain=${CHAIN:-3}
+long_time=${LONG_TIME:-1}
+jobs=${JOBS:-2}
+
+knit init > /dev/null 2>&1
+cd .knit/..
+
+{
+    echo 'step params: params'
+    echo '    nonce = ./nonce'
+    for ((i = 0; i < shorts; i++)); do
+        echo "step short$i: cmd \"bash\" \"-c\" \"sleep $short_time; cp in/nonce out/n; echo $i >> out/n\""
+        echo '    nonce = params:nonce'
+    done
+    for ((i = 0; i < chain; i++)); do
+        echo "step long$i: cmd \"bash\" \"-c\" \"sleep $long_time; cp in/nonce out/n; echo $i >> out/n\""
+        echo '    nonce = params:nonce'
+        ((i == 0)) || echo "    prev = long$((i - 1)):n"
+    done
+} > plan.knit
+
+echo 0 > nonce
+secs=$(elapsed knit-run-plan -j $jobs)
+echo "first run: ${secs}s"
+for run in 1 2 3; do
+    secs=$(elapsed knit-run-plan -j $jobs -p nonce=$run)
+    echo "rerun $run: ${secs}s"
+done
@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Run many trivial independent cmd steps, dispatched by knit-run-cmd and by
+# knit-dispatch-job, and report jobs per second.
+
+. bench-setup.sh
+
+unset MAKEFLAGS
+
+steps=${STEPS:-500}
+
+for mode in native script; do
+    mkdir $mode
+    (
+        cd $mode
+        knit init > /dev/null 2>&1
+        echo "dispatch = $mode" > .knit/config
+        for ((i = 0; i < steps; i++)); do
+            echo "step s$i: cmd \"touch\" \"out/$i\""
+        done > plan.knit
+        secs=$(elapsed knit-run-plan)
+        ms=$(echo $secs | tr -d .)
+        echo "$mode: $steps jobs in ${secs}s, $((steps * 1000 / 10#$ms)) jobs/s"
+    )
+done
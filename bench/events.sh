@@ -0,0 +1,8 @@
+#!/bin/bash
+
+. bench-setup.sh
+
+for n in 10 100 1000 9000; do
+    bench-events poll $n
+    bench-events events $n
+done
@@ -0,0 +1,8 @@
+#!/bin/bash
+
+. bench-setup.sh
+
+for n in 10000 100000 1000000; do
+    bench-intern trie $n
+    bench-intern table $n
+done
@@ -0,0 +1,26 @@
+#!/bin/bash
+#
+# Parse a long chain of steps and build a session from it. Set
+# KNIT_ALLOC_STATS to also print bump allocator usage.
+
+. bench-setup.sh
+
+steps=${STEPS:-20000}
+
+knit init > /dev/null 2>&1
+cd .knit/..
+
+{
+    echo 'step s0: cmd "true"'
+    for ((i = 1; i < steps; i++)); do
+        echo "step s$i: cmd \"true\""
+        echo "    prev = s$((i - 1)):out"
+    done
+} > plan.knit
+
+job=$(knit-parse-plan --emit-params-files plan.knit | knit-plan-job plan.knit)
+secs=$(elapsed knit-parse-plan --build-instructions $job)
+echo "parse $steps steps: ${secs}s"
+knit-parse-plan --build-instructions $job > instructions
+secs=$(elapsed knit-build-session bench < instructions)
+echo "build session of $steps steps: ${secs}s"
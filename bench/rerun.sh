@@ -0,0 +1,28 @@
+#!/bin/bash
+#
+# Rerun a long chain of steps whose jobs are all cached. Only a trailing step
+# changes between runs, so the session is rebuilt and every other step is
+# resolved from the cache.
+
+. bench-setup.sh
+
+steps=${STEPS:-2000}
+
+knit init > /dev/null 2>&1
+cd .knit/..
+
+plan() {
+    echo 'step s0: cmd "bash" "-c" "echo 0 > out/n"'
+    for ((i = 1; i < steps; i++)); do
+        echo "step s$i: cmd \"bash\" \"-c\" \"echo $i > out/n\""
+        echo "    prev = s$((i - 1)):n"
+    done
+    echo "step tail: cmd \"bash\" \"-c\" \"echo $1 > out/n\""
+    echo "    prev = s$((steps - 1)):n"
+}
+
+plan 0 > plan.knit
+knit-run-plan > /dev/null
+plan 1 > plan.knit
+secs=$(elapsed knit-run-plan)
+echo "rerun $steps cached steps: ${secs}s"
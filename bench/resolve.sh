@@ -0,0 +1,11 @@
+#!/bin/bash
+
+. bench-setup.sh
+
+knit init > /dev/null 2>&1
+cd .knit/..
+
+for n in 10000 100000; do
+    bench-resolve chain $n
+    bench-resolve fanin $n
+done
@@ -1,32 +1,193 @@
 #include "cache.h"
 
 #include "hash.h"
+#include "table.h"
 #include "util.h"
 
-// TODO overlaps with object file functions in hash.c
+#include <dirent.h>
+#include <sys/file.h>
+#include <zlib.h>
 
-static char* cache_path(const struct job* job) {
-    const char* hex = oid_to_hex(&job->object.oid);
-    static char filename[PATH_MAX];
-    if (snprintf(filename, PATH_MAX, "%s/cache/%c%c/%s",
-                 get_knit_dir(), hex[0], hex[1], &hex[2]) >= PATH_MAX)
-        die("path too long");
-    return filename;
+#define CACHE_LOG_SIGNATURE 0x4b434c47 // "KCLG"
+#define CACHE_INDEX_SIGNATURE 0x4b434958 // "KCIX"
+#define CACHE_INDEX_VERSION 1
+
+// Compact once the log holds more records than the index, and at least this
+// many, so compaction is amortized over the entries it writes.
+#define CACHE_COMPACT_MIN_RECORDS 4096
+
+// On disk, all integers are big endian.
+struct cache_log_record {
+    uint32_t signature;
+    uint8_t job[KNIT_HASH_RAWSZ];
+    uint8_t prd[KNIT_HASH_RAWSZ];
+    uint32_t checksum;  // crc32 of the preceding fields
+};
+
+struct cache_index_header {
+    uint32_t signature;
+    uint32_t version;
+    uint32_t num_slots;  // a power of 2
+    uint32_t num_entries;
+};
+
+// Empty slots are all zero. Slots are probed linearly from the job hash.
+struct cache_index_slot {
+    uint8_t job[KNIT_HASH_RAWSZ];
+    uint8_t prd[KNIT_HASH_RAWSZ];
+};
+
+// Keyed by job.
+struct cache_entry {
+    struct object_id job;
+    struct object_id prd;
+};
+
+// Entries read from the log or written by this process.
+static struct table entries;
+
+static struct bytebuf index_bb;
+static const struct cache_index_header* index_hdr;  // NULL if no valid index
+static size_t num_indexed;
+static int log_fd = -1;
+static int has_legacy;
+static int is_loaded;
+
+static char cache_dir[PATH_MAX];
+static char log_path[PATH_MAX];
+static char index_path[PATH_MAX];
+
+static size_t hash_key(const uint8_t* hash) {
+    // Object ids are already uniformly distributed.
+    return get_be64(hash);
 }
 
-int open_cache_file(const struct job* job) {
-    if (job->is_nocache)
-        return -1;
-    int fd = open(cache_path(job), O_RDONLY);
-    if (fd < 0 && errno != ENOENT)
-        warning_errno("could not open cache file");
-    return fd;
+static void set_entry(const uint8_t* job, const uint8_t* prd) {
+    struct cache_entry* entry = table_insert(&entries, job, NULL);
+    memcpy(entry->prd.hash, prd, KNIT_HASH_RAWSZ);
 }
 
-struct production* read_cache(const struct job* job) {
-    int fd = open_cache_file(job);
-    if (fd < 0)
+static int is_zero_hash(const uint8_t* hash) {
+    for (size_t i = 0; i < KNIT_HASH_RAWSZ; i++) {
+        if (hash[i])
+            return 0;
+    }
+    return 1;
+}
+
+static const uint8_t* find_index_prd(const struct object_id* job) {
+    if (!index_hdr)
         return NULL;
+    const struct cache_index_slot* slots = (const void*)(index_hdr + 1);
+    size_t num_slots = ntohl(index_hdr->num_slots);
+    size_t i = hash_key(job->hash) & (num_slots - 1);
+    // Bound the probe in case the index is corrupt and has no empty slots.
+    for (size_t n = 0; n < num_slots; n++, i = (i + 1) & (num_slots - 1)) {
+        if (!memcmp(slots[i].job, job->hash, KNIT_HASH_RAWSZ))
+            return slots[i].prd;
+        if (is_zero_hash(slots[i].job))
+            break;
+    }
+    return NULL;
+}
+
+static void unload_index() {
+    cleanup_bytebuf(&index_bb);
+    index_hdr = NULL;
+}
+
+static void load_index() {
+    unload_index();
+    int fd = open(index_path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            warning_errno("cannot open %s", index_path);
+        return;
+    }
+    if (mmap_fd(fd, &index_bb) < 0) {
+        warning_errno("cannot mmap %s", index_path);
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    const struct cache_index_header* hdr = index_bb.data;
+    size_t num_slots = index_bb.size >= sizeof(*hdr) ? ntohl(hdr->num_slots) : 0;
+    if (index_bb.size < sizeof(*hdr) ||
+            ntohl(hdr->signature) != CACHE_INDEX_SIGNATURE ||
+            ntohl(hdr->version) != CACHE_INDEX_VERSION ||
+            !num_slots || (num_slots & (num_slots - 1)) ||
+            index_bb.size != sizeof(*hdr) +
+                num_slots * sizeof(struct cache_index_slot)) {
+        warning("ignoring invalid %s", index_path);
+        cleanup_bytebuf(&index_bb);
+        return;
+    }
+    index_hdr = hdr;
+    num_indexed = ntohl(hdr->num_entries);
+}
+
+static uint32_t record_checksum(const struct cache_log_record* rec) {
+    return crc32(0, (const Bytef*)rec, offsetof(struct cache_log_record, checksum));
+}
+
+static void lock_log(int op) {
+    while (flock(log_fd, op) < 0) {
+        if (errno != EINTR) {
+            warning_errno("cannot lock %s", log_path);
+            return;
+        }
+    }
+}
+
+// Read all records in the log into entries. The caller should hold a lock.
+static void read_log() {
+    struct bytebuf bb;
+    if (mmap_fd(log_fd, &bb) < 0) {
+        warning_errno("cannot mmap %s", log_path);
+        return;
+    }
+
+    // Records are normally back to back, but a crash may leave a partial one
+    // behind, and later appends then follow it unaligned. Resynchronize by
+    // scanning for the next record with a valid signature and checksum.
+    size_t off = 0;
+    struct cache_log_record rec;
+    while (bb.size - off >= sizeof(rec)) {
+        memcpy(&rec, (char*)bb.data + off, sizeof(rec));
+        if (ntohl(rec.signature) != CACHE_LOG_SIGNATURE ||
+                ntohl(rec.checksum) != record_checksum(&rec)) {
+            off++;
+            continue;
+        }
+        set_entry(rec.job, rec.prd);
+        off += sizeof(rec);
+    }
+    cleanup_bytebuf(&bb);
+}
+
+static int is_hex(const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!isxdigit(s[i]) || isupper(s[i]))
+            return 0;
+    }
+    return s[len] == '\0';
+}
+
+enum legacy_scan {
+    LEGACY_PROBE,   // stop at the first file
+    LEGACY_READ,    // read files into entries without overriding newer ones
+    LEGACY_REMOVE,  // remove files and their directories
+};
+
+// Legacy cache files contain the hex production id and a newline.
+static int read_legacy_file(const char* filename, struct object_id* oid) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            warning_errno("could not open cache file");
+        return -1;
+    }
 
     char buf[KNIT_HASH_HEXSZ + 2];
     int rc;
@@ -41,56 +202,252 @@ struct production* read_cache(const struct job* job) {
         warning_errno("read cache error");
     close(fd);
 
-    struct object_id oid;
     if (len != KNIT_HASH_HEXSZ + 1 || buf[KNIT_HASH_HEXSZ] != '\n' ||
-            hex_to_oid(buf, &oid) < 0) {
-        warning("invalid cached production in %s", cache_path(job));
-        return NULL;
+            hex_to_oid(buf, oid) < 0) {
+        warning("invalid cached production in %s", filename);
+        return -1;
     }
-
-    return get_production(&oid);
+    return 0;
 }
 
-static int mkstemp_mode(char* template, mode_t mode) {
-    int fd = mkstemp(template);
-    if (fd >= 0) {
-        mode_t orig_mask = umask(0);
-        umask(orig_mask);
-        fchmod(fd, mode & ~orig_mask);
+// Walk the legacy cache/xx/<hex> files. Returns the number of files seen.
+static int scan_legacy_dir(enum legacy_scan mode) {
+    DIR* dir = opendir(cache_dir);
+    if (!dir) {
+        if (errno != ENOENT)
+            warning_errno("cannot open %s", cache_dir);
+        return 0;
     }
-    return fd;
+
+    int num_files = 0;
+    struct dirent* dent;
+    while (errno = 0, (dent = readdir(dir))) {
+        if (!is_hex(dent->d_name, 2))
+            continue;
+
+        char subdir_name[PATH_MAX];
+        if (snprintf(subdir_name, PATH_MAX, "%s/%s",
+                     cache_dir, dent->d_name) >= PATH_MAX)
+            die("path too long");
+        DIR* subdir = opendir(subdir_name);
+        if (!subdir) {
+            warning_errno("cannot open %s", subdir_name);
+            continue;
+        }
+
+        struct dirent* sub_dent;
+        while (errno = 0, (sub_dent = readdir(subdir))) {
+            if (!is_hex(sub_dent->d_name, KNIT_HASH_HEXSZ - 2))
+                continue;
+            num_files++;
+            if (mode == LEGACY_PROBE)
+                break;
+
+            char filename[PATH_MAX];
+            char hex[KNIT_HASH_HEXSZ + 1];
+            stpcpy(stpcpy(hex, dent->d_name), sub_dent->d_name);
+            if (snprintf(filename, PATH_MAX, "%s/%s",
+                         subdir_name, sub_dent->d_name) >= PATH_MAX)
+                die("path too long");
+
+            struct object_id job;
+            struct object_id prd;
+            if (mode == LEGACY_REMOVE) {
+                if (unlink(filename) < 0)
+                    warning_errno("cannot remove %s", filename);
+            } else if (hex_to_oid(hex, &job) == 0 &&
+                       read_legacy_file(filename, &prd) == 0) {
+                int is_new;
+                struct cache_entry* entry = table_insert(&entries, job.hash, &is_new);
+                if (is_new)
+                    memcpy(entry->prd.hash, prd.hash, KNIT_HASH_RAWSZ);
+            }
+        }
+        if (errno != 0)
+            warning_errno("readdir");
+        closedir(subdir);
+        if (mode == LEGACY_REMOVE && rmdir(subdir_name) < 0)
+            warning_errno("cannot remove %s", subdir_name);
+        if (num_files && mode == LEGACY_PROBE)
+            break;
+    }
+    if (errno != 0)
+        warning_errno("readdir");
+    closedir(dir);
+    return num_files;
 }
 
-static int move_temp_to_file(const char* tmpfile, const char* filename) {
-    int ret = rename(tmpfile, filename);
-    if (ret < 0 && errno == ENOENT) {
-        // Retry after trying to create the cache subdirectory.
-        char* dir = strrchr(filename, '/');
-        *dir = '\0';
-        mkdir(filename, 0777);
-        *dir = '/';
-        return rename(tmpfile, filename);
+static void load_cache() {
+    is_loaded = 1;
+    init_table(&entries, sizeof(struct cache_entry), sizeof(struct object_id));
+
+    if (snprintf(cache_dir, PATH_MAX, "%s/cache", get_knit_dir()) >= PATH_MAX ||
+            snprintf(log_path, PATH_MAX, "%s/log", cache_dir) >= PATH_MAX ||
+            snprintf(index_path, PATH_MAX, "%s/index", cache_dir) >= PATH_MAX)
+        die("path too long");
+
+    log_fd = open(log_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    if (log_fd < 0) {
+        warning_errno("cannot open %s", log_path);
+        load_index();
+    } else {
+        // Hold the lock so a concurrent compaction cannot truncate the log
+        // between our reading the old index and the log.
+        lock_log(LOCK_SH);
+        load_index();
+        read_log();
+        lock_log(LOCK_UN);
     }
-    return ret;
+    has_legacy = scan_legacy_dir(LEGACY_PROBE) > 0;
+}
+
+static char* legacy_cache_path(const struct job* job) {
+    const char* hex = oid_to_hex(&job->object.oid);
+    static char filename[PATH_MAX];
+    if (snprintf(filename, PATH_MAX, "%s/%c%c/%s",
+                 cache_dir, hex[0], hex[1], &hex[2]) >= PATH_MAX)
+        die("path too long");
+    return filename;
+}
+
+struct production* read_cache(const struct job* job) {
+    if (job->is_nocache)
+        return NULL;
+    if (!is_loaded)
+        load_cache();
+
+    // The log is read once per process, so entries appended later by other
+    // processes are misses; the job then simply runs again.
+    const struct cache_entry* entry = table_find(&entries, &job->object.oid);
+    if (entry)
+        return get_production(&entry->prd);
+    const uint8_t* prd = find_index_prd(&job->object.oid);
+    if (prd)
+        return get_production(oid_of_hash(prd));
+
+    struct object_id oid;
+    if (has_legacy && read_legacy_file(legacy_cache_path(job), &oid) == 0)
+        return get_production(&oid);
+    return NULL;
+}
+
+static int should_compact(off_t log_size) {
+    size_t num_records = log_size / sizeof(struct cache_log_record);
+    return num_records >= CACHE_COMPACT_MIN_RECORDS && num_records > num_indexed;
 }
 
 int write_cache(const struct job* job, const struct production* prd) {
     if (job->is_nocache)
         return 0;
+    if (!is_loaded)
+        load_cache();
+    if (log_fd < 0)
+        return error("cannot write cache to %s", log_path);
+
+    struct cache_log_record rec = {
+        .signature = htonl(CACHE_LOG_SIGNATURE),
+    };
+    memcpy(rec.job, job->object.oid.hash, KNIT_HASH_RAWSZ);
+    memcpy(rec.prd, prd->object.oid.hash, KNIT_HASH_RAWSZ);
+    rec.checksum = htonl(record_checksum(&rec));
 
-    char tmpfile[PATH_MAX];
-    if (snprintf(tmpfile, PATH_MAX, "%s/tmp-XXXXXX", get_knit_dir()) >= PATH_MAX)
-        return error("path too long");
-    int fd = mkstemp_mode(tmpfile, 0666);
-    if (fd < 0)
-        return error_errno("cannot open cache temp file");
-    if (dprintf(fd, "%s\n", oid_to_hex(&prd->object.oid)) < 0)
-        return error_errno("write failed");
-    if (close(fd) < 0)
-        return error_errno("close failed");
+    // With O_APPEND, a single write() lands whole at the end of the log even
+    // with concurrent writers. The shared lock only excludes compaction.
+    lock_log(LOCK_SH);
+    ssize_t nr = xwrite(log_fd, &rec, sizeof(rec));
+    int saved_errno = errno;
+    struct stat st;
+    int is_full = nr == sizeof(rec) && fstat(log_fd, &st) == 0 &&
+        should_compact(st.st_size);
+    lock_log(LOCK_UN);
+    if (nr != sizeof(rec)) {
+        errno = nr < 0 ? saved_errno : ENOSPC;
+        return error_errno("cannot append to %s", log_path);
+    }
 
-    if (move_temp_to_file(tmpfile, cache_path(job)) < 0)
-        return error_errno("failed to rename cache file");
+    set_entry(rec.job, rec.prd);
 
+    // The entry is already durable in the log, so compaction is best effort.
+    if (is_full && compact_cache() < 0)
+        warning("cache compaction failed");
+    return 0;
+}
+
+static int write_index(FILE* fh) {
+    size_t num_entries = entries.num_entries;
+    size_t num_slots = 64;
+    while (4 * num_entries > 3 * num_slots)
+        num_slots *= 2;
+    size_t size = sizeof(struct cache_index_header) +
+        num_slots * sizeof(struct cache_index_slot);
+    char* buf = xmalloc(size);
+    memset(buf, 0, size);
+
+    struct cache_index_header* hdr = (struct cache_index_header*)buf;
+    hdr->signature = htonl(CACHE_INDEX_SIGNATURE);
+    hdr->version = htonl(CACHE_INDEX_VERSION);
+    hdr->num_slots = htonl(num_slots);
+    hdr->num_entries = htonl(num_entries);
+
+    struct cache_index_slot* slots = (struct cache_index_slot*)(hdr + 1);
+    for (size_t i = 0; i < entries.alloc_entries; i++) {
+        const struct cache_entry* entry = table_slot(&entries, i);
+        if (!entry)
+            continue;
+        size_t j = hash_key(entry->job.hash) & (num_slots - 1);
+        while (!is_zero_hash(slots[j].job))
+            j = (j + 1) & (num_slots - 1);
+        memcpy(slots[j].job, entry->job.hash, KNIT_HASH_RAWSZ);
+        memcpy(slots[j].prd, entry->prd.hash, KNIT_HASH_RAWSZ);
+    }
+
+    int rc = fwrite(buf, size, 1, fh) == 1 ? 0 : -1;
+    free(buf);
+    return rc;
+}
+
+int compact_cache() {
+    if (!is_loaded)
+        load_cache();
+    if (log_fd < 0)
+        return error("cannot compact cache in %s", cache_dir);
+
+    lock_log(LOCK_EX);
+
+    // Start over from what is on disk, since other processes may have
+    // appended or compacted since we loaded. The log overrides the index,
+    // and both override legacy files.
+    clear_table(&entries);
+    load_index();
+    if (index_hdr) {
+        const struct cache_index_slot* slots = (const void*)(index_hdr + 1);
+        for (size_t i = 0; i < ntohl(index_hdr->num_slots); i++) {
+            if (!is_zero_hash(slots[i].job))
+                set_entry(slots[i].job, slots[i].prd);
+        }
+    }
+    read_log();
+    if (has_legacy)
+        scan_legacy_dir(LEGACY_READ);
+
+    // The index and cache/ are synced so the rename is durable before the
+    // log is truncated, or a crash could keep the empty log with the old index.
+    if (replace_file(index_path, 0444, write_index, 1) < 0) {
+        error_errno("cannot write %s", index_path);
+        lock_log(LOCK_UN);
+        return -1;
+    }
+
+    // Every entry is in the new index, so the log can be emptied. Entries
+    // stay in memory; the old index mapping is no longer needed.
+    if (ftruncate(log_fd, 0) < 0)
+        warning_errno("cannot truncate %s", log_path);
+    unload_index();
+    num_indexed = entries.num_entries;
+    if (has_legacy) {
+        scan_legacy_dir(LEGACY_REMOVE);
+        has_legacy = 0;
+    }
+    lock_log(LOCK_UN);
     return 0;
 }
@@ -3,8 +3,24 @@
 #include "job.h"
 #include "production.h"
 
+// Cached productions of jobs are kept in two files under $KNIT_DIR/cache/:
+//
+//   log    Append-only (job, production) records from write_cache(). Each is
+//          appended with a single write() while holding a shared flock on the
+//          log, and carries a checksum so a record torn by a crash is skipped
+//          instead of misread.
+//   index  An open-addressing hash table of compacted records, looked up
+//          through mmap. It is only ever replaced by rename.
+//
+// Once the log outgrows the index, the writer compacts them: holding an
+// exclusive flock on the log, it writes a new index of every entry, syncs it
+// and cache/ so the rename is durable, and then truncates the log. A crash in
+// between only leaves duplicate entries.
+//
+// Older versions stored each entry in its own file cache/xx/<hex>. These are
+// still read, and compaction folds them into the index and removes them.
+
 struct production* read_cache(const struct job* job);
 int write_cache(const struct job* job, const struct production* prd);
-// Open cache file for read. Return its file descriptor, or -1 if nonexistent or
-// on error.
-int open_cache_file(const struct job* job);
+// Fold the log and any per-file entries into a new index.
+int compact_cache();
@@ -0,0 +1,247 @@
+#include "cmd.h"
+
+#include "config.h"
+#include "hash.h"
+#include "resource.h"
+#include "unpack.h"
+
+#include <ftw.h>
+
+static int remove_entry(const char* filename, const struct stat* /*st*/,
+                        int /*type*/, struct FTW* /*ftw*/) {
+    return remove(filename) < 0 ? -1 : 0;
+}
+
+static int remove_tree(const char* dir) {
+    return nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+int is_native_dispatch() {
+    static int enabled = -1;
+    if (enabled < 0) {
+        const char* value = get_config("dispatch");
+        if (!value || !strcmp(value, "native"))
+            enabled = 1;
+        else if (!strcmp(value, "script"))
+            enabled = 0;
+        else
+            die("invalid config dispatch %s", value);
+    }
+    return enabled;
+}
+
+char** parse_cmd_args(char* buf, size_t size) {
+    char** args = NULL;
+    size_t alloc_args = 0;
+    size_t num_args = 0;
+
+    char* p = buf;
+    char* end = p + size;
+    do {
+        if (num_args + 1 >= alloc_args) {
+            alloc_args = (alloc_args + 16) * 2;
+            args = xrealloc(args, alloc_args * sizeof(char*));
+        }
+        args[num_args++] = p;
+        p = memchr(p, '\0', end + 1 - p);
+        assert(p);
+        p++;
+    } while (p < end);
+    args[num_args] = NULL;
+    return args;
+}
+
+int putenv_environ(char* buf, size_t size) {
+    if (size && buf[size - 1] != '\0')
+        return -1;
+    char* end = buf + size;
+    while (buf < end) {
+        putenv(buf);
+        while (*buf++)
+            continue;
+    }
+    return 0;
+}
+
+static int make_scratch_dirs(const char* scratch) {
+    char path[PATH_MAX];
+    struct stat st;
+    if (!lstat(scratch, &st)) {
+        warning("removing %s", scratch);
+        if (remove_tree(scratch) < 0)
+            return error_errno("cannot remove %s", scratch);
+    }
+    if (mkdir(scratch, 0777) < 0)
+        return error_errno("cannot mkdir %s", scratch);
+    static const char* subdirs[] = { "out.knit", "work", NULL };
+    for (const char** subdir = subdirs; *subdir; subdir++) {
+        if (snprintf(path, PATH_MAX, "%s/%s", scratch, *subdir) >= PATH_MAX)
+            return error("path too long");
+        if (mkdir(path, 0777) < 0)
+            return error_errno("cannot mkdir %s", path);
+    }
+    return 0;
+}
+
+// In a child process, run args in work_dir as knit-exec-cmd does: with the
+// job's variables (NUL-terminated in env) set, stdin closed, and output to
+// log_fd. Like any execvp(), a script without #! is run by /bin/sh.
+[[noreturn]]
+static void exec_cmd(char** args, struct bytebuf* env, const char* work_dir,
+                     int log_fd) {
+    if (putenv_environ(env->data, env->size) < 0) {
+        error("unterminated environ");
+        _exit(1);
+    }
+    if (chdir(work_dir) < 0) {
+        perror("chdir");
+        _exit(1);
+    }
+
+    // Our stdin may already be closed, and log_fd in its place, so close it
+    // only once done with fds.
+    int stderr_fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+    if (stderr_fd < 0 || dup2(log_fd, STDOUT_FILENO) < 0 ||
+            dup2(log_fd, STDERR_FILENO) < 0) {
+        perror("fcntl/dup2");
+        _exit(1);
+    }
+    close(STDIN_FILENO);
+
+    execvp(args[0], args); // should not return
+    dup2(stderr_fd, STDERR_FILENO);
+    perror("exec");
+    _exit(1);
+}
+
+// Unpack the job into scratch and run its command. Returns its wait status,
+// or -1 on error.
+static int unpack_and_exec(struct job* job, const char* scratch) {
+    if (make_scratch_dirs(scratch) < 0)
+        return -1;
+
+    char work_dir[PATH_MAX];
+    char path[PATH_MAX];
+    if (snprintf(path, PATH_MAX, "%s/work", scratch) >= PATH_MAX ||
+            !realpath(path, work_dir))
+        return error_errno("cannot resolve %s", path);
+    if (unpack_resources(&job->inputs, OBJ_JOB, work_dir, NULL) < 0)
+        return -1;
+    // Keep environ where knit-dispatch-job puts it.
+    char environ_path[PATH_MAX];
+    if (snprintf(path, PATH_MAX, "%s/environ", work_dir) >= PATH_MAX ||
+            snprintf(environ_path, PATH_MAX, "%s/environ", scratch) >= PATH_MAX)
+        return error("path too long");
+    struct bytebuf env = {0};
+    if (rename(path, environ_path) < 0) {
+        if (errno != ENOENT)
+            return error_errno("cannot rename %s", path);
+    } else if (slurp_file(environ_path, &env) < 0) {
+        return -1;
+    }
+    if (snprintf(path, PATH_MAX, "%s/out", work_dir) >= PATH_MAX)
+        return error("path too long");
+    if (mkdir(path, 0777) < 0)
+        return error_errno("cannot mkdir %s", path);
+
+    struct resource_entry* cmd = resource_list_find(&job->inputs, JOB_INPUT_CMD);
+    if (!cmd)
+        return error("job %s has no %s", oid_to_hex(&job->object.oid), JOB_INPUT_CMD);
+    struct bytebuf bb;
+    if (read_object_view_of_type(&cmd->res->object.oid, OBJ_RESOURCE, &bb) < 0)
+        return -1;
+    ensure_bytebuf_null_terminated(&bb);
+    char** args = parse_cmd_args(bb.data, bb.size);
+
+    if (snprintf(path, PATH_MAX, "%s/out.knit/log", scratch) >= PATH_MAX)
+        die("path too long");
+    int log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (log_fd < 0)
+        return error_errno("cannot open %s", path);
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0)
+        die_errno("fork failed");
+    if (!pid)
+        exec_cmd(args, &env, work_dir, log_fd);
+
+    close(log_fd);
+    free(args);
+    cleanup_bytebuf(&bb);
+    cleanup_bytebuf(&env);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            die_errno("waitpid failed");
+    }
+    return status;
+}
+
+// Store the production of a command that exited with status (from waitpid()).
+static struct production* store_cmd_production(struct job* job,
+                                               const char* scratch, int status) {
+    // Report the exit code as bash does.
+    int code = 1;
+    if (WIFEXITED(status))
+        code = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+        code = 128 + WTERMSIG(status);
+
+    char path[PATH_MAX];
+    struct stat st;
+    if (snprintf(path, PATH_MAX, "%s/work/out/.knit", scratch) >= PATH_MAX)
+        die("path too long");
+    if (!lstat(path, &st))
+        warning("discarding %s", path);
+
+    struct resource_list outputs = {0};
+    path[strlen(path) - strlen("/.knit")] = '\0';
+    if (resource_list_append_dir_files(&outputs, path, "") < 0) {
+        error_errno("directory traversal failed on %s", path);
+        return NULL;
+    }
+    if (snprintf(path, PATH_MAX, "%s/out.knit/log", scratch) >= PATH_MAX)
+        die("path too long");
+    struct resource* res;
+    if (!stat(path, &st) && st.st_size > 0) {
+        if (!(res = store_resource_file(path)))
+            return NULL;
+        resource_list_append(&outputs, PRODUCTION_OUTPUT_LOG, res);
+    }
+    char exitcode[16];
+    int len = snprintf(exitcode, sizeof(exitcode), "%d\n", code);
+    if (!(res = store_resource(exitcode, len)))
+        return NULL;
+    resource_list_append(&outputs, PRODUCTION_OUTPUT_EXITCODE, res);
+    if (code == 0)
+        resource_list_append(&outputs, PRODUCTION_OUTPUT_OK, get_empty_resource());
+
+    resource_list_sort(&outputs);
+    struct production* prd = store_production(job, NULL, &outputs);
+    // Names of outputs from the directory are ours to free. It has no .knit/
+    // outputs, whose names are static.
+    for (size_t i = 0; i < outputs.num_entries; i++) {
+        if (strncmp(outputs.entries[i].name, JOB_INPUT_RESERVED_PREFIX,
+                    strlen(JOB_INPUT_RESERVED_PREFIX)))
+            free(outputs.entries[i].name);
+    }
+    free(outputs.entries);
+    return prd;
+}
+
+struct production* run_cmd(struct job* job) {
+    char scratch[PATH_MAX];
+    if (snprintf(scratch, PATH_MAX, "%s/scratch/%s",
+                 get_knit_dir(), oid_to_hex(&job->object.oid)) >= PATH_MAX)
+        die("path too long");
+
+    int status = unpack_and_exec(job, scratch);
+    if (status < 0)
+        return NULL;
+    struct production* prd = store_cmd_production(job, scratch, status);
+    if (prd && remove_tree(scratch) < 0)
+        warning_errno("cannot remove %s", scratch);
+    return prd;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "job.h"
+#include "production.h"
+
+// Run cmd jobs without knit-dispatch-job's process per step: knit-run-cmd
+// unpacks the job into $KNIT_DIR/scratch/<job>, runs its command in work/ with
+// its output logged, and stores a production of work/out/ along with the log
+// and exit code. With "dispatch = script" in the config, knit-schedule-jobs
+// leaves cmd jobs to knit-dispatch-job instead.
+
+// Returns whether knit-schedule-jobs should run cmd jobs with knit-run-cmd.
+int is_native_dispatch();
+
+// Run the job's command to completion, store its production and remove its
+// scratch directory. Returns NULL on error.
+struct production* run_cmd(struct job* job);
+
+// Split the NUL-separated arguments of a job's .knit/cmd in buf, which must be
+// NUL-terminated. The arguments point into buf.
+char** parse_cmd_args(char* buf, size_t size);
+
+// Set the job variables in buf, an environ file of NUL-terminated
+// <name>=<value> strings (see unpack.h). buf must outlive them. Returns -1 if
+// the last string is unterminated.
+int putenv_environ(char* buf, size_t size);
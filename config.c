@@ -0,0 +1,74 @@
+#include "config.h"
+
+struct config_list {
+    struct config_list* next;
+    char* key;
+    char* value;
+};
+
+static struct config_list* config;
+static int config_loaded;
+
+static char* trim(char* s, char* end) {
+    while (s < end && isspace(*s))
+        s++;
+    while (end > s && isspace(end[-1]))
+        end--;
+    *end = '\0';
+    return s;
+}
+
+static void load_config() {
+    config_loaded = 1;
+
+    char filename[PATH_MAX];
+    if (snprintf(filename, PATH_MAX, "%s/config", get_knit_dir()) >= PATH_MAX)
+        die("path too long");
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            die_errno("cannot open %s", filename);
+        return;
+    }
+    struct bytebuf bb; // never deallocated; config entries point into it
+    if (slurp_fd(fd, &bb) < 0)
+        die_errno("cannot read %s", filename);
+    close(fd);
+
+    struct config_list** list_p = &config;
+    char* end = (char*)bb.data + bb.size;
+    int lineno = 0;
+    for (char* line = bb.data; line < end; ) {
+        char* nl = memchr(line, '\n', end - line);
+        if (!nl)
+            nl = end;
+        lineno++;
+
+        char* s = trim(line, nl);
+        line = nl + 1;
+        if (!*s || *s == '#')
+            continue;
+        char* eq = strchr(s, '=');
+        if (!eq)
+            die("%s:%d: expected <key> = <value>", filename, lineno);
+
+        struct config_list* entry = xmalloc(sizeof(*entry));
+        entry->value = trim(eq + 1, eq + strlen(eq));
+        entry->key = trim(s, eq);
+        entry->next = NULL;
+        *list_p = entry;
+        list_p = &entry->next;
+    }
+}
+
+const char* get_config(const char* key) {
+    if (!config_loaded)
+        load_config();
+    // Later entries take precedence.
+    const char* value = NULL;
+    for (struct config_list* entry = config; entry; entry = entry->next) {
+        if (!strcmp(entry->key, key))
+            value = entry->value;
+    }
+    return value;
+}
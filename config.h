@@ -0,0 +1,23 @@
+#pragma once
+
+#include "util.h"
+
+// Repository configuration is read from $KNIT_DIR/config, where each line is
+// of the form
+//
+//   <key> = <value>
+//
+// Blank lines and lines starting with # are ignored. Known keys:
+//
+//   compression  Algorithm for storing new objects: none (default) or zlib.
+//   cpus         Job slots for cmd jobs when knit-schedule-jobs is not given
+//                -j: unlimited by default. Steps declaring cpus=N take N.
+//   dispatch     How knit-schedule-jobs runs cmd jobs: native (default), with
+//                knit-run-cmd, or script, with knit-dispatch-job.
+//   materialize  How job inputs are placed in job directories: copy
+//                (default), reflink, hardlink or symlink. See hash.h.
+//   memory       Memory for cmd jobs declaring memory=<size> to share, such as
+//                64G: physical memory by default.
+
+// Returns the configured value, or NULL if key is unset.
+const char* get_config(const char* key);
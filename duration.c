@@ -0,0 +1,197 @@
+#include "duration.h"
+
+#include "table.h"
+
+#define DURATIONS_SIGNATURE 0x4b445552 // "KDUR"
+#define DURATIONS_VERSION 1
+
+// Past this many entries, history not used by the current process is dropped
+// when saving.
+#define DURATIONS_MAX_ENTRIES (1 << 18)
+
+#define KEY_JOB  1
+#define KEY_NAME 2
+
+struct durations_header {
+    uint32_t signature;
+    uint32_t version;
+    uint32_t num_entries;
+};
+
+// On disk, all integers are big endian. Jobs are keyed by object id, and step
+// names by a 64-bit hash (in the first 8 bytes of key, the rest zero).
+struct durations_record {
+    uint8_t key[KNIT_HASH_RAWSZ];
+    uint8_t ns[8];
+    uint32_t kind;
+    uint32_t reserved;
+};
+
+struct durations_key {
+    uint8_t hash[KNIT_HASH_RAWSZ];
+    uint32_t kind;
+};
+
+struct durations_entry {
+    struct durations_key key;
+    uint64_t ns;
+    unsigned is_used : 1;
+    unsigned is_recorded : 1;
+};
+
+static struct table entries;
+static int is_loaded;
+static int is_dirty;
+
+static struct durations_key make_key(const uint8_t* hash, uint32_t kind) {
+    struct durations_key key = { .kind = kind };
+    memcpy(key.hash, hash, KNIT_HASH_RAWSZ);
+    return key;
+}
+
+// FNV-1a, which is plenty to tell step names apart.
+static void name_key(const char* name, uint8_t* key) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const char* p = name; *p; p++)
+        h = (h ^ (uint8_t)*p) * 0x100000001b3ull;
+    memset(key, 0, KNIT_HASH_RAWSZ);
+    put_be64(key, h);
+}
+
+static char* durations_path() {
+    static char filename[PATH_MAX];
+    if (snprintf(filename, PATH_MAX, "%s/durations", get_knit_dir()) >= PATH_MAX)
+        die("path too long");
+    return filename;
+}
+
+// Read the history file into the table, keeping any durations recorded by
+// this process over those in the file.
+static void read_durations() {
+    struct bytebuf bb;
+    int fd = open(durations_path(), O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            warning_errno("cannot open %s", durations_path());
+        return;
+    }
+    if (mmap_fd(fd, &bb) < 0) {
+        warning_errno("cannot mmap %s", durations_path());
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    const struct durations_header* hdr = bb.data;
+    if (bb.size < sizeof(*hdr) ||
+            ntohl(hdr->signature) != DURATIONS_SIGNATURE ||
+            ntohl(hdr->version) != DURATIONS_VERSION ||
+            bb.size != sizeof(*hdr) +
+                ntohl(hdr->num_entries) * sizeof(struct durations_record)) {
+        warning("ignoring invalid %s", durations_path());
+        cleanup_bytebuf(&bb);
+        return;
+    }
+
+    const struct durations_record* rec = (const void*)(hdr + 1);
+    for (size_t i = 0; i < ntohl(hdr->num_entries); i++, rec++) {
+        struct durations_key key = make_key(rec->key, ntohl(rec->kind));
+        struct durations_entry* entry = table_insert(&entries, &key, NULL);
+        if (!entry->is_recorded)
+            entry->ns = get_be64(rec->ns);
+    }
+    cleanup_bytebuf(&bb);
+}
+
+static void load_durations() {
+    is_loaded = 1;
+    init_table(&entries, sizeof(struct durations_entry), sizeof(struct durations_key));
+    read_durations();
+}
+
+static struct durations_entry* lookup(const uint8_t* hash, uint32_t kind) {
+    struct durations_key key = make_key(hash, kind);
+    struct durations_entry* entry = table_find(&entries, &key);
+    if (entry)
+        entry->is_used = 1;
+    return entry;
+}
+
+uint64_t estimate_duration(const struct object_id* job_oid, const char* step_name) {
+    if (!is_loaded)
+        load_durations();
+    struct durations_entry* entry;
+    if (job_oid && (entry = lookup(job_oid->hash, KEY_JOB)))
+        return entry->ns;
+    uint8_t key[KNIT_HASH_RAWSZ];
+    name_key(step_name, key);
+    if ((entry = lookup(key, KEY_NAME)))
+        return entry->ns;
+    return 0;
+}
+
+void record_duration(const struct object_id* job_oid, const char* step_name,
+                     uint64_t ns) {
+    if (!is_loaded)
+        load_durations();
+    struct durations_key key = make_key(job_oid->hash, KEY_JOB);
+    struct durations_entry* entry = table_insert(&entries, &key, NULL);
+    entry->ns = ns;
+    entry->is_used = entry->is_recorded = 1;
+
+    uint8_t hash[KNIT_HASH_RAWSZ];
+    name_key(step_name, hash);
+    key = make_key(hash, KEY_NAME);
+    int is_new;
+    entry = table_insert(&entries, &key, &is_new);
+    entry->ns = is_new ? ns : entry->ns / 2 + ns / 2;
+    entry->is_used = entry->is_recorded = 1;
+    is_dirty = 1;
+}
+
+static int write_durations(FILE* fh) {
+    int only_used = entries.num_entries > DURATIONS_MAX_ENTRIES;
+    size_t num_written = 0;
+    for (size_t i = 0; i < entries.alloc_entries; i++) {
+        const struct durations_entry* entry = table_slot(&entries, i);
+        if (entry && (!only_used || entry->is_used))
+            num_written++;
+    }
+
+    struct durations_header hdr = {
+        .signature = htonl(DURATIONS_SIGNATURE),
+        .version = htonl(DURATIONS_VERSION),
+        .num_entries = htonl(num_written),
+    };
+    if (fwrite(&hdr, sizeof(hdr), 1, fh) != 1)
+        return -1;
+    for (size_t i = 0; i < entries.alloc_entries; i++) {
+        const struct durations_entry* entry = table_slot(&entries, i);
+        if (!entry || (only_used && !entry->is_used))
+            continue;
+        struct durations_record rec = {
+            .kind = htonl(entry->key.kind),
+        };
+        memcpy(rec.key, entry->key.hash, KNIT_HASH_RAWSZ);
+        put_be64(rec.ns, entry->ns);
+        if (fwrite(&rec, sizeof(rec), 1, fh) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+void save_durations() {
+    if (!is_dirty)
+        return;
+
+    // Sessions of nested flows finish while their parents are still running,
+    // so pick up what they saved before replacing the file. Writers that race
+    // each other may still lose durations; the last one wins.
+    read_durations();
+
+    if (replace_file(durations_path(), 0600, write_durations, 0) < 0) {
+        warning_errno("cannot write %s", durations_path());
+        return;
+    }
+    is_dirty = 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "hash.h"
+
+// A persistent history in $KNIT_DIR/durations of how long jobs ran, so the
+// scheduler can start jobs on the critical path first.
+//
+// Durations are recorded both by job and by step name. A job that ran before
+// is expected to take as long again. A step whose job is new (as when its
+// inputs changed) is expected to take about as long as steps of the same name
+// did, which are averaged.
+
+// Returns the expected nanoseconds for a step to run, by its job if known (or
+// job_oid may be NULL), else by its name. Returns 0 without any history.
+uint64_t estimate_duration(const struct object_id* job_oid, const char* step_name);
+void record_duration(const struct object_id* job_oid, const char* step_name,
+                     uint64_t ns);
+
+// Write back the history if anything was recorded, merged with durations that
+// other processes recorded since we loaded it. Failures are only warnings.
+void save_durations();
@@ -0,0 +1,287 @@
+#include "event.h"
+
+#include <signal.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#else
+#include <poll.h>
+#endif
+
+#define MAX_EVENTS_PER_WAIT 256
+
+// Sources whose fds cannot be watched are returned by every wait.
+static struct event_source** always_ready;
+static size_t num_always_ready;
+static size_t alloc_always_ready;
+
+static void add_always_ready(struct event_source* src) {
+    if (num_always_ready == alloc_always_ready) {
+        alloc_always_ready = (alloc_always_ready + 16) * 2;
+        always_ready = xrealloc(always_ready,
+                                alloc_always_ready * sizeof(*always_ready));
+    }
+    src->is_always_ready = 1;
+    src->slot = num_always_ready;
+    always_ready[num_always_ready++] = src;
+}
+
+static void remove_always_ready(struct event_source* src) {
+    assert(always_ready[src->slot] == src);
+    always_ready[src->slot] = always_ready[--num_always_ready];
+    always_ready[src->slot]->slot = src->slot;
+    src->is_always_ready = 0;
+}
+
+#ifdef __linux__
+
+static int epoll_fd = -1;
+
+static void ensure_epoll_fd() {
+    if (epoll_fd < 0 && (epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        die_errno("epoll_create1 failed");
+}
+
+static void watch(struct event_source* src) {
+    ensure_epoll_fd();
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = src };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, src->fd, &ev) < 0) {
+        // Regular files do not support epoll, but never block either.
+        if (errno != EPERM)
+            die_errno("epoll_ctl failed");
+        add_always_ready(src);
+    }
+}
+
+static void unwatch(struct event_source* src) {
+    if (src->is_always_ready)
+        remove_always_ready(src);
+    else if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, src->fd, NULL) < 0)
+        die_errno("epoll_ctl failed");
+}
+
+static int wait_watched(struct event_source** ready, int max_ready,
+                        int timeout) {
+    ensure_epoll_fd();
+    static struct epoll_event events[MAX_EVENTS_PER_WAIT];
+    int n = epoll_wait(epoll_fd, events, max_ready, timeout);
+    for (int i = 0; i < n; i++)
+        ready[i] = events[i].data.ptr;
+    return n;
+}
+
+#else
+
+// Parallel arrays of pollfds and their sources; src->slot indexes both.
+static struct pollfd* pfds;
+static struct event_source** pfd_sources;
+static size_t num_pfds;
+static size_t alloc_pfds;
+
+static void watch(struct event_source* src) {
+    if (num_pfds == alloc_pfds) {
+        alloc_pfds = (alloc_pfds + 16) * 2;
+        pfds = xrealloc(pfds, alloc_pfds * sizeof(*pfds));
+        pfd_sources = xrealloc(pfd_sources, alloc_pfds * sizeof(*pfd_sources));
+    }
+    src->slot = num_pfds;
+    pfds[num_pfds].fd = src->fd;
+    pfds[num_pfds].events = POLLIN;
+    pfds[num_pfds].revents = 0;
+    pfd_sources[num_pfds++] = src;
+}
+
+static void unwatch(struct event_source* src) {
+    assert(pfd_sources[src->slot] == src);
+    num_pfds--;
+    pfds[src->slot] = pfds[num_pfds];
+    pfd_sources[src->slot] = pfd_sources[num_pfds];
+    pfd_sources[src->slot]->slot = src->slot;
+}
+
+static int wait_watched(struct event_source** ready, int max_ready,
+                        int timeout) {
+    if (poll(pfds, num_pfds, timeout) < 0)
+        return -1;
+    int n = 0;
+    for (size_t i = 0; i < num_pfds && n < max_ready; i++) {
+        if (!pfds[i].revents)
+            continue;
+        assert(!(pfds[i].revents & POLLNVAL));
+        ready[n++] = pfd_sources[i];
+    }
+    return n;
+}
+
+#endif
+
+// Without pidfds, SIGCHLD writes to a self-pipe. Once it is readable, every
+// child source is queued to be returned by wait_for_events().
+static int sigchld_pipe[2] = { -1, -1 };
+static struct event_source sigchld_src;
+static struct event_source** children;  // indexed by slot
+static size_t num_children;
+static size_t alloc_children;
+static struct event_source** queued_children;
+static size_t num_queued_children;
+static size_t alloc_queued_children;
+
+static void handle_sigchld(int signo) {
+    (void)signo;
+    int saved_errno = errno;
+    char c = 0;
+    // If the pipe is full, a wakeup is already pending.
+    ssize_t unused = write(sigchld_pipe[1], &c, 1);
+    (void)unused;
+    errno = saved_errno;
+}
+
+static void queue_child(struct event_source* src) {
+    if (src->is_queued)
+        return;
+    if (num_queued_children == alloc_queued_children) {
+        alloc_queued_children = (alloc_queued_children + 16) * 2;
+        queued_children = xrealloc(queued_children,
+                                   alloc_queued_children * sizeof(*queued_children));
+    }
+    src->is_queued = 1;
+    queued_children[num_queued_children++] = src;
+}
+
+static void add_sigchld_child(struct event_source* src) {
+    if (sigchld_pipe[0] < 0) {
+        if (pipe(sigchld_pipe) < 0)
+            die_errno("pipe failed");
+        for (int i = 0; i < 2; i++) {
+            fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+            fcntl(sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+        }
+        struct sigaction act = {
+            .sa_handler = handle_sigchld,
+            .sa_flags = SA_RESTART | SA_NOCLDSTOP,
+        };
+        if (sigaction(SIGCHLD, &act, NULL) < 0)
+            die_errno("sigaction failed");
+        sigchld_src.fd = sigchld_pipe[0];
+        add_event_source(&sigchld_src);
+    }
+
+    if (num_children == alloc_children) {
+        alloc_children = (alloc_children + 16) * 2;
+        children = xrealloc(children, alloc_children * sizeof(*children));
+    }
+    src->slot = num_children;
+    children[num_children++] = src;
+    // The child may have exited before SIGCHLD was handled, so check it once.
+    queue_child(src);
+}
+
+static void remove_sigchld_child(struct event_source* src) {
+    assert(children[src->slot] == src);
+    children[src->slot] = children[--num_children];
+    children[src->slot]->slot = src->slot;
+    if (src->is_queued) {
+        for (size_t i = 0; i < num_queued_children; i++) {
+            if (queued_children[i] == src) {
+                queued_children[i] = queued_children[--num_queued_children];
+                break;
+            }
+        }
+        src->is_queued = 0;
+    }
+}
+
+static void handle_sigchld_ready() {
+    char buf[64];
+    while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+    for (size_t i = 0; i < num_children; i++)
+        queue_child(children[i]);
+}
+
+void add_event_source(struct event_source* src) {
+    src->is_enabled = 1;
+    src->is_always_ready = src->is_child = src->is_queued = 0;
+    watch(src);
+}
+
+void add_child_event_source(struct event_source* src, pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+    if (fd >= 0) {
+        src->fd = fd;
+        add_event_source(src);
+        src->is_child = 1;
+        return;
+    }
+    if (errno != ENOSYS)
+        die_errno("pidfd_open failed");
+#else
+    (void)pid;
+#endif
+    src->fd = -1;
+    src->is_enabled = src->is_always_ready = src->is_queued = 0;
+    src->is_child = 1;
+    add_sigchld_child(src);
+}
+
+void remove_event_source(struct event_source* src) {
+    if (src->is_enabled)
+        unwatch(src);
+    src->is_enabled = 0;
+    if (src->is_child) {
+        // The pidfd belongs to us.
+        if (src->fd >= 0)
+            close(src->fd);
+        else
+            remove_sigchld_child(src);
+        src->fd = -1;
+        src->is_child = 0;
+    }
+}
+
+void enable_event_source(struct event_source* src, int is_enabled) {
+    if (!is_enabled == !src->is_enabled)
+        return;
+    if (is_enabled)
+        watch(src);
+    else
+        unwatch(src);
+    src->is_enabled = !!is_enabled;
+}
+
+int wait_for_events(struct event_source** ready, int max_ready) {
+    if (max_ready > MAX_EVENTS_PER_WAIT)
+        max_ready = MAX_EVENTS_PER_WAIT;
+    for (;;) {
+        int n = 0;
+        for (size_t i = 0; i < num_always_ready && n < max_ready; i++)
+            ready[n++] = always_ready[i];
+        while (num_queued_children > 0 && n < max_ready) {
+            struct event_source* src = queued_children[--num_queued_children];
+            src->is_queued = 0;
+            ready[n++] = src;
+        }
+        if (n == max_ready)
+            return n;
+
+        // Only block if nothing is ready already.
+        int nr = wait_watched(ready + n, max_ready - n, n ? 0 : -1);
+        if (nr < 0)
+            return n ? n : -1;
+
+        // SIGCHLD is handled here, and readies child sources in its place.
+        for (int i = n; i < n + nr; i++) {
+            if (ready[i] == &sigchld_src) {
+                handle_sigchld_ready();
+                ready[i] = ready[n + nr - 1];
+                nr--;
+                break;
+            }
+        }
+        n += nr;
+        if (n > 0)
+            return n;
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "util.h"
+
+// Wait for any of many fds to become readable. On Linux this uses epoll, so a
+// wakeup costs the same however many sources are registered; elsewhere it
+// falls back to poll over a growable array.
+//
+// A source is readable at EOF too. Sources are owned by the caller and must
+// stay put while registered. Fds that cannot be polled (such as regular files)
+// are always ready.
+struct event_source {
+    int fd;
+    void* data;
+    // Private to event.c.
+    size_t slot;
+    unsigned is_enabled : 1;
+    unsigned is_always_ready : 1;
+    unsigned is_child : 1;
+    unsigned is_queued : 1;
+};
+
+// Start watching src->fd, which must not be registered already.
+void add_event_source(struct event_source* src);
+// Stop watching src->fd; this must happen before it is closed.
+void remove_event_source(struct event_source* src);
+// A disabled source stays registered but is never ready.
+void enable_event_source(struct event_source* src, int is_enabled);
+
+// Start watching for child pid to exit, through a pidfd where the platform
+// supports it and SIGCHLD otherwise. The source may be ready before the child
+// can be reaped, so reap it with WNOHANG. remove_event_source() once reaped.
+void add_child_event_source(struct event_source* src, pid_t pid);
+
+// Block until some sources are ready and store up to max_ready of them. Returns
+// the number stored, or -1 with errno set (notably EINTR).
+int wait_for_events(struct event_source** ready, int max_ready);
@@ -1,12 +1,17 @@
 #include "hash.h"
 
+#include "config.h"
+#include "pack.h"
+
+#include <zlib.h>
+
 // The "modern" EVP API is clunky. We probably won't use it but could vendor an
 // implementation of SHA-256 to avoid this API deprecation.
 #define OPENSSL_SUPPRESS_DEPRECATED
 #include <openssl/sha.h>
 
 struct object_id* oid_of_hash(const uint8_t* hash) {
-    static struct object_id oid;
+    static _Thread_local struct object_id oid;
     memcpy(oid.hash, hash, KNIT_HASH_RAWSZ);
     return &oid;
 }
@@ -36,8 +41,8 @@ int hex_to_oid(const char* hex, struct object_id* oid) {
 
 char* oid_to_hex(const struct object_id* oid) {
     const char HEX_DIGITS[] = "0123456789abcdef";
-    static char bufs[4][KNIT_HASH_HEXSZ + 1];
-    static int i;
+    static _Thread_local char bufs[4][KNIT_HASH_HEXSZ + 1];
+    static _Thread_local int i;
     i = (i + 1) % 4;
     char* hex = bufs[i];
     for (int i = 0; i < KNIT_HASH_RAWSZ; i++) {
@@ -84,8 +89,8 @@ char* strtypesig(uint32_t typesig) {
     }
     // Rotate among 4 statically allocated buffers so we can be invoked on
     // nonstandard types multiple times (like in printf()).
-    static char bufs[4][5];
-    static int i;
+    static _Thread_local char bufs[4][5];
+    static _Thread_local int i;
     i = (i + 1) % 4;
     char* buf = bufs[i];
     uint32_t be = htonl(typesig);
@@ -96,94 +101,649 @@ char* strtypesig(uint32_t typesig) {
 
 static char* object_path(const struct object_id* oid) {
     const char* hex = oid_to_hex(oid);
-    static char filename[PATH_MAX];
+    static _Thread_local char filename[PATH_MAX];
     if (snprintf(filename, PATH_MAX, "%s/objects/%c%c/%s",
                  get_knit_dir(), hex[0], hex[1], &hex[2]) >= PATH_MAX)
         die("path too long");
     return filename;
 }
 
-static int move_temp_to_file(const char* tmpfile, const char* filename) {
+// Resources may instead be stored without a header under objects/payload/, so
+// their files can be shared with job directories (see get_materialize_mode()).
+// The type is implied and the size is the file size.
+static char* payload_path(const struct object_id* oid) {
+    const char* hex = oid_to_hex(oid);
+    static _Thread_local char filename[PATH_MAX];
+    if (snprintf(filename, PATH_MAX, "%s/objects/payload/%c%c/%s",
+                 get_knit_dir(), hex[0], hex[1], &hex[2]) >= PATH_MAX)
+        die("path too long");
+    return filename;
+}
+
+static int move_temp_to_file(const char* tmpfile, char* filename) {
     int ret = rename(tmpfile, filename);
     if (ret < 0 && errno == ENOENT) {
-        // Retry after trying to create the object subdirectory.
+        // Retry after trying to create the object subdirectory (and for
+        // payloads, its parent).
         char* dir = strrchr(filename, '/');
         *dir = '\0';
-        mkdir(filename, 0777);
+        if (mkdir(filename, 0777) < 0 && errno == ENOENT) {
+            char* parent = strrchr(filename, '/');
+            *parent = '\0';
+            mkdir(filename, 0777);
+            *parent = '/';
+            mkdir(filename, 0777);
+        }
         *dir = '/';
         return rename(tmpfile, filename);
     }
     return ret;
 }
 
-struct object_header {
-    uint32_t typesig;
-    uint32_t size;
-};
+enum materialize_mode get_materialize_mode() {
+    static int mode = -1;
+    if (mode < 0) {
+        const char* value = get_config("materialize");
+        if (!value || !strcmp(value, "copy")) {
+            mode = MATERIALIZE_COPY;
+        } else if (!strcmp(value, "reflink")) {
+            mode = MATERIALIZE_REFLINK;
+        } else if (!strcmp(value, "hardlink")) {
+            mode = MATERIALIZE_HARDLINK;
+        } else if (!strcmp(value, "symlink")) {
+            mode = MATERIALIZE_SYMLINK;
+        } else {
+            warning("unknown materialize mode '%s'; copying", value);
+            mode = MATERIALIZE_COPY;
+        }
+    }
+    return mode;
+}
 
-int write_object(uint32_t typesig, const void* data, size_t size,
-                 struct object_id* out_oid) {
-    struct object_header hdr = {
-        .typesig = ntohl(typesig),
-        .size = ntohl(size),
-    };
+static int stores_payload(uint32_t typesig) {
+    return typesig == OBJ_RESOURCE && get_materialize_mode() != MATERIALIZE_COPY;
+}
 
-    SHA256_CTX ctx;
-    SHA256_Init(&ctx);
-    SHA256_Update(&ctx, &hdr, sizeof(hdr));
-    SHA256_Update(&ctx, data, size);
-    SHA256_Final(out_oid->hash, &ctx);
+// Objects are identified by the hash of a header followed by the payload:
+//
+//   uint32_t typesig
+//   uint32_t size
+//
+// Payloads of 4 GiB or more instead use an extended header, which leaves the
+// ids of all smaller objects unchanged:
+//
+//   uint32_t typesig
+//   uint32_t OBJ_SIZE_EXTENDED
+//   uint64_t size
+//
+// All integers are big endian. Objects are stored with the same header.
+#define OBJ_SIZE_EXTENDED 0xffffffff
+#define OBJ_HEADER_MAX_SIZE 16
+
+// Set in the stored (but never the hashed) typesig when the payload following
+// the header is zlib compressed. The header size is always the raw size.
+#define OBJ_COMPRESSED 0x80000000
+
+// Compressing small payloads saves little space and costs an inflate on every
+// read, so store them raw.
+#define COMPRESS_MIN_SIZE 4096
+
+// Files larger than this are hashed and copied in chunks of this size.
+#define STREAM_CHUNK_SIZE (1 << 20)
+
+// Retained views of smaller loose objects are copied rather than each pinning
+// its own mapping (and at least a page).
+#define RETAIN_MAP_MIN_SIZE (64 * 1024)
+
+static size_t encode_object_header(uint32_t typesig, size_t size, uint8_t* buf) {
+    uint32_t be = htonl(typesig);
+    memcpy(buf, &be, sizeof(be));
+    if (size < OBJ_SIZE_EXTENDED) {
+        be = htonl(size);
+        memcpy(buf + 4, &be, sizeof(be));
+        return 8;
+    }
+    be = htonl(OBJ_SIZE_EXTENDED);
+    memcpy(buf + 4, &be, sizeof(be));
+    put_be64(buf + 8, size);
+    return 16;
+}
+
+// Returns the header length, or -1 if buf is too short.
+static ssize_t decode_object_header(const void* buf, size_t len,
+                                    uint32_t* typesig, size_t* size) {
+    const uint8_t* p = buf;
+    uint32_t be;
+    if (len < 8)
+        return error("truncated header");
+    memcpy(&be, p, sizeof(be));
+    *typesig = ntohl(be);
+    memcpy(&be, p + 4, sizeof(be));
+    *size = ntohl(be);
+    if (*size != OBJ_SIZE_EXTENDED)
+        return 8;
+    if (len < 16)
+        return error("truncated header");
+    *size = get_be64(p + 8);
+    return 16;
+}
+
+static int should_compress() {
+    static int compress = -1;
+    if (compress < 0) {
+        const char* algo = get_config("compression");
+        if (!algo || !strcmp(algo, "none")) {
+            compress = 0;
+        } else if (!strcmp(algo, "zlib")) {
+            compress = 1;
+        } else {
+            warning("unknown compression '%s'; storing objects raw", algo);
+            compress = 0;
+        }
+    }
+    return compress;
+}
+
+// Returns a compressed copy of data, or NULL if it would not save enough
+// space to be worth inflating on read.
+static void* compress_payload(const void* data, size_t size, size_t* out_size) {
+    if (size < COMPRESS_MIN_SIZE || !should_compress())
+        return NULL;
+    uLongf zsize = compressBound(size);
+    void* zbuf = xmalloc(zsize);
+    if (compress2(zbuf, &zsize, data, size, Z_BEST_SPEED) != Z_OK ||
+            zsize > size - size / 8) {
+        free(zbuf);
+        return NULL;
+    }
+    *out_size = zsize;
+    return zbuf;
+}
+
+void prepare_object_writes() {
+    get_knit_dir();
+    get_packs();
+    get_materialize_mode();
+    should_compress();
+}
 
-    const char* filename = object_path(out_oid);
+int has_object(const struct object_id* oid) {
+    if (has_packed_object(oid))
+        return 1;
     struct stat st;
-    if (stat(filename, &st) == 0 && st.st_size > 0)
-        return 0; // object already exists
+    return (stat(object_path(oid), &st) == 0 && st.st_size > 0) ||
+        stat(payload_path(oid), &st) == 0;
+}
 
-    char tmpfile[PATH_MAX];
+static int open_object_temp(char* tmpfile) {
     if (snprintf(tmpfile, PATH_MAX, "%s/tmp-XXXXXX", get_knit_dir()) >= PATH_MAX)
         return error("path too long");
     int fd = mkstemp(tmpfile);
     if (fd < 0)
         return error_errno("cannot open object temp file");
-    // TODO compress
-    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
-            write(fd, data, size) != (ssize_t)size)
-        return error("write failed");
+    return fd;
+}
+
+// Close the temp file and move it into place as filename.
+static int finish_object_temp(int fd, const char* tmpfile, char* filename) {
     fchmod(fd, 0444);
-    if (close(fd) < 0)
+    if (close(fd) < 0) {
+        unlink(tmpfile);
         return error_errno("close failed");
-
-    if (move_temp_to_file(tmpfile, filename) < 0)
+    }
+    if (move_temp_to_file(tmpfile, filename) < 0) {
+        unlink(tmpfile);
         return error_errno("failed to rename object file");
+    }
+    return 0;
+}
+
+static void abort_object_temp(int fd, const char* tmpfile) {
+    close(fd);
+    unlink(tmpfile);
+}
+
+int write_object(uint32_t typesig, const void* data, size_t size,
+                 struct object_id* out_oid) {
+    if (typesig & OBJ_COMPRESSED)
+        return error("invalid typesig %08x", typesig);
+    uint8_t hdr[OBJ_HEADER_MAX_SIZE];
+    size_t hdr_len = encode_object_header(typesig, size, hdr);
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, hdr, hdr_len);
+    SHA256_Update(&ctx, data, size);
+    SHA256_Final(out_oid->hash, &ctx);
+
+    if (has_object(out_oid))
+        return 0;
+
+    // Payload files are shared verbatim, so never compress them.
+    int is_payload = stores_payload(typesig);
+    size_t zsize;
+    void* zbuf = is_payload ? NULL : compress_payload(data, size, &zsize);
+    if (zbuf) {
+        encode_object_header(typesig | OBJ_COMPRESSED, size, hdr);
+        data = zbuf;
+        size = zsize;
+    }
 
+    int rc = -1;
+    char tmpfile[PATH_MAX];
+    int fd = open_object_temp(tmpfile);
+    if (fd < 0)
+        goto cleanup;
+    if ((!is_payload && write_fully(fd, hdr, hdr_len) < 0) ||
+            write_fully(fd, data, size) < 0) {
+        error_errno("write failed");
+        abort_object_temp(fd, tmpfile);
+        goto cleanup;
+    }
+    rc = finish_object_temp(fd, tmpfile,
+                            is_payload ? payload_path(out_oid) : object_path(out_oid));
+
+cleanup:
+    free(zbuf);
+    return rc;
+}
+
+// Read exactly size bytes at offset, failing on a short read.
+static int pread_fully(int fd, void* buf, size_t size, off_t offset) {
+    size_t off = 0;
+    while (off < size) {
+        ssize_t n = pread(fd, (char*)buf + off, size - off, offset + off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return error_errno("read failed");
+        if (n == 0)
+            return error("file shrank while reading");
+        off += n;
+    }
     return 0;
 }
 
-void* read_object(const struct object_id* oid, uint32_t* typesig, size_t* size) {
-    void* ret = NULL;
-    struct bytebuf bb;
-    if (mmap_file(object_path(oid), &bb) < 0)
-        return NULL;
+// Hash size bytes of fd starting at offset, as an object with header hdr.
+static int hash_fd(int fd, off_t offset, size_t size, const uint8_t* hdr,
+                   size_t hdr_len, void* chunk, struct object_id* out_oid) {
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, hdr, hdr_len);
+    for (size_t off = 0; off < size; off += STREAM_CHUNK_SIZE) {
+        size_t n = size - off < STREAM_CHUNK_SIZE ? size - off : STREAM_CHUNK_SIZE;
+        if (pread_fully(fd, chunk, n, offset + off) < 0)
+            return -1;
+        SHA256_Update(&ctx, chunk, n);
+    }
+    SHA256_Final(out_oid->hash, &ctx);
+    return 0;
+}
 
-    struct object_header* hdr = bb.data;
-    if (bb.size < sizeof(*hdr)) {
-        error("truncated header");
+// Copy size bytes of fd starting at offset to out_fd, deflating if z is
+// non-NULL, and rehash as we go to catch modifications since hash_fd().
+static int copy_fd(int out_fd, int fd, off_t offset, size_t size,
+                   const uint8_t* hdr, size_t hdr_len, void* chunk,
+                   z_stream* z, const struct object_id* oid) {
+    uint8_t zchunk[64 * 1024];
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, hdr, hdr_len);
+    size_t off = 0;
+    do {
+        size_t n = size - off < STREAM_CHUNK_SIZE ? size - off : STREAM_CHUNK_SIZE;
+        if (pread_fully(fd, chunk, n, offset + off) < 0)
+            return -1;
+        SHA256_Update(&ctx, chunk, n);
+        off += n;
+
+        if (!z) {
+            if (write_fully(out_fd, chunk, n) < 0)
+                return error_errno("write failed");
+            continue;
+        }
+        z->next_in = chunk;
+        z->avail_in = n;
+        int flush = off == size ? Z_FINISH : Z_NO_FLUSH;
+        do {
+            z->next_out = zchunk;
+            z->avail_out = sizeof(zchunk);
+            if (deflate(z, flush) == Z_STREAM_ERROR)
+                return error("deflate failed");
+            if (write_fully(out_fd, zchunk, sizeof(zchunk) - z->avail_out) < 0)
+                return error_errno("write failed");
+        } while (z->avail_out == 0);
+    } while (off < size);
+
+    struct object_id actual;
+    SHA256_Final(actual.hash, &ctx);
+    if (memcmp(actual.hash, oid->hash, KNIT_HASH_RAWSZ))
+        return error("file changed while writing object");
+    return 0;
+}
+
+// Snapshot size bytes of fd into a payload temp file, sharing extents where
+// the filesystem allows, then hash the snapshot. Since the snapshot is private
+// it cannot change between hashing and storing.
+static int write_payload_fd(int fd, off_t offset, size_t size, void* chunk,
+                            struct object_id* out_oid) {
+    char tmpfile[PATH_MAX];
+    int out_fd = open_object_temp(tmpfile);
+    if (out_fd < 0)
+        return -1;
+    if ((offset != 0 || reflink_fd(out_fd, fd) < 0) &&
+            copy_fd_range(out_fd, fd, offset, size) < 0) {
+        abort_object_temp(out_fd, tmpfile);
+        return error_errno("copy failed");
+    }
+
+    struct stat st;
+    if (fstat(out_fd, &st) < 0) {
+        abort_object_temp(out_fd, tmpfile);
+        return error_errno("fstat");
+    }
+    uint8_t hdr[OBJ_HEADER_MAX_SIZE];
+    size_t hdr_len = encode_object_header(OBJ_RESOURCE, st.st_size, hdr);
+    if (hash_fd(out_fd, 0, st.st_size, hdr, hdr_len, chunk, out_oid) < 0) {
+        abort_object_temp(out_fd, tmpfile);
+        return -1;
+    }
+    if (has_object(out_oid)) {
+        abort_object_temp(out_fd, tmpfile);
+        return 0;
+    }
+    return finish_object_temp(out_fd, tmpfile, payload_path(out_oid));
+}
+
+int write_object_fd(uint32_t typesig, int fd, struct object_id* out_oid) {
+    if (typesig & OBJ_COMPRESSED)
+        return error("invalid typesig %08x", typesig);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return error_errno("fstat");
+    off_t offset = S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+    if (offset < 0 || st.st_size - offset <= STREAM_CHUNK_SIZE) {
+        // Pipes and small files are simplest to buffer in memory.
+        struct bytebuf bb;
+        if (slurp_fd(fd, &bb) < 0)
+            return error_errno("read failed");
+        int rc = write_object(typesig, bb.data, bb.size, out_oid);
+        cleanup_bytebuf(&bb);
+        return rc;
+    }
+
+    size_t size = st.st_size - offset;
+    void* chunk = xmalloc(STREAM_CHUNK_SIZE);
+    int rc;
+    if (stores_payload(typesig)) {
+        rc = write_payload_fd(fd, offset, size, chunk, out_oid);
         goto cleanup;
     }
 
-    *typesig = ntohl(hdr->typesig);
-    size_t nrem = ntohl(hdr->size);
-    if (bb.size != sizeof(*hdr) + nrem) {
-        error("size mismatch");
+    // Hash first, so we only copy objects that do not exist yet.
+    uint8_t hdr[OBJ_HEADER_MAX_SIZE];
+    size_t hdr_len = encode_object_header(typesig, size, hdr);
+    rc = hash_fd(fd, offset, size, hdr, hdr_len, chunk, out_oid);
+    if (rc < 0 || has_object(out_oid))
         goto cleanup;
+
+    // Unlike write_object(), we cannot cheaply check whether compression pays
+    // off before committing to it, so compress whenever it is configured.
+    z_stream zs = { };
+    z_stream* z = NULL;
+    if (should_compress()) {
+        if (deflateInit(&zs, Z_BEST_SPEED) != Z_OK) {
+            rc = error("deflateInit failed");
+            goto cleanup;
+        }
+        z = &zs;
     }
 
-    // TODO decompress
-    *size = bb.size - sizeof(*hdr);
-    ret = xmalloc(*size);
-    memcpy(ret, bb.data + sizeof(*hdr), *size);
+    char tmpfile[PATH_MAX];
+    int out_fd = open_object_temp(tmpfile);
+    if (out_fd < 0) {
+        rc = -1;
+    } else {
+        uint8_t stored_hdr[OBJ_HEADER_MAX_SIZE];
+        encode_object_header(z ? typesig | OBJ_COMPRESSED : typesig, size,
+                             stored_hdr);
+        if (write_fully(out_fd, stored_hdr, hdr_len) < 0)
+            rc = error_errno("write failed");
+        else
+            rc = copy_fd(out_fd, fd, offset, size, hdr, hdr_len, chunk, z,
+                         out_oid);
+        if (rc < 0)
+            abort_object_temp(out_fd, tmpfile);
+        else
+            rc = finish_object_temp(out_fd, tmpfile, object_path(out_oid));
+    }
+    if (z)
+        deflateEnd(z);
 
 cleanup:
+    free(chunk);
+    return rc;
+}
+
+const char* find_object_payload(const struct object_id* oid) {
+    const char* filename = payload_path(oid);
+    return access(filename, F_OK) == 0 ? filename : NULL;
+}
+
+// Open the loose object file or else the payload file for oid.
+static int open_loose_object(const struct object_id* oid, int* is_payload,
+                             const char** filename) {
+    *is_payload = 0;
+    *filename = object_path(oid);
+    int fd = open(*filename, O_RDONLY);
+    if (fd < 0 && errno == ENOENT) {
+        const char* loose_filename = *filename;
+        *filename = payload_path(oid);
+        fd = open(*filename, O_RDONLY);
+        if (fd >= 0)
+            *is_payload = 1;
+        else if (errno == ENOENT)
+            *filename = loose_filename;
+    }
+    return fd;
+}
+
+// Map the stored object from a pack, loose object file or payload file. The
+// mapping includes the header unless *is_payload is set. Packed objects are
+// borrowed, so cleanup_bytebuf() is a no-op for them.
+static int map_object(const struct object_id* oid, struct bytebuf* bb,
+                      int* is_payload) {
+    *is_payload = 0;
+    if (!find_packed_object(oid, bb))
+        return 0;
+
+    const char* filename;
+    int fd = open_loose_object(oid, is_payload, &filename);
+    if (fd < 0 && errno == ENOENT) {
+        // The object may have been repacked since we last loaded packs.
+        reprepare_packs();
+        if (!find_packed_object(oid, bb))
+            return 0;
+        errno = ENOENT;
+    }
+    if (fd < 0)
+        return error_errno("cannot open %s", filename);
+
+    if (mmap_fd(fd, bb) < 0) {
+        close(fd);
+        return error_errno("cannot mmap %s", filename);
+    }
+    close(fd);
+    return 0;
+}
+
+// Object metadata never changes, so remember it for the life of the process.
+// Direct mapped by leading oid bytes; colliding entries simply evict.
+#define STAT_CACHE_SIZE 4096
+
+static struct stat_cache_entry {
+    struct object_id oid;
+    uint32_t typesig;
+    uint64_t size;
+    unsigned is_valid : 1;
+} stat_cache[STAT_CACHE_SIZE];
+
+static struct stat_cache_entry* stat_cache_slot(const struct object_id* oid) {
+    return &stat_cache[(oid->hash[0] << 8 | oid->hash[1]) % STAT_CACHE_SIZE];
+}
+
+// Returns 1 if oid is not packed.
+static int read_packed_object_header(const struct object_id* oid,
+                                     uint32_t* typesig, size_t* size) {
+    struct bytebuf bb;
+    if (find_packed_object(oid, &bb) < 0)
+        return 1;
+    return decode_object_header(bb.data, bb.size, typesig, size) < 0 ? -1 : 0;
+}
+
+// Like map_object() but only reads the header.
+static int read_object_header(const struct object_id* oid,
+                              uint32_t* typesig, size_t* size) {
+    int rc = read_packed_object_header(oid, typesig, size);
+    if (rc <= 0)
+        return rc;
+
+    const char* filename;
+    int is_payload;
+    int fd = open_loose_object(oid, &is_payload, &filename);
+    if (fd < 0 && errno == ENOENT) {
+        reprepare_packs();
+        rc = read_packed_object_header(oid, typesig, size);
+        if (rc <= 0)
+            return rc;
+        errno = ENOENT;
+    }
+    if (fd < 0)
+        return error_errno("cannot open %s", filename);
+    if (is_payload) {
+        struct stat st;
+        rc = fstat(fd, &st);
+        close(fd);
+        if (rc < 0)
+            return error_errno("cannot stat %s", filename);
+        *typesig = OBJ_RESOURCE;
+        *size = st.st_size;
+        return 0;
+    }
+    uint8_t hdr[OBJ_HEADER_MAX_SIZE];
+    ssize_t n = pread(fd, hdr, sizeof(hdr), 0);
+    close(fd);
+    if (n < 0)
+        return error_errno("read failed %s", filename);
+    return decode_object_header(hdr, n, typesig, size) < 0 ? -1 : 0;
+}
+
+int stat_object(const struct object_id* oid, uint32_t* typesig, size_t* size) {
+    struct stat_cache_entry* entry = stat_cache_slot(oid);
+    if (!entry->is_valid ||
+            memcmp(entry->oid.hash, oid->hash, KNIT_HASH_RAWSZ)) {
+        uint32_t stored_typesig;
+        size_t stored_size;
+        if (read_object_header(oid, &stored_typesig, &stored_size) < 0)
+            return -1;
+        memcpy(entry->oid.hash, oid->hash, KNIT_HASH_RAWSZ);
+        entry->typesig = stored_typesig & ~OBJ_COMPRESSED;
+        entry->size = stored_size;
+        entry->is_valid = 1;
+    }
+    *typesig = entry->typesig;
+    if (size)
+        *size = entry->size;
+    return 0;
+}
+
+int read_object_view(const struct object_id* oid, uint32_t* typesig,
+                     struct bytebuf* out) {
+    struct bytebuf bb;
+    int is_payload;
+    if (map_object(oid, &bb, &is_payload) < 0)
+        return -1;
+    if (is_payload) {
+        *out = bb;
+        *typesig = OBJ_RESOURCE;
+        return 0;
+    }
+
+    uint32_t stored_typesig;
+    size_t size;
+    ssize_t hdr_len = decode_object_header(bb.data, bb.size,
+                                           &stored_typesig, &size);
+    if (hdr_len < 0) {
+        cleanup_bytebuf(&bb);
+        return -1;
+    }
+    const void* payload = bb.data + hdr_len;
+    size_t payload_size = bb.size - hdr_len;
+
+    if (!(stored_typesig & OBJ_COMPRESSED)) {
+        if (payload_size != size) {
+            cleanup_bytebuf(&bb);
+            return error("size mismatch");
+        }
+        // Skip over the header but keep ownership of the mapping, if any.
+        *out = bb;
+        out->data = (char*)bb.data + hdr_len;
+        out->size = size;
+        out->map_offset = bb.map_offset + hdr_len;
+        *typesig = stored_typesig;
+        return 0;
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->data = xmalloc(size);
+    out->size = size;
+    out->should_free = 1;
+    uLongf inflated_size = size;
+    int rc = uncompress(out->data, &inflated_size, payload, payload_size);
+    cleanup_bytebuf(&bb);
+    if (rc != Z_OK || inflated_size != size) {
+        cleanup_bytebuf(out);
+        return error("corrupt compressed object %s", oid_to_hex(oid));
+    }
+    *typesig = stored_typesig & ~OBJ_COMPRESSED;
+    return 0;
+}
+
+int read_object_view_of_type(const struct object_id* oid, uint32_t typesig,
+                             struct bytebuf* out) {
+    uint32_t actual_typesig;
+    if (read_object_view(oid, &actual_typesig, out) < 0)
+        return -1;
+    if (actual_typesig != typesig) {
+        cleanup_bytebuf(out);
+        return error("object %s is type %s, expected %s", oid_to_hex(oid),
+                     strtypesig(actual_typesig), strtypesig(typesig));
+    }
+    return 0;
+}
+
+void retain_object_view(struct bytebuf* bb) {
+    if (!bb->should_munmap || bb->size >= RETAIN_MAP_MIN_SIZE)
+        return;
+    size_t size = bb->size;
+    void* buf = xmalloc(size);
+    memcpy(buf, bb->data, size);
+    cleanup_bytebuf(bb);
+    bb->data = buf;
+    bb->size = size;
+    bb->should_free = 1;
+}
+
+void* read_object(const struct object_id* oid, uint32_t* typesig, size_t* size) {
+    struct bytebuf bb;
+    if (read_object_view(oid, typesig, &bb) < 0)
+        return NULL;
+    *size = bb.size;
+    if (bb.should_free)
+        return bb.data; // already a private copy
+    void* ret = xmalloc(bb.size);
+    memcpy(ret, bb.data, bb.size);
     cleanup_bytebuf(&bb);
     return ret;
 }
@@ -12,10 +12,10 @@ struct object_id {
 // Interpret the first KNIT_HASH_HEXSZ bytes as an object_id. Consider using
 // peel_*() in spec.h instead.
 int hex_to_oid(const char* hex, struct object_id* oid);
-// Returns statically allocated buffer; rotates among 4 buffers so recent
-// results are valid when invoked multiple times (like in printf()).
+// Returns statically allocated (per thread) buffer; rotates among 4 buffers so
+// recent results are valid when invoked multiple times (like in printf()).
 char* oid_to_hex(const struct object_id* oid);
-// Returns statically allocated object_id.
+// Returns statically allocated (per thread) object_id.
 struct object_id* oid_of_hash(const uint8_t* hash);
 
 #define OBJ_RESOURCE   0x72657300 // "res\0"
@@ -29,5 +29,48 @@ char* strtypesig(uint32_t typesig);
 
 int write_object(uint32_t typesig, const void* data, size_t size,
                  struct object_id* out_oid);
+// Load lazily initialized state (repository config and packs) so that
+// has_object(), write_object() and write_object_fd() may then be called
+// concurrently from multiple threads.
+void prepare_object_writes();
+
+// Returns whether the object exists in any form (packed, loose or payload).
+int has_object(const struct object_id* oid);
+// Write the rest of fd as an object. Large regular files are hashed and copied
+// in bounded chunks instead of being read into memory.
+int write_object_fd(uint32_t typesig, int fd, struct object_id* out_oid);
+// How knit-unpack materializes resources in job directories, from the
+// "materialize" config. Other than copy, resources are stored as headerless
+// payload files that can be shared, falling back to a copy where the
+// filesystem does not support sharing.
+enum materialize_mode {
+    MATERIALIZE_COPY,
+    MATERIALIZE_REFLINK,
+    MATERIALIZE_HARDLINK,
+    MATERIALIZE_SYMLINK,
+};
+
+enum materialize_mode get_materialize_mode();
+
+// Returns the path of the headerless payload file storing resource oid, or
+// NULL if it is stored otherwise. The path is statically allocated.
+const char* find_object_payload(const struct object_id* oid);
+
+// Look up the object type and (uncompressed) payload size from its header
+// without reading the payload. Results are cached for the process lifetime.
+// size may be NULL.
+int stat_object(const struct object_id* oid, uint32_t* typesig, size_t* size);
+
+// Read the object payload into out, which may borrow an mmap of the object
+// (or of its pack) rather than copying it. Release with cleanup_bytebuf().
+int read_object_view(const struct object_id* oid, uint32_t* typesig,
+                     struct bytebuf* out);
+int read_object_view_of_type(const struct object_id* oid, uint32_t typesig,
+                             struct bytebuf* out);
+// Prepare a view to be kept for the life of the process, as when parsed objects
+// borrow from it. Views of packs stay as they are, but small loose objects are
+// copied so that each does not hold its own mapping.
+void retain_object_view(struct bytebuf* bb);
+// Like read_object_view() but returns a malloc()ed copy of the payload.
 void* read_object(const struct object_id* oid, uint32_t* typesig, size_t* size);
 void* read_object_of_type(const struct object_id* oid, uint32_t typesig, size_t* size);
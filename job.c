@@ -34,16 +34,17 @@ struct job* get_job(const struct object_id* oid) {
     return intern_object(oid, OBJ_JOB, sizeof(struct job));
 }
 
-int parse_job_bytes(struct job* job, void* data, size_t size) {
-    if (job->object.is_parsed)
-        return 0;
+static int parse_job_inputs(struct job* job, void* data, size_t size) {
     struct job_header* hdr = (struct job_header*)data;
     size_t off = sizeof(*hdr);
     if (size < off)
         return error("truncated job header");
     size_t num_inputs = ntohl(hdr->num_inputs);
+    // Each input takes at least its hash and a NUL.
+    if (num_inputs > (size - off) / (sizeof(struct job_input) + 1))
+        return error("truncated job input");
+    resource_list_reserve(&job->inputs, num_inputs);
 
-    struct resource_list** list_p = &job->inputs;
     const char* prev_name = "";
     for (uint32_t i = 0; i < num_inputs; i++) {
         struct job_input* in = (struct job_input*)((char*)data + off);
@@ -54,20 +55,18 @@ int parse_job_bytes(struct job* job, void* data, size_t size) {
         if (pathlen == nrem)
             return error("job input not NUL-terminated");
 
-        struct resource_list* list = xmalloc(sizeof(*list));
-        list->res = get_resource(oid_of_hash(in->res_hash));
-        list->name = strdup(in->name);
-        list->next = NULL;
-
-        if (strcmp(prev_name, list->name) >= 0)
+        if (strcmp(prev_name, in->name) >= 0)
             return error("job input names not in strict lexicographical order");
-        prev_name = list->name;
+        char* name = in->name;
+        resource_list_append(&job->inputs, name,
+                             get_resource(oid_of_hash(in->res_hash)));
+        prev_name = name;
 
         enum job_process process = JOB_PROCESS_INVALID;
-        if (!strcmp(list->name, JOB_INPUT_NOCACHE)) {
+        if (!strcmp(name, JOB_INPUT_NOCACHE)) {
             job->is_nocache = 1;
         } else {
-            process = parse_job_process(list->name);
+            process = parse_job_process(name);
         }
         if (process != JOB_PROCESS_INVALID) {
             if (job->process != JOB_PROCESS_INVALID)
@@ -76,15 +75,25 @@ int parse_job_bytes(struct job* job, void* data, size_t size) {
         }
 
         off += sizeof(*in) + pathlen + 1;
-        *list_p = list;
-        list_p = &list->next;
     }
     if (off != size)
         return error("trailing job data");
 
     if (job->process == JOB_PROCESS_INVALID)
         return error("job missing process");
+    return 0;
+}
 
+int parse_job_bytes(struct job* job, void* data, size_t size) {
+    if (job->object.is_parsed)
+        return 0;
+    if (parse_job_inputs(job, data, size) < 0) {
+        // Do not leave entries pointing into data, which the caller may free.
+        resource_list_clear(&job->inputs);
+        job->process = JOB_PROCESS_INVALID;
+        job->is_nocache = 0;
+        return -1;
+    }
     job->object.is_parsed = 1;
     return 0;
 }
@@ -92,23 +101,25 @@ int parse_job_bytes(struct job* job, void* data, size_t size) {
 int parse_job(struct job* job) {
     if (job->object.is_parsed)
         return 0;
-    size_t size;
-    void* buf = read_object_of_type(&job->object.oid, OBJ_JOB, &size);
-    if (!buf)
+    struct bytebuf bb;
+    if (read_object_view_of_type(&job->object.oid, OBJ_JOB, &bb) < 0)
         return -1;
-    int ret = parse_job_bytes(job, buf, size);
-    free(buf);
-    return ret;
+    retain_object_view(&bb);
+    if (parse_job_bytes(job, bb.data, bb.size) < 0) {
+        cleanup_bytebuf(&bb);
+        return -1;
+    }
+    return 0; // the job now borrows bb
 }
 
-struct job* store_job(struct resource_list* inputs) {
+struct job* store_job(const struct resource_list* inputs) {
     size_t size = sizeof(struct job_header);
-    size_t num_inputs = 0;
-    for (struct resource_list* curr = inputs; curr; curr = curr->next) {
+    size_t num_inputs = inputs->num_entries;
+    for (size_t i = 0; i < num_inputs; i++) {
+        const struct resource_entry* curr = &inputs->entries[i];
         if (parse_resource(curr->res) < 0)
             return NULL;
         size += sizeof(struct job_input) + strlen(curr->name) + 1;
-        num_inputs++;
     }
 
     char* buf = xmalloc(size);
@@ -118,7 +129,8 @@ struct job* store_job(struct resource_list* inputs) {
 
     int has_process = 0;
     const char* prev_name = "";
-    for (struct resource_list* curr = inputs; curr; curr = curr->next) {
+    for (size_t i = 0; i < num_inputs; i++) {
+        const struct resource_entry* curr = &inputs->entries[i];
         if (strcmp(prev_name, curr->name) >= 0) {
             error("job input names not in strict lexicographical order");
             return NULL;
@@ -149,3 +161,40 @@ struct job* store_job(struct resource_list* inputs) {
     free(buf);
     return rc < 0 ? NULL : get_job(&oid);
 }
+
+// Read a decimal (or for memory, size) requirement from a job input.
+static int read_requirement(const struct job* job, const char* name,
+                            uint64_t* value) {
+    struct resource_entry* entry = resource_list_find(&job->inputs, name);
+    if (!entry)
+        return 0;
+    size_t size;
+    char* buf = read_object_of_type(&entry->res->object.oid, OBJ_RESOURCE, &size);
+    if (!buf)
+        return -1;
+    char str[32];
+    int rc = 0;
+    if (size >= sizeof(str) || memchr(buf, '\0', size)) {
+        rc = -1;
+    } else {
+        memcpy(str, buf, size);
+        str[size] = '\0';
+        rc = parse_size(str, value);
+    }
+    free(buf);
+    if (rc < 0)
+        return error("invalid job input %s", name);
+    return 0;
+}
+
+int read_job_requirements(const struct job* job, struct job_requirements* req) {
+    uint64_t cpus = 1;
+    req->memory = 0;
+    if (read_requirement(job, JOB_INPUT_CPUS, &cpus) < 0 ||
+            read_requirement(job, JOB_INPUT_MEMORY, &req->memory) < 0)
+        return -1;
+    if (!cpus || cpus > UINT32_MAX)
+        return error("invalid job input %s", JOB_INPUT_CPUS);
+    req->cpus = cpus;
+    return 0;
+}
@@ -15,16 +15,26 @@ const char* job_process_name(enum job_process process);
 
 struct job {
     struct object object;
-    struct resource_list* inputs;
+    struct resource_list inputs;
     enum job_process process;
     unsigned is_nocache : 1;
 };
 
 struct job* get_job(const struct object_id* oid);
 int parse_job(struct job* job);
+// On success, input names point into data, which must then outlive the job.
 int parse_job_bytes(struct job* job, void* data, size_t size);
-// Caller should free inputs.
-struct job* store_job(struct resource_list* inputs);
+// Inputs must be sorted. Caller should free inputs.
+struct job* store_job(const struct resource_list* inputs);
+
+// What a cmd job declares it needs while running, per its JOB_INPUT_CPUS and
+// JOB_INPUT_MEMORY inputs. Undeclared, a job needs one CPU and no memory.
+struct job_requirements {
+    uint32_t cpus;
+    uint64_t memory;  // in bytes
+};
+
+int read_job_requirements(const struct job* job, struct job_requirements* req);
 
 struct job_header {
     uint32_t num_inputs;
@@ -38,7 +48,9 @@ struct job_input {
 #define JOB_INPUT_RESERVED_PREFIX ".knit/"
 #define JOB_INPUT_FILES_PREFIX ".knit/files/"
 #define JOB_INPUT_CMD ".knit/cmd"
+#define JOB_INPUT_CPUS ".knit/cpus"
 #define JOB_INPUT_FLOW ".knit/flow"
 #define JOB_INPUT_IDENTITY ".knit/identity"
 #define JOB_INPUT_EXTERNAL ".knit/external"
+#define JOB_INPUT_MEMORY ".knit/memory"
 #define JOB_INPUT_NOCACHE ".knit/nocache"
@@ -0,0 +1,206 @@
+#include "jobserver.h"
+
+#include <poll.h>
+
+static struct event_source jobserver_src = { .fd = -1 };
+static int write_fd = -1;
+// Whether reading jobserver_src.fd never blocks; see open_private_read().
+static int is_nonblocking;
+// Job slots taken, including the implicit one.
+static size_t num_slots;
+static int max_slots;
+// Tokens taken from the pool, to write back as they were read.
+static char* tokens;
+static size_t num_tokens;
+static size_t alloc_tokens;
+
+// Reading a token must not block the event loop, but the pipe is shared with
+// other processes, so we cannot simply make it nonblocking. Where /proc allows,
+// reopen it as our own open file description instead. Otherwise we poll before
+// each read, which only blocks if another process takes the token first.
+static void open_private_read(int fd) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    int private_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (private_fd >= 0) {
+        jobserver_src.fd = private_fd;
+        is_nonblocking = 1;
+    } else {
+        jobserver_src.fd = fd;
+        is_nonblocking = 0;
+    }
+}
+
+// Join the jobserver named by the last --jobserver-auth option in makeflags.
+// make 4.4 passes fifo:<path>; earlier versions pass <read-fd>,<write-fd> of an
+// inherited pipe (as --jobserver-fds before make 4.2). Returns 1 if joined, 0
+// if there is no jobserver, or -1 if there is one we cannot use.
+static int join_jobserver(const char* makeflags) {
+    if (!makeflags)
+        return 0;
+    static const char* prefixes[] = {
+        "--jobserver-auth=", "--jobserver-fds=", NULL
+    };
+    const char* auth = NULL;
+    size_t auth_len = 0;
+    int jobs = 0;
+    for (const char* p = makeflags; *p; p += strspn(p, " ")) {
+        size_t len = strcspn(p, " ");
+        if (!strncmp(p, "-j", 2))
+            jobs = atoi(p + 2);
+        for (const char** prefix = prefixes; *prefix; prefix++) {
+            size_t prefix_len = strlen(*prefix);
+            if (len > prefix_len && !strncmp(p, *prefix, prefix_len)) {
+                auth = p + prefix_len;
+                auth_len = len - prefix_len;
+            }
+        }
+        p += len;
+    }
+    if (!auth)
+        return 0;
+    max_slots = jobs > 0 ? jobs : 0;
+
+    char value[PATH_MAX + 8];
+    if (auth_len >= sizeof(value)) {
+        warning("jobserver path too long");
+        return -1;
+    }
+    memcpy(value, auth, auth_len);
+    value[auth_len] = '\0';
+
+    if (!strncmp(value, "fifo:", 5)) {
+        const char* path = value + 5;
+        int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            warning_errno("cannot open jobserver %s", path);
+            return -1;
+        }
+        if ((write_fd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+            warning_errno("cannot open jobserver %s", path);
+            close(fd);
+            return -1;
+        }
+        jobserver_src.fd = fd;
+        is_nonblocking = 1;
+        return 1;
+    }
+
+    int readfd, writefd;
+    char trailing;
+    if (sscanf(value, "%d,%d%c", &readfd, &writefd, &trailing) != 2) {
+        warning("unrecognized jobserver %s", value);
+        return -1;
+    }
+    // make only passes its pipe to recipes that run make or are marked with +.
+    if (fcntl(readfd, F_GETFD) < 0 || fcntl(writefd, F_GETFD) < 0) {
+        warning("jobserver unavailable; mark the make recipe with +");
+        return -1;
+    }
+    open_private_read(readfd);
+    write_fd = writefd;
+    return 1;
+}
+
+// Create a pool of max_jobs - 1 tokens, and export it in MAKEFLAGS. Both ends of
+// the pipe are inherited by our jobs, for make to find.
+static void create_jobserver(int max_jobs) {
+    int fds[2];
+    if (pipe(fds) < 0)
+        die_errno("pipe failed");
+    // The pipe must hold every token, so do not block filling it.
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    for (int i = 1; i < max_jobs; i++)
+        if (write(fds[1], "+", 1) != 1)
+            die("too many jobs for jobserver");
+    fcntl(fds[1], F_SETFL, 0);
+    open_private_read(fds[0]);
+    write_fd = fds[1];
+    max_slots = max_jobs;
+
+    const char* makeflags = getenv("MAKEFLAGS");
+    if (!makeflags)
+        makeflags = "";
+    size_t size = strlen(makeflags) + 64;
+    char* buf = xmalloc(size);
+    snprintf(buf, size, "%s -j%d --jobserver-auth=%d,%d",
+             makeflags, max_jobs, fds[0], fds[1]);
+    if (setenv("MAKEFLAGS", buf, 1) < 0)
+        die_errno("setenv failed");
+    free(buf);
+}
+
+// Tokens still held when we exit would be lost to the rest of the pool.
+static void return_tokens() {
+    while (num_tokens > 0) {
+        if (write_fully(write_fd, &tokens[--num_tokens], 1) < 0)
+            break;
+    }
+}
+
+struct event_source* setup_jobserver(int max_jobs) {
+    int rc = join_jobserver(getenv("MAKEFLAGS"));
+    if (rc > 0) {
+        if (max_jobs > 0)
+            warning("-j%d ignored under make jobserver", max_jobs);
+    } else {
+        // Like make, run one job at a time if the jobserver is unusable.
+        if (rc < 0 && max_jobs <= 0)
+            max_jobs = 1;
+        if (max_jobs <= 0)
+            return NULL;
+        create_jobserver(max_jobs);
+    }
+    atexit(return_tokens);
+    add_event_source(&jobserver_src);
+    enable_event_source(&jobserver_src, 0);
+    return &jobserver_src;
+}
+
+int max_job_slots() {
+    return max_slots;
+}
+
+static int read_token(char* token) {
+    if (!is_nonblocking) {
+        struct pollfd pfd = { .fd = jobserver_src.fd, .events = POLLIN };
+        if (poll(&pfd, 1, 0) <= 0)
+            return 0;
+    }
+    ssize_t nr;
+    do {
+        nr = read(jobserver_src.fd, token, 1);
+    } while (nr < 0 && errno == EINTR);
+    if (nr < 0 && errno != EAGAIN)
+        die_errno("cannot read jobserver");
+    if (!nr)
+        die("jobserver closed");
+    return nr == 1;
+}
+
+int acquire_job_slot() {
+    if (jobserver_src.fd < 0 || !num_slots) {
+        num_slots++;
+        return 1;
+    }
+    char token;
+    if (!read_token(&token))
+        return 0;
+    if (num_tokens == alloc_tokens) {
+        alloc_tokens = (alloc_tokens + 16) * 2;
+        tokens = xrealloc(tokens, alloc_tokens);
+    }
+    tokens[num_tokens++] = token;
+    num_slots++;
+    return 1;
+}
+
+void release_job_slot() {
+    assert(num_slots > 0);
+    num_slots--;
+    // The last slot is our implicit one.
+    if (num_tokens > 0 && num_slots <= num_tokens) {
+        if (write_fully(write_fd, &tokens[--num_tokens], 1) < 0)
+            die_errno("cannot write jobserver");
+    }
+}
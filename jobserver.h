@@ -0,0 +1,26 @@
+#pragma once
+
+#include "event.h"
+
+// Limit how many jobs run at once with the GNU make jobserver protocol. Every
+// process sharing a jobserver has one implicit job slot, and takes a token (a
+// byte) from a shared pipe for each further job it runs concurrently, writing
+// the token back once that job is finished.
+//
+// When run under make with a jobserver (per MAKEFLAGS), we join its pool as a
+// client. Otherwise, given a limit we create a pool of our own and export it in
+// MAKEFLAGS, so that make run by our jobs shares our slots.
+
+// Join or create a jobserver. Returns a source that is ready when tokens may be
+// available, initially disabled. Returns NULL if there is neither a jobserver
+// to join nor a limit (max_jobs of 0), in which case slots are unlimited.
+struct event_source* setup_jobserver(int max_jobs);
+
+// The number of slots in the pool, or 0 if unknown (or unlimited).
+int max_job_slots();
+
+// Take a job slot without blocking. Returns whether one was taken; if not, wait
+// for the jobserver source before trying again.
+int acquire_job_slot();
+// Give back a job slot once its job is finished.
+void release_job_slot();
@@ -65,7 +65,8 @@ int main(int argc, char** argv) {
             struct operand_list* opnd = bump_alloc(&bump, sizeof(*opnd));
             if (!strcmp(s, "list")) {
                 opnd->type = OPND_RESOURCE_LIST;
-                opnd->list = NULL;
+                opnd->list = bump_alloc(&bump, sizeof(*opnd->list));
+                memset(opnd->list, 0, sizeof(*opnd->list));
                 opnd->next = operands;
                 operands = opnd;
                 continue;
@@ -136,10 +137,10 @@ int main(int argc, char** argv) {
             if (!operands || operands->type != OPND_RESOURCE)
                 die("expected resource operand");
             struct resource_list* list = bump_alloc(&bump, sizeof(*list));
-            list->name = bump_alloc(&bump, strlen(s) + 1);
-            strcpy(list->name, s);
-            list->res = operands->res;
-            list->next = NULL;
+            memset(list, 0, sizeof(*list));
+            char* name = bump_alloc(&bump, strlen(s) + 1);
+            strcpy(name, s);
+            resource_list_append(list, name, operands->res);
             operands->type = OPND_RESOURCE_LIST;
             operands->list = list;
         } else if (removeprefix(&s, "link ")) {
@@ -148,16 +149,29 @@ int main(int argc, char** argv) {
             if (count == ULONG_MAX || s == end || *end != '\0')
                 die("expected: link <count>");
 
+            if (!count)
+                continue;
+            if (!operands || operands->type != OPND_RESOURCE_LIST)
+                die("expected resource list first operand");
+
+            // Prepend count single entries to the list, keeping stack order.
+            struct resource_list* tail = operands->list;
+            size_t num_entries = count + tail->num_entries;
+            struct resource_entry* entries = xmalloc(num_entries * sizeof(*entries));
+            memcpy(entries + count, tail->entries,
+                   tail->num_entries * sizeof(*entries));
             for (; count; count--) {
-                if (!operands || operands->type != OPND_RESOURCE_LIST)
-                    die("expected resource list first operand");
-                struct resource_list* tail = operands->list;
                 operands = operands->next;
                 if (!operands || operands->type != OPND_RESOURCE_LIST ||
-                        operands->list->next)
+                        operands->list->num_entries != 1)
                     die("expected loose resource list second operand");
-                operands->list->next = tail;
+                entries[count - 1] = operands->list->entries[0];
+                resource_list_clear(operands->list);
             }
+            resource_list_clear(tail);
+            tail->entries = entries;
+            tail->num_entries = tail->alloc_entries = num_entries;
+            operands->list = tail;
         } else if (!strcmp(s, "job")) {
             if (!operands || operands->type != OPND_RESOURCE_LIST)
                 die("expected resource list operand");
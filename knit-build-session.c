@@ -46,14 +46,14 @@ int main(int argc, char** argv) {
         } else if (removeprefix(&s, "resource ")) {
             if (input_pos < 0)
                 die("input must precede resource");
-            struct session_input* si = active_inputs[input_pos];
+            struct session_input* si = &active_inputs[input_pos];
             struct object_id res_oid;
             if (strlen(s) != KNIT_HASH_HEXSZ || hex_to_oid(s, &res_oid) < 0)
                 die("invalid resource hash");
             memcpy(si->res_hash, res_oid.hash, KNIT_HASH_RAWSZ);
             si_setflag(si, SI_RESOURCE | SI_FINAL);
         } else if (removeprefix(&s, "dependency ")) {
-            uint16_t flags = 0;
+            uint32_t flags = 0;
             if (removeprefix(&s, "input ")) {
                 if (input_pos < 0)
                     die("input must precede input dependency");
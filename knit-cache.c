@@ -2,7 +2,7 @@
 #include "spec.h"
 
 static void die_usage(const char* arg0) {
-    fprintf(stderr, "usage: %s <job> [<production>]\n", arg0);
+    fprintf(stderr, "usage: %s (<job> [<production>] | --compact)\n", arg0);
     exit(1);
 }
 
@@ -10,6 +10,12 @@ int main(int argc, char** argv) {
     if (argc < 2 || argc > 3)
         die_usage(argv[0]);
 
+    if (!strcmp(argv[1], "--compact")) {
+        if (argc != 2)
+            die_usage(argv[0]);
+        return compact_cache() < 0;
+    }
+
     struct job* job = peel_job(argv[1]);
     if (!job)
         exit(1);
@@ -6,8 +6,10 @@
 #include "util.h"
 
 static void pretty_job(const struct job* job) {
-    for (struct resource_list* in = job->inputs; in; in = in->next)
+    for (size_t i = 0; i < job->inputs.num_entries; i++) {
+        const struct resource_entry* in = &job->inputs.entries[i];
         printf("%s\t%s\n", oid_to_hex(&in->res->object.oid), in->name);
+    }
 }
 
 static void pretty_production(const struct production* prd) {
@@ -15,8 +17,10 @@ static void pretty_production(const struct production* prd) {
     if (prd->inv)
         printf("invocation %s\n", oid_to_hex(&prd->inv->object.oid));
     printf("\n");
-    for (struct resource_list* out = prd->outputs; out; out = out->next)
+    for (size_t i = 0; i < prd->outputs.num_entries; i++) {
+        const struct resource_entry* out = &prd->outputs.entries[i];
         printf("%s\t%s\n", oid_to_hex(&out->res->object.oid), out->name);
+    }
 }
 
 static void die_usage(char* arg0) {
@@ -61,13 +65,13 @@ int main(int argc, char** argv) {
             strtypesig(obj->typesig), argv[1]);
     }
 
-    size_t size;
-    char* buf = read_object_of_type(&obj->oid, obj->typesig, &size);
-    if (!buf)
+    struct bytebuf bb;
+    if (read_object_view_of_type(&obj->oid, obj->typesig, &bb) < 0)
         exit(1);
 
-    if (write_fully(STDOUT_FILENO, buf, size) < 0)
+    if (write_fully(STDOUT_FILENO, bb.data, bb.size) < 0)
         die_errno("write failed");
+    cleanup_bytebuf(&bb);
 
     return 0;
 }
@@ -20,3 +20,4 @@ fi
 } | knit-hash-object -t invocation -w --stdin
 
 rm "$KNIT_DIR/sessions/$session"
+rm -f "$KNIT_DIR/sessions/$session.journal"
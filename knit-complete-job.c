@@ -2,6 +2,7 @@
 #include "production.h"
 #include "resource.h"
 #include "spec.h"
+#include "statcache.h"
 #include "util.h"
 
 #include <getopt.h>
@@ -49,7 +50,7 @@ static void die_usage(const char* arg0) {
 
 int main(int argc, char** argv) {
     struct job* job = NULL;
-    struct resource_list* outputs = NULL;
+    struct resource_list outputs = {0};
 
     int fail = 0;
 
@@ -70,14 +71,14 @@ int main(int argc, char** argv) {
                 exit(1);
 
             // Remove filename prefix until /./ if present (like rsync).
-            const char* base = strstr(optarg, "/./");
-            const char* filename = base ? base + 3 : optarg;
+            char* base = strstr(optarg, "/./");
+            char* filename = base ? base + 3 : optarg;
 
-            resource_list_insert(&outputs, filename, res);
+            resource_list_append(&outputs, filename, res);
             break;
         }
         case OPT_DIRECTORY:
-            if (resource_list_insert_dir_files(&outputs, optarg, "") < 0)
+            if (resource_list_append_dir_files(&outputs, optarg, "") < 0)
                 die_errno("directory traversal failed on %s", optarg);
             break;
         default:
@@ -86,10 +87,12 @@ int main(int argc, char** argv) {
     }
 
     if (!fail)
-        resource_list_insert(&outputs, PRODUCTION_OUTPUT_OK,
+        resource_list_append(&outputs, PRODUCTION_OUTPUT_OK,
                              get_empty_resource());
+    resource_list_sort(&outputs);
 
-    struct production* prd = store_production(job, NULL, outputs);
+    struct production* prd = store_production(job, NULL, &outputs);
+    save_statcache();
 
     char msg[KNIT_HASH_HEXSZ + 13];
     if (snprintf(msg, sizeof(msg), "production %s\n",
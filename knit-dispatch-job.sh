@@ -2,6 +2,9 @@
 
 . knit-bash-setup
 
+# knit-schedule-jobs runs cmd jobs with knit-run-cmd unless configured otherwise
+# (see cmd.h), which must produce the same productions.
+
 [[ $# -eq 2 ]]
 process="$1"
 job="$2"
@@ -33,7 +36,7 @@ process_cmd() {
 
     set +e
     # TODO disambiguate errors from knit-exec-cmd and .knit/cmd
-    knit-exec-cmd "$scratch" "$scratch/work/in/.knit/cmd" 3>&- > "$scratch/out.knit/log"
+    knit-exec-cmd "$scratch" "$scratch/work/in/.knit/cmd" > "$scratch/out.knit/log"
     rc=$?
     set -e
 
@@ -1,34 +1,4 @@
-#include "util.h"
-
-static void putenv_buf(char* buf, size_t size) {
-    char* end = buf + size;
-    while (buf < end) {
-        putenv(buf);
-        while (*buf++)
-            continue;
-    }
-}
-
-static char** parse_args(char* buf, size_t size) {
-    char** args = NULL;
-    size_t alloc_args = 0;
-    size_t num_args = 0;
-
-    char* p = buf;
-    char* end = p + size;
-    do {
-        if (num_args + 1 >= alloc_args) {
-            alloc_args = (alloc_args + 16) * 2;
-            args = xrealloc(args, alloc_args * sizeof(char*));
-        }
-        args[num_args++] = p;
-        p = memchr(p, '\0', end + 1 - p);
-        assert(p);
-        p++;
-    } while (p < end);
-    args[num_args] = NULL;
-    return args;
-}
+#include "cmd.h"
 
 static void die_usage(char* arg0) {
     fprintf(stderr, "usage: %s <scratch-dir> <cmdfile>\n", arg0);
@@ -52,9 +22,8 @@ int main(int argc, char** argv) {
         struct bytebuf bb; // never deallocated
         if (slurp_fd(env_fd, &bb) < 0)
             die_errno("cannot read %s", path);
-        if (*((char*)bb.data + bb.size - 1) != '\0')
+        if (putenv_environ(bb.data, bb.size) < 0)
             die("unterminated environ %s", path);
-        putenv_buf(bb.data, bb.size);
     } else if (errno != ENOENT) {
         die_errno("cannot open %s", path);
     }
@@ -73,7 +42,7 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
-    char** args = parse_args(bb.data, bb.size);
+    char** args = parse_cmd_args(bb.data, bb.size);
     execvp(args[0], args); // should not return
     dup2(stderr_fd, STDERR_FILENO);
     perror("exec");
@@ -44,26 +44,24 @@ int main(int argc, char** argv) {
 
     int ret = 0;
     for (int i = optind - (read_stdin ? 1 : 0); i < argc; i++) {
-        struct bytebuf bbuf;
+        int fd;
         if (read_stdin) {
             read_stdin = 0;
-            if (slurp_fd(0, &bbuf) < 0) {
-                error_errno("reading stdin failed");
-                ret = 1;
-                continue;
-            }
-        } else if (mmap_or_slurp_file(argv[i], &bbuf) < 0) {
+            fd = STDIN_FILENO;
+        } else if ((fd = open(argv[i], O_RDONLY)) < 0) {
+            error_errno("cannot open %s", argv[i]);
             ret = 1;
             continue;
         }
 
         struct object_id oid;
-        if (write_object(make_typesig(type), bbuf.data, bbuf.size, &oid) < 0) {
+        if (write_object_fd(make_typesig(type), fd, &oid) < 0) {
             ret = 1;
         } else {
             puts(oid_to_hex(&oid));
         }
-        cleanup_bytebuf(&bbuf);
+        if (fd != STDIN_FILENO)
+            close(fd);
     }
     return ret;
 }
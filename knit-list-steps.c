@@ -15,17 +15,14 @@ static const char* to_hex(const uint8_t* rawhash) {
     return oid_to_hex(&oid);
 }
 
-static const char* pflags(uint16_t flags) {
+static const char* pflags(uint32_t flags) {
     const char binbyte[16][5] = {
         "0000", "0001", "0010", "0011", "0100", "0101", "0110", "0111",
         "1000", "1001", "1010", "1011", "1100", "1101", "1110", "1111",
     };
-    flags = ntohs(flags);
-    static_assert(0xfff == SS_NAMEMASK);
-    static_assert(0xfff == SI_PATHMASK);
-    static_assert(0xfff == SD_OUTPUTMASK);
-    static char buf[10];
-    sprintf(buf, "%.4s %4u", binbyte[flags >> 12], flags & 0xfff);
+    flags = ntohl(flags);
+    static char buf[5];
+    sprintf(buf, "%.4s", binbyte[(flags >> 12) & 0xf]);
     return buf;
 }
 
@@ -33,7 +30,7 @@ static void emit(size_t step_pos, struct session_step* ss) {
     if (debug) {
         if (ss) {
             printf("step @%-9zu %-2u %s %s\n",
-                   step_pos, ntohs(ss->num_unresolved), pflags(ss->ss_flags), ss->name);
+                   step_pos, ntohl(ss->num_unresolved), pflags(ss->ss_flags), ss_name(ss));
             printf("     job        %s\n", to_hex(ss->job_hash));
             printf("     production %s\n", to_hex(ss->prd_hash));
         } else {
@@ -41,22 +38,22 @@ static void emit(size_t step_pos, struct session_step* ss) {
         }
 
         for (size_t i = 0; i < num_active_inputs; i++) {
-            struct session_input* si = active_inputs[i];
+            struct session_input* si = &active_inputs[i];
             if (ntohl(si->step_pos) != step_pos)
                 continue;
-            printf("     input      %-2zu %s %s\n", i, pflags(si->si_flags), si->name);
+            printf("     input      %-2zu %s %s\n", i, pflags(si->si_flags), si_name(si));
             if (si_hasflag(si, SI_FANOUT))
                 printf("     fanout     @%u\n", ntohl(si->fanout_step_pos));
             else
                 printf("     resource   %s\n", to_hex(si->res_hash));
         }
 
-        for (size_t i = 0; i < num_active_deps; i++) {
-            struct session_dependency* sd = active_deps[i];
-            if (ntohl(sd->step_pos) != step_pos)
-                continue;
+        size_t dep_pos, dep_end;
+        step_dependencies(step_pos, &dep_pos, &dep_end);
+        for (size_t i = dep_pos; i < dep_end; i++) {
+            struct session_dependency* sd = &active_deps[i];
             printf("     dependency %-2u %s %s\n",
-                   ntohl(sd->input_pos), pflags(sd->sd_flags), sd->output);
+                   ntohl(sd->input_pos), pflags(sd->sd_flags), sd_output(sd));
         }
     } else if (porcelain) {
         printf("@%zu\t", step_pos);
@@ -69,16 +66,16 @@ static void emit(size_t step_pos, struct session_step* ss) {
             if (ss_hasflag(ss, SS_JOB))
                 printf("a");
             else
-                printf("%d", ntohs(ss->num_unresolved));
+                printf("%u", ntohl(ss->num_unresolved));
         }
-        printf("\t%s\t%s\t%s\n", to_hex(ss->job_hash), to_hex(ss->prd_hash), ss->name);
+        printf("\t%s\t%s\t%s\n", to_hex(ss->job_hash), to_hex(ss->prd_hash), ss_name(ss));
     } else {
-        puts(ss->name);
+        puts(ss_name(ss));
     }
 }
 
 static int emit_step_if_wanted(size_t step_pos) {
-    struct session_step* ss = active_steps[step_pos];
+    struct session_step* ss = &active_steps[step_pos];
     if (ss_hasflag(ss, SS_JOB)) {
         if (ss_hasflag(ss, SS_FINAL)) {
             if (wants_fulfilled)
@@ -93,7 +90,7 @@ static int emit_step_if_wanted(size_t step_pos) {
                 emit(step_pos, ss);
         } else {
             if (!ss->num_unresolved)
-                return error("step not blocked but has no job: %s", ss->name);
+                return error("step not blocked but has no job: %s", ss_name(ss));
             if (wants_blocked)
                 emit(step_pos, ss);
         }
@@ -50,6 +50,9 @@ struct step_list {
     // When modifying flags, be sure to consider propagation through partials.
     unsigned is_params : 1;
     unsigned is_nocache : 1;
+    // Requirements of cmd steps, or 0 if undeclared.
+    uint32_t cpus;
+    uint64_t memory;
 };
 
 static struct step_list* find_step(struct step_list* step, const char* name) {
@@ -80,6 +83,25 @@ static int input_list_insert(struct input_list** list_p, struct input_list* inpu
     return 0;
 }
 
+// Like input_list_insert(), but copy the inputs before the insertion point
+// rather than rewriting them, as steps share inputs with their partials.
+static int input_list_insert_unshared(struct bump_list** bump_p,
+                                      struct input_list** list_p,
+                                      struct input_list* input) {
+    int cmp = -1;
+    while (*list_p && (cmp = strcmp((*list_p)->name, input->name)) < 0) {
+        struct input_list* copy = bump_alloc(bump_p, sizeof(*copy));
+        memcpy(copy, *list_p, sizeof(*copy));
+        *list_p = copy;
+        list_p = &copy->next;
+    }
+    if (cmp == 0)
+        return error("duplicate input %s", input->name);
+    input->next = *list_p;
+    *list_p = input;
+    return 0;
+}
+
 static struct input_list* input_list_override(struct bump_list** bump_p,
                                               struct input_list** inputs_p,
                                               struct input_list* override) {
@@ -231,6 +253,46 @@ static int parse_process_partial(struct parse_context* ctx, struct step_list* st
     if (step->is_nocache && partial->is_nocache)
         warning("both step and partial are marked nocache");
     step->is_nocache = partial->is_nocache;
+    // The step's own requirements take precedence over the partial's.
+    if (!step->cpus)
+        step->cpus = partial->cpus;
+    if (!step->memory)
+        step->memory = partial->memory;
+
+    if (step->cpus || step->memory) {
+        for (struct input_list* input = step->inputs; input; input = input->next)
+            if (!strcmp(input->name, JOB_INPUT_CMD))
+                return 0;
+        return error("only cmd steps can declare cpus or memory");
+    }
+    return 0;
+}
+
+// Parse cpus=<count> or memory=<size> after its keyword.
+static int parse_requirement(struct parse_context* ctx, struct step_list* step,
+                             enum token tok) {
+    struct lex_input* in = &ctx->in;
+    const char* what = tok == TOKEN_CPUS ? "cpus" : "memory";
+    if (lex(in) != TOKEN_EQUALS)
+        return error("expected =");
+    if (lex_path(in) < 0)
+        return -1;
+    char* value = lex_stuff_null(in);
+
+    uint64_t n;
+    if (parse_size(value, &n) < 0 || !n)
+        return error("invalid %s %s", what, value);
+    if (tok == TOKEN_CPUS) {
+        if (step->cpus)
+            return error("duplicate cpus");
+        if (strspn(value, "0123456789") != strlen(value) || n > UINT32_MAX)
+            return error("invalid cpus %s", value);
+        step->cpus = n;
+    } else {
+        if (step->memory)
+            return error("duplicate memory");
+        step->memory = n;
+    }
     return 0;
 }
 
@@ -252,13 +314,25 @@ static void append_value_suffix(struct parse_context* ctx, const struct value* i
 static int parse_process(struct parse_context* ctx, struct step_list* step) {
     struct lex_input* in = &ctx->in;
 
-    enum token tok = lex_keyword(in);
-    if (tok == TOKEN_NOCACHE) {
+    enum token tok;
+    while (1) {
+        tok = lex_keyword(in);
+        if (tok == TOKEN_NOCACHE) {
+            if (step->is_nocache)
+                return error("duplicate nocache");
+            step->is_nocache = 1;
+        } else if (tok == TOKEN_CPUS || tok == TOKEN_MEMORY) {
+            if (parse_requirement(ctx, step, tok) < 0)
+                return -1;
+        } else {
+            break;
+        }
         if (lex(in) != TOKEN_SPACE)
             return error("expected space");
-        step->is_nocache = 1;
-        tok = lex_keyword(in);
     }
+    if ((step->cpus || step->memory) &&
+            tok != TOKEN_CMD && tok != TOKEN_PARTIAL)
+        return error("only cmd steps can declare cpus or memory");
 
     struct input_list* context_input;
     switch (tok) {
@@ -533,20 +607,21 @@ static int print_build_instructions(FILE* fh, const struct step_list* step) {
 }
 
 static struct input_list* job_params_to_inputs(struct bump_list** bump_p,
-                                               struct resource_list* job_inputs) {
+                                               const struct resource_list* job_inputs) {
     struct input_list* ret = NULL;
     struct input_list** inputs_p = &ret;
-    for (; job_inputs; job_inputs = job_inputs->next) {
-        if (!strncmp(job_inputs->name, JOB_INPUT_RESERVED_PREFIX,
+    for (size_t i = 0; i < job_inputs->num_entries; i++) {
+        const struct resource_entry* entry = &job_inputs->entries[i];
+        if (!strncmp(entry->name, JOB_INPUT_RESERVED_PREFIX,
                      strlen(JOB_INPUT_RESERVED_PREFIX)))
             continue;
 
         struct input_list* input = bump_alloc(bump_p, sizeof(*input));
-        input->name = job_inputs->name;
+        input->name = entry->name;
         input->val = bump_alloc(bump_p, sizeof(*input->val));
         input->val->tag = VALUE_FILENAME;
-        input->val->path = job_inputs->name;
-        input->val->res = job_inputs->res;
+        input->val->path = entry->name;
+        input->val->res = entry->res;
         input->next = NULL;
         *inputs_p = input;
         inputs_p = &input->next;
@@ -554,25 +629,20 @@ static struct input_list* job_params_to_inputs(struct bump_list** bump_p,
     return ret;
 }
 
-static struct resource* find_resource(struct resource_list* list, const char* name) {
-    for (; list; list = list->next) {
-        int cmp = strcmp(list->name, name);
-        if (!cmp)
-            break;
-        else if (cmp > 0)
-            return NULL;
-    }
-    return list ? list->res : NULL;
+static struct resource* find_resource(const struct resource_list* list,
+                                      const char* name) {
+    struct resource_entry* entry = resource_list_find(list, name);
+    return entry ? entry->res : NULL;
 }
 
-static struct resource* find_file_resource(struct resource_list* list,
+static struct resource* find_file_resource(const struct resource_list* list,
                                            const char* filename) {
     char buf[strlen(JOB_INPUT_FILES_PREFIX) + strlen(filename) + 1];
     stpcpy(stpcpy(buf, JOB_INPUT_FILES_PREFIX), filename);
     return find_resource(list, buf);
 }
 
-static int populate_input(struct input_list* input, struct resource_list* job_inputs) {
+static int populate_input(struct input_list* input, const struct resource_list* job_inputs) {
     struct value* val = input->val;
     if (val->res)
         return 0;
@@ -603,7 +673,7 @@ char* make_joined_str(struct bump_list** bump_p,
 
 static void expand_input_file_dir(struct bump_list** bump_p,
                                   struct input_list** input_p,
-                                  struct resource_list* job_inputs) {
+                                  const struct resource_list* job_inputs) {
     struct input_list* dir_input = *input_p;
     // Remove dir_input (that is, *input_p) from the step.
     *input_p = dir_input->next;
@@ -614,15 +684,13 @@ static void expand_input_file_dir(struct bump_list** bump_p,
 
     // Add an expanded step input for each job input in the directory of the
     // dir_input value.
-    for (; job_inputs; job_inputs = job_inputs->next) {
-        int cmp = strncmp(job_inputs->name, prefix, prefix_len);
-        if (cmp < 0) {
-            continue;
-        } else if (cmp > 0) {
+    for (size_t i = resource_list_lower_bound(job_inputs, prefix);
+         i < job_inputs->num_entries; i++) {
+        char* name = job_inputs->entries[i].name;
+        if (strncmp(name, prefix, prefix_len))
             break;
-        }
 
-        char* suffix = job_inputs->name + prefix_len;
+        char* suffix = name + prefix_len;
         char* step_input_name = make_joined_str(bump_p, dir_input->name, suffix);
         struct input_list* inserted = create_input(bump_p, step_input_name);
         inserted->val->tag = VALUE_FILENAME;
@@ -634,18 +702,35 @@ static void expand_input_file_dir(struct bump_list** bump_p,
     }
 }
 
+static int insert_number_input(struct bump_list** bump_p,
+                               struct step_list* step, char* name, uint64_t n) {
+    struct input_list* input = create_input(bump_p, name);
+    input->val->tag = VALUE_LITERAL;
+    input->val->literal = bump_alloc(bump_p, 21);
+    input->val->literal_len =
+        snprintf(input->val->literal, 21, "%llu", (unsigned long long)n);
+    return input_list_insert_unshared(bump_p, &step->inputs, input);
+}
+
 static int finalize_flow_job_step(struct bump_list** bump_p,
                                   struct step_list* step,
-                                  struct resource_list* job_inputs) {
+                                  const struct resource_list* job_inputs) {
     // Represent nocache as a special input so it is part of the job id.
     if (step->is_nocache) {
         struct input_list* input = create_input(bump_p, JOB_INPUT_NOCACHE);
         input->val->tag = VALUE_LITERAL;
         input->val->literal = NULL;
         input->val->literal_len = 0;
-        if (input_list_insert(&step->inputs, input))
+        if (input_list_insert_unshared(bump_p, &step->inputs, input) < 0)
             return -1;
     }
+    // Likewise requirements, so the cmd can also read them.
+    if (step->cpus &&
+            insert_number_input(bump_p, step, JOB_INPUT_CPUS, step->cpus) < 0)
+        return -1;
+    if (step->memory &&
+            insert_number_input(bump_p, step, JOB_INPUT_MEMORY, step->memory) < 0)
+        return -1;
 
     for (struct input_list** input_p = &step->inputs;
          *input_p; input_p = &(*input_p)->next) {
@@ -664,7 +749,7 @@ static int finalize_flow_job_step(struct bump_list** bump_p,
 
 static int finalize_flow_job_plan(struct bump_list** bump_p,
                                   struct step_list* plan,
-                                  struct resource_list* job_inputs) {
+                                  const struct resource_list* job_inputs) {
     // Only the first step of the plan may be a params process. If the job
     // has any params they should override the params step inputs.
     struct input_list* params = job_params_to_inputs(bump_p, job_inputs);
@@ -720,7 +805,7 @@ int main(int argc, char** argv) {
         if (!job || parse_job(job) < 0)
             exit(1);
 
-        struct resource* plan_res = find_resource(job->inputs, JOB_INPUT_FLOW);
+        struct resource* plan_res = find_resource(&job->inputs, JOB_INPUT_FLOW);
         bb.data = read_object_of_type(&plan_res->object.oid, OBJ_RESOURCE, &bb.size);
         if (!bb.data)
             exit(1);
@@ -748,7 +833,7 @@ int main(int argc, char** argv) {
     }
 
     if (job) {
-        if (finalize_flow_job_plan(&bump, plan, job->inputs) < 0) {
+        if (finalize_flow_job_plan(&bump, plan, &job->inputs) < 0) {
             error("in job %s", oid_to_hex(&job->object.oid));
             exit(1);
         }
@@ -765,6 +850,7 @@ int main(int argc, char** argv) {
         }
     }
 
+    report_bump_stats("knit-parse-plan", bump);
     // leak bump and bb
     return 0;
 }
@@ -1,5 +1,6 @@
 #include "job.h"
 #include "resource.h"
+#include "statcache.h"
 
 struct param_arg_list {
     struct param_arg_list* next;
@@ -73,7 +74,7 @@ static struct input_line* parse_lines(char* buf, size_t size, size_t* num_lines)
 
 static int add_param_arg(const struct param_arg_list* arg,
                          struct input_line* lines, size_t num_lines,
-                         struct resource_list** inputs_p) {
+                         struct resource_list* inputs) {
     size_t j;
     for (j = 0; j < num_lines; j++) {
         if (lines[j].param && !path_or_dir_cmp(lines[j].param, arg->name))
@@ -104,7 +105,7 @@ static int add_param_arg(const struct param_arg_list* arg,
                      arg->value);
     } else {
         int num_added =
-            resource_list_insert_dir_files(inputs_p, arg->value, arg->name);
+            resource_list_append_dir_files(inputs, arg->value, arg->name);
         if (num_added < 0)
             return error_errno("directory traversal failed on %s", arg->value);
         if (num_added == 0)
@@ -113,7 +114,7 @@ static int add_param_arg(const struct param_arg_list* arg,
     }
     if (!res)
         return -1;
-    resource_list_insert(inputs_p, arg->name, res);
+    resource_list_append(inputs, arg->name, res);
 
     return 0;
 }
@@ -121,7 +122,7 @@ static int add_param_arg(const struct param_arg_list* arg,
 // Returns number of files added (this will be 1 for any non-directory) or -1 on
 // error. Note that name may be empty to add basedir itself.
 static int add_file(const char* name, const char* basedir,
-                    struct resource_list** inputs_p) {
+                    struct resource_list* inputs) {
     char path[strlen(basedir) + strlen(name) + 1];
     stpcpy(stpcpy(path, basedir), name);
 
@@ -131,7 +132,7 @@ static int add_file(const char* name, const char* basedir,
 
     // If a directory, add every file inside.
     if (input_name[input_name_len - 1] == '/') {
-        int rc = resource_list_insert_dir_files(inputs_p, path, input_name);
+        int rc = resource_list_append_dir_files(inputs, path, input_name);
         if (rc < 0)
             return error_errno("directory traversal failed on %s", path);
         return rc;
@@ -140,7 +141,7 @@ static int add_file(const char* name, const char* basedir,
     struct resource* res = store_resource_file(path);
     if (!res)
         return -1;
-    resource_list_insert(inputs_p, input_name, res);
+    resource_list_append(inputs, strdup(input_name), res);
     return 1;
 }
 
@@ -187,11 +188,11 @@ int main(int argc, char** argv) {
         die_usage(argv[0]);
     char* plan_filename = argv[optind];
 
-    struct resource_list* inputs = NULL;
+    struct resource_list inputs = {0};
     struct resource* plan_res = store_resource_file(plan_filename);
     if (!plan_res)
         exit(1);
-    resource_list_insert(&inputs, JOB_INPUT_FLOW, plan_res);
+    resource_list_append(&inputs, JOB_INPUT_FLOW, plan_res);
 
     struct bytebuf bb;
     if (slurp_fd(STDIN_FILENO, &bb) < 0)
@@ -203,7 +204,7 @@ int main(int argc, char** argv) {
 
     for (size_t i = 0; i < num_lines; i++) {
         if (lines[i].is_nocache) {
-            resource_list_insert(&inputs, JOB_INPUT_NOCACHE, get_empty_resource());
+            resource_list_append(&inputs, JOB_INPUT_NOCACHE, get_empty_resource());
             break;
         }
     }
@@ -233,16 +234,23 @@ int main(int argc, char** argv) {
     // The flow plan may include distinct references to the same file; dedupe
     // them here.
     // TODO dedupe earlier to avoid loading files more than once
-    for (struct resource_list* curr = inputs; curr && curr->next; curr = curr->next) {
-        while (!strcmp(curr->name, curr->next->name)) {
-            assert(curr->res == curr->next->res);
-            resource_list_remove_and_free(&curr->next);
+    resource_list_sort(&inputs);
+    size_t num_unique = 0;
+    for (size_t i = 0; i < inputs.num_entries; i++) {
+        struct resource_entry* curr = &inputs.entries[i];
+        if (num_unique &&
+                !strcmp(inputs.entries[num_unique - 1].name, curr->name)) {
+            assert(inputs.entries[num_unique - 1].res == curr->res);
+            continue;
         }
+        inputs.entries[num_unique++] = *curr;
     }
+    inputs.num_entries = num_unique;
 
-    struct job* job = store_job(inputs);
+    struct job* job = store_job(&inputs);
     if (!job)
         exit(1);
+    save_statcache();
 
     puts(oid_to_hex(&job->object.oid));
     // leak bb, lines, and inputs
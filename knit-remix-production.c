@@ -3,18 +3,24 @@
 #include "production.h"
 #include "resource.h"
 #include "spec.h"
+#include "statcache.h"
 
 #include <getopt.h>
 
-struct resource_list* deep_copy(struct resource_list* orig) {
-    struct resource_list* ret = NULL;
-    struct resource_list** copy_p = &ret;
-    for (; orig; orig = orig->next) {
-        *copy_p = xmalloc(sizeof(**copy_p));
-        memcpy(*copy_p, orig, sizeof(**copy_p));
-        copy_p = &(*copy_p)->next;
+static void copy_list(struct resource_list* dst, const struct resource_list* src) {
+    resource_list_clear(dst);
+    for (size_t i = 0; i < src->num_entries; i++)
+        resource_list_append(dst, src->entries[i].name, src->entries[i].res);
+}
+
+static void remove_prefix(struct resource_list* list, const char* prefix) {
+    size_t prefix_len = strlen(prefix);
+    size_t num_kept = 0;
+    for (size_t i = 0; i < list->num_entries; i++) {
+        if (strncmp(list->entries[i].name, prefix, prefix_len))
+            list->entries[num_kept++] = list->entries[i];
     }
-    return ret;
+    list->num_entries = num_kept;
 }
 
 enum options {
@@ -52,7 +58,7 @@ int main(int argc, char** argv) {
 
     struct invocation* final_inv = NULL;
     struct job* final_job = NULL;
-    struct resource_list* outputs = NULL;
+    struct resource_list outputs = {0};
 
     char* tok;
     struct job* job;
@@ -65,22 +71,14 @@ int main(int argc, char** argv) {
             job = peel_job(optarg);
             if (!job || parse_job(job) < 0)
                 exit(1);
-            outputs = deep_copy(job->inputs);
+            copy_list(&outputs, &job->inputs);
             break;
         case OPT_READ_OUTPUTS_FROM_DIR:
-            if (resource_list_insert_dir_files(&outputs, optarg, "") < 0)
+            if (resource_list_append_dir_files(&outputs, optarg, "") < 0)
                 die_errno("directory traversal failed on %s", optarg);
             break;
         case OPT_REMOVE_PREFIX:
-            for (struct resource_list** list_p = &outputs; *list_p; list_p = &(*list_p)->next) {
-                if (!strncmp((*list_p)->name, optarg, strlen(optarg))) {
-                    struct resource_list* next = (*list_p)->next;
-                    free(*list_p);
-                    *list_p = next;
-                    if (!*list_p)
-                        break;
-                }
-            }
+            remove_prefix(&outputs, optarg);
             break;
         case OPT_SET_JOB:
             final_job = peel_job(optarg);
@@ -95,7 +93,7 @@ int main(int argc, char** argv) {
             res = peel_resource(tok);
             if (!res)
                 exit(1);
-            resource_list_insert(&outputs, optarg, res);
+            resource_list_append(&outputs, optarg, res);
             break;
         case OPT_WRAP_INVOCATION:
             final_inv = peel_invocation(optarg);
@@ -104,7 +102,7 @@ int main(int argc, char** argv) {
             if (final_inv->entries->prd) {
                 if (parse_production(final_inv->entries->prd) < 0)
                     exit(1);
-                outputs = deep_copy(final_inv->entries->prd->outputs);
+                copy_list(&outputs, &final_inv->entries->prd->outputs);
             }
             break;
         default:
@@ -114,12 +112,14 @@ int main(int argc, char** argv) {
 
     if (!final_job)
         die("missing job");
-    if (!outputs && !final_inv)
+    if (!outputs.num_entries && !final_inv)
         die("no outputs nor invocation");
 
-    prd = store_production(final_job, final_inv, outputs);
+    resource_list_sort(&outputs);
+    prd = store_production(final_job, final_inv, &outputs);
     if (!prd)
         exit(1);
+    save_statcache();
 
     puts(oid_to_hex(&prd->object.oid));
     // leak outputs
@@ -0,0 +1,315 @@
+// Fold loose objects into a pack so that lookups are a binary search over a
+// mapped index instead of a path walk per object. Headerless payload files
+// are left alone since job directories may share them.
+
+#include "hash.h"
+#include "pack.h"
+#include "util.h"
+
+#include <dirent.h>
+
+// The "modern" EVP API is clunky; see hash.c.
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+struct pack_entry {
+    struct object_id oid;
+    char* loose_path;    // NULL if from an existing pack
+    struct pack* pack;   // NULL if loose
+    size_t pack_index;
+};
+
+static struct pack_entry* entries;
+static size_t num_entries;
+static size_t alloc_entries;
+
+static struct pack_entry* add_entry(const struct object_id* oid) {
+    if (num_entries == alloc_entries) {
+        alloc_entries = (alloc_entries + 16) * 2;
+        entries = xrealloc(entries, alloc_entries * sizeof(*entries));
+    }
+    struct pack_entry* entry = &entries[num_entries++];
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->oid.hash, oid->hash, KNIT_HASH_RAWSZ);
+    return entry;
+}
+
+static int is_hex(const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!isxdigit(s[i]) || isupper(s[i]))
+            return 0;
+    }
+    return s[len] == '\0';
+}
+
+static void collect_loose_objects(const char* objects_dir) {
+    DIR* dir = opendir(objects_dir);
+    if (!dir)
+        die_errno("cannot open %s", objects_dir);
+
+    struct dirent* dent;
+    while (errno = 0, (dent = readdir(dir))) {
+        if (!is_hex(dent->d_name, 2))
+            continue;
+
+        char subdir_name[PATH_MAX];
+        if (snprintf(subdir_name, PATH_MAX, "%s/%s",
+                     objects_dir, dent->d_name) >= PATH_MAX)
+            die("path too long");
+        DIR* subdir = opendir(subdir_name);
+        if (!subdir)
+            die_errno("cannot open %s", subdir_name);
+
+        struct dirent* sub_dent;
+        while (errno = 0, (sub_dent = readdir(subdir))) {
+            if (!is_hex(sub_dent->d_name, KNIT_HASH_HEXSZ - 2))
+                continue;
+            char hex[KNIT_HASH_HEXSZ + 1];
+            stpcpy(stpcpy(hex, dent->d_name), sub_dent->d_name);
+            struct object_id oid;
+            if (hex_to_oid(hex, &oid) < 0)
+                continue;
+
+            struct pack_entry* entry = add_entry(&oid);
+            entry->loose_path = xmalloc(strlen(subdir_name) + KNIT_HASH_HEXSZ);
+            sprintf(entry->loose_path, "%s/%s", subdir_name, sub_dent->d_name);
+        }
+        if (errno != 0)
+            die_errno("readdir");
+        closedir(subdir);
+    }
+    if (errno != 0)
+        die_errno("readdir");
+    closedir(dir);
+}
+
+static void collect_packed_objects() {
+    for (struct pack* pack = get_packs(); pack; pack = pack->next) {
+        for (size_t i = 0; i < pack->num_objects; i++) {
+            struct pack_entry* entry =
+                add_entry(oid_of_hash(&pack->oids[i * KNIT_HASH_RAWSZ]));
+            entry->pack = pack;
+            entry->pack_index = i;
+        }
+    }
+}
+
+static int cmp_entry(const void* a, const void* b) {
+    const struct pack_entry* pa = a;
+    const struct pack_entry* pb = b;
+    int cmp = memcmp(pa->oid.hash, pb->oid.hash, KNIT_HASH_RAWSZ);
+    if (cmp)
+        return cmp;
+    // Prefer already packed copies of duplicate objects.
+    return !!pa->loose_path - !!pb->loose_path;
+}
+
+static void read_entry(const struct pack_entry* entry, struct bytebuf* bb) {
+    if (entry->loose_path) {
+        if (mmap_file(entry->loose_path, bb) < 0)
+            exit(1);
+    } else {
+        const struct pack* pack = entry->pack;
+        uint64_t start = pack_offset_at(pack, entry->pack_index);
+        uint64_t end = entry->pack_index + 1 < pack->num_objects
+            ? pack_offset_at(pack, entry->pack_index + 1)
+            : pack->data.size;
+        if (start > end || end > pack->data.size)
+            die("corrupt pack offset in %s", pack->filename);
+        memset(bb, 0, sizeof(*bb));
+        bb->data = (char*)pack->data.data + start;
+        bb->size = end - start;
+    }
+    if (bb->size < 2 * sizeof(uint32_t))
+        die("truncated object %s", oid_to_hex(&entry->oid));
+}
+
+// The index being written, for replace_file().
+static const char* idx_buf;
+static size_t idx_size;
+
+static int write_idx(FILE* fh) {
+    return fwrite(idx_buf, idx_size, 1, fh) == 1 ? 0 : -1;
+}
+
+static char pack_filename[PATH_MAX];
+
+// Write the pack and its index from the (sorted, deduplicated) entries.
+static void write_pack(const char* pack_dir) {
+    char tmp_pack[PATH_MAX];
+    if (snprintf(tmp_pack, PATH_MAX, "%s/tmp-pack-XXXXXX", pack_dir) >= PATH_MAX)
+        die("path too long");
+    int fd = mkstemp(tmp_pack);
+    if (fd < 0)
+        die_errno("cannot open pack temp file");
+    fchmod(fd, 0444);
+    FILE* fh = fdopen(fd, "w");
+    if (!fh)
+        die_errno("fdopen");
+
+    idx_size = sizeof(struct pack_idx_header) +
+        PACK_FANOUT_SIZE * sizeof(uint32_t) +
+        num_entries * (KNIT_HASH_RAWSZ + sizeof(uint64_t));
+    char* idx = xmalloc(idx_size);
+    struct pack_idx_header* idx_hdr = (struct pack_idx_header*)idx;
+    idx_hdr->signature = htonl(PACK_IDX_SIGNATURE);
+    idx_hdr->version = htonl(PACK_VERSION);
+    idx_hdr->num_objects = htonl(num_entries);
+    uint32_t* fanout = (uint32_t*)(idx_hdr + 1);
+    uint8_t* oids = (uint8_t*)(fanout + PACK_FANOUT_SIZE);
+    uint8_t* offsets = oids + num_entries * KNIT_HASH_RAWSZ;
+
+    struct pack_header hdr = {
+        .signature = htonl(PACK_SIGNATURE),
+        .version = htonl(PACK_VERSION),
+        .num_objects = htonl(num_entries),
+    };
+    if (fwrite(&hdr, sizeof(hdr), 1, fh) != 1)
+        die_errno("write failed %s", tmp_pack);
+    uint64_t offset = sizeof(hdr);
+
+    // The pack is named by the hash of the object ids it contains.
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+
+    memset(fanout, 0, PACK_FANOUT_SIZE * sizeof(uint32_t));
+    for (size_t i = 0; i < num_entries; i++) {
+        const struct pack_entry* entry = &entries[i];
+        struct bytebuf bb;
+        read_entry(entry, &bb);
+        if (fwrite(bb.data, 1, bb.size, fh) != bb.size)
+            die_errno("write failed %s", tmp_pack);
+
+        memcpy(&oids[i * KNIT_HASH_RAWSZ], entry->oid.hash, KNIT_HASH_RAWSZ);
+        put_be64(&offsets[i * sizeof(uint64_t)], offset);
+        fanout[entry->oid.hash[0]]++;
+        SHA256_Update(&ctx, entry->oid.hash, KNIT_HASH_RAWSZ);
+        offset += bb.size;
+        cleanup_bytebuf(&bb);
+    }
+    // Loose objects and old packs are removed once the pack is in place, so
+    // it must reach the disk first.
+    if (fflush(fh) != 0 || fsync(fd) < 0)
+        die_errno("sync failed %s", tmp_pack);
+    if (fclose(fh) != 0)
+        die_errno("close failed %s", tmp_pack);
+
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < PACK_FANOUT_SIZE; i++) {
+        cumulative += fanout[i];
+        fanout[i] = htonl(cumulative);
+    }
+
+    struct object_id pack_oid;
+    SHA256_Final(pack_oid.hash, &ctx);
+    const char* pack_hex = oid_to_hex(&pack_oid);
+
+    char idx_filename[PATH_MAX];
+    if (snprintf(pack_filename, PATH_MAX, "%s/pack-%s.pack",
+                 pack_dir, pack_hex) >= PATH_MAX ||
+            snprintf(idx_filename, PATH_MAX, "%s/pack-%s.idx",
+                     pack_dir, pack_hex) >= PATH_MAX)
+        die("path too long");
+
+    // Readers discover packs by their index, so move it into place last. It
+    // is synced along with pack_dir, so both renames are durable.
+    if (rename(tmp_pack, pack_filename) < 0)
+        die_errno("failed to rename %s", tmp_pack);
+    idx_buf = idx;
+    if (replace_file(idx_filename, 0444, write_idx, 1) < 0)
+        die_errno("cannot write %s", idx_filename);
+    free(idx);
+
+    puts(pack_hex);
+}
+
+// Remove packs loaded before repacking, except any identical new pack.
+static void remove_old_packs() {
+    for (struct pack* pack = get_packs(); pack; pack = pack->next) {
+        if (!strcmp(pack->filename, pack_filename))
+            continue;
+        char idx_filename[PATH_MAX];
+        size_t len = strlen(pack->filename) - strlen(".pack");
+        if (snprintf(idx_filename, PATH_MAX, "%.*s.idx",
+                     (int)len, pack->filename) >= PATH_MAX)
+            die("path too long");
+        // Remove the index first so readers never see it without its pack.
+        if (unlink(idx_filename) < 0 || unlink(pack->filename) < 0)
+            warning_errno("cannot remove %s", pack->filename);
+    }
+}
+
+static char lockfile[PATH_MAX];
+
+static void unlock_repack() { unlink(lockfile); }
+
+static void die_usage(const char* arg0) {
+    fprintf(stderr, "usage: %s [-a]\n", arg0);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    int all = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "a")) != -1) {
+        switch (opt) {
+        case 'a':
+            all = 1;
+            break;
+        default:
+            die_usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        die_usage(argv[0]);
+
+    if (snprintf(lockfile, PATH_MAX, "%s/repack.lock", get_knit_dir()) >= PATH_MAX)
+        die("lock path too long");
+    if (acquire_lockfile(lockfile) < 0)  // leaks returned fd
+        exit(1);
+    atexit(unlock_repack);
+
+    char objects_dir[PATH_MAX];
+    char pack_dir[PATH_MAX];
+    if (snprintf(objects_dir, PATH_MAX, "%s/objects", get_knit_dir()) >= PATH_MAX ||
+            snprintf(pack_dir, PATH_MAX, "%s/pack", objects_dir) >= PATH_MAX)
+        die("path too long");
+    if (mkdir(pack_dir, 0777) < 0 && errno != EEXIST)
+        die_errno("cannot mkdir %s", pack_dir);
+
+    collect_loose_objects(objects_dir);
+    if (all)
+        collect_packed_objects();
+    if (!num_entries)
+        return 0;
+
+    qsort(entries, num_entries, sizeof(*entries), cmp_entry);
+
+    // Drop duplicates, and without -a loose objects that are already packed.
+    // Loose copies of every object are removed once the pack is in place.
+    size_t num_packed = 0;
+    char** loose_paths = xmalloc(num_entries * sizeof(*loose_paths));
+    size_t num_loose = 0;
+    for (size_t i = 0; i < num_entries; i++) {
+        struct pack_entry* entry = &entries[i];
+        if (entry->loose_path)
+            loose_paths[num_loose++] = entry->loose_path;
+        int is_dup = num_packed > 0 &&
+            !memcmp(entries[num_packed - 1].oid.hash, entry->oid.hash,
+                    KNIT_HASH_RAWSZ);
+        if (is_dup || (!all && has_packed_object(&entry->oid)))
+            continue;
+        entries[num_packed++] = *entry;
+    }
+    num_entries = num_packed;
+
+    if (num_entries)
+        write_pack(pack_dir);
+    for (size_t i = 0; i < num_loose; i++) {
+        if (unlink(loose_paths[i]) < 0)
+            warning_errno("cannot remove %s", loose_paths[i]);
+    }
+    if (all)
+        remove_old_packs();
+    return 0;
+}
@@ -1,3 +1,5 @@
+#include "cache.h"
+#include "duration.h"
 #include "hash.h"
 #include "job.h"
 #include "production.h"
@@ -13,6 +15,23 @@ struct step_list {
 };
 
 static char* session_name;
+static size_t num_completed;  // steps completed by this process
+static size_t num_dispatched; // steps waiting on the scheduler
+
+// Jobs to request from the scheduler in the next frame.
+struct request {
+    uint64_t priority;
+    size_t seq;
+    const struct object_id* oid;
+};
+static struct request* requests;
+static struct session_frame_record* records;
+static size_t num_requests;
+static size_t alloc_requests;
+
+// For each step, the estimated nanoseconds from when it finishes until every
+// step depending on it is done, were they run with unlimited parallelism.
+static uint64_t* downstream;
 
 // TODO this would make more sense in knit-schedule-jobs (and avoid clock skew)
 static void step_status(const struct session_step* ss,
@@ -24,67 +43,146 @@ static void step_status(const struct session_step* ss,
     struct job* job = get_job(oid_of_hash(ss->job_hash));
     dprintf(STDERR_FILENO, "!!step\t%llu\t%s\t%s\t%s\t%s\n",
             ns, session_name, oid_to_hex(&job->object.oid),
-            prd ? oid_to_hex(&prd->object.oid) : "-", ss->name);
+            prd ? oid_to_hex(&prd->object.oid) : "-", ss_name(ss));
+}
+
+static uint64_t estimate_step(const struct session_step* ss) {
+    if (ss_hasflag(ss, SS_FINAL))
+        return 0;
+    return estimate_duration(ss_hasflag(ss, SS_JOB) ? oid_of_hash(ss->job_hash) : NULL,
+                             ss_name(ss));
+}
+
+// Steps only depend on earlier steps, so visit them in reverse.
+static void estimate_downstream() {
+    downstream = xmalloc(num_active_steps * sizeof(*downstream));
+    for (size_t i = num_active_steps; i-- > 0;) {
+        downstream[i] = 0;
+        size_t dep_pos, dep_end;
+        step_dependencies(i, &dep_pos, &dep_end);
+        for (; dep_pos < dep_end; dep_pos++) {
+            const struct session_dependency* dep = &active_deps[dep_pos];
+            size_t dependent_pos = sd_hasflag(dep, SD_INPUTISSTEP)
+                ? ntohl(dep->input_pos)
+                : ntohl(active_inputs[ntohl(dep->input_pos)].step_pos);
+            if (dependent_pos <= i || dependent_pos >= num_active_steps)
+                die("step later than its dependent");
+            uint64_t path = estimate_step(&active_steps[dependent_pos]) +
+                downstream[dependent_pos];
+            if (path > downstream[i])
+                downstream[i] = path;
+        }
+    }
+}
+
+// Most urgent first, and otherwise in step order.
+static int compare_requests(const void* a, const void* b) {
+    const struct request* ra = a;
+    const struct request* rb = b;
+    if (ra->priority != rb->priority)
+        return ra->priority < rb->priority ? 1 : -1;
+    return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
 }
 
 static void dispatch_step(size_t step_pos) {
-    const struct session_step* ss = active_steps[step_pos];
+    const struct session_step* ss = &active_steps[step_pos];
     step_status(ss, NULL);
     struct job* job = get_job(oid_of_hash(ss->job_hash));
     struct step_list* tail = job->object.extra;
-    if (!tail)
-        puts(oid_to_hex(&job->object.oid));
+    if (!tail) {
+        if (!downstream)
+            estimate_downstream();
+        if (num_requests == alloc_requests) {
+            alloc_requests = (alloc_requests + 16) * 2;
+            requests = xrealloc(requests, alloc_requests * sizeof(*requests));
+            records = xrealloc(records, alloc_requests * sizeof(*records));
+        }
+        struct request* req = &requests[num_requests];
+        req->priority = estimate_step(ss) + downstream[step_pos];
+        req->seq = num_requests++;
+        req->oid = &job->object.oid;
+    }
     struct step_list* head = xmalloc(sizeof(*head));
     head->step_pos = step_pos;
     head->next = tail;
     job->object.extra = head;
+    num_dispatched++;
+}
+
+static void complete_step(size_t step_pos, struct production* prd) {
+    struct session_step* ss = &active_steps[step_pos];
+    if (ss_hasflag(ss, SS_FINAL))
+        die("step %s already finished", ss_name(ss));
+    memcpy(ss->prd_hash, prd->object.oid.hash, KNIT_HASH_RAWSZ);
+    ss_setflag(ss, SS_FINAL);
+    mark_step_dirty(step_pos);
+
+    step_status(ss, prd);
+
+    resolve_dependencies(step_pos, &prd->outputs);
+    num_completed++;
+}
+
+// Complete the step here if its job has a cached production. Returns whether
+// it did.
+static int complete_cached_step(size_t step_pos) {
+    const struct session_step* ss = &active_steps[step_pos];
+    struct job* job = get_job(oid_of_hash(ss->job_hash));
+    // The job is already outstanding with the scheduler, so it missed.
+    if (job->object.extra)
+        return 0;
+    // Only cacheable jobs are ever written to the cache, so the job need not
+    // be parsed to check is_nocache.
+    struct production* prd = read_cache(job);
+    if (!prd)
+        return 0;
+    if (parse_production(prd) < 0)
+        die("could not parse production %s", oid_to_hex(&prd->object.oid));
+    if (prd->job != job)
+        die("cached production %s is not of job %s",
+            oid_to_hex(&prd->object.oid), oid_to_hex(&job->object.oid));
+
+    step_status(ss, NULL);
+    dprintf(STDERR_FILENO, "!!cache-hit\t%s\t%s\n",
+            oid_to_hex(&job->object.oid), oid_to_hex(&prd->object.oid));
+    complete_step(step_pos, prd);
+    return 1;
 }
 
-int schedule_steps(int* steps_dispatched) {
-    int unfinished = 0;
-    for (size_t i = 0; i < num_active_steps; i++) {
-        struct session_step* ss = active_steps[i];
-        if (!ss_hasflag(ss, SS_FINAL)) {
-            unfinished = 1;
-            if (ss_hasflag(ss, SS_JOB) && !steps_dispatched[i]) {
-                dispatch_step(i);
-                steps_dispatched[i] = 1;
-            }
+// Dispatch steps whose jobs are compiled, completing cache hits locally.
+// Completing a step may make more steps ready, which are dispatched in turn.
+// Their jobs are requested from the scheduler together. Returns whether any
+// steps are waiting on the scheduler.
+static int schedule_steps() {
+    ssize_t step_pos;
+    while ((step_pos = next_ready_step()) >= 0) {
+        if (!complete_cached_step(step_pos))
+            dispatch_step(step_pos);
+    }
+    if (num_requests > 0) {
+        // The scheduler reads requests as it has room for them, so send the
+        // most urgent first.
+        qsort(requests, num_requests, sizeof(*requests), compare_requests);
+        for (size_t i = 0; i < num_requests; i++) {
+            memcpy(records[i].hash, requests[i].oid->hash, KNIT_HASH_RAWSZ);
+            put_be64(records[i].value, requests[i].priority);
         }
+        if (write_session_frames(STDOUT_FILENO, records, num_requests) < 0)
+            die_errno("cannot request jobs");
+        num_requests = 0;
     }
-    return unfinished;
+    return num_dispatched > 0;
 }
 
-static struct production* read_production() {
-    size_t orig_num_active_steps = num_active_steps;
-    close_session();
-
-    char buf[KNIT_HASH_HEXSZ + 2];
-    errno = 0;
-    if (!fgets(buf, sizeof(buf), stdin)) {
-        if (errno)
+static void read_stdin(void* buf, size_t size) {
+    if (fread(buf, size, 1, stdin) != 1) {
+        if (ferror(stdin))
             die_errno("cannot read stdin");
         die("stdin prematurely closed");
     }
-    if (strlen(buf) != KNIT_HASH_HEXSZ + 1 || buf[KNIT_HASH_HEXSZ] != '\n')
-        die("malformed line");
-
-    struct object_id oid;
-    if (hex_to_oid(buf, &oid) < 0)
-        die("invalid production hash");
-    struct production* prd = get_production(&oid);
-    if (parse_production(prd) < 0)
-        die("could not parse production %s", oid_to_hex(&oid));
-
-    if (load_session(session_name) < 0)
-        exit(1);
-    if (orig_num_active_steps != num_active_steps)
-        die("session %s changed while lock released", session_name);
-
-    return prd;
 }
 
-static void complete_steps(struct production* prd) {
+static void complete_steps(struct production* prd, uint64_t duration) {
     struct step_list* list = prd->job->object.extra;
     if (!list) {
         die("cannot complete unscheduled job %s",
@@ -92,15 +190,11 @@ static void complete_steps(struct production* prd) {
     }
 
     while (list) {
-        struct session_step* ss = active_steps[list->step_pos];
-        if (ss_hasflag(ss, SS_FINAL))
-            die("step %s already finished", ss->name);
-        memcpy(ss->prd_hash, prd->object.oid.hash, KNIT_HASH_RAWSZ);
-        ss_setflag(ss, SS_FINAL);
-
-        step_status(ss, prd);
-
-        resolve_dependencies(list->step_pos, prd->outputs);
+        if (duration > 0)
+            record_duration(&prd->job->object.oid,
+                            ss_name(&active_steps[list->step_pos]), duration);
+        complete_step(list->step_pos, prd);
+        num_dispatched--;
 
         struct step_list* tmp = list;
         list = tmp->next;
@@ -109,6 +203,24 @@ static void complete_steps(struct production* prd) {
     prd->job->object.extra = NULL;
 }
 
+// Complete the steps of each production in a frame from the scheduler.
+static void complete_frame() {
+    uint32_t num_records;
+    read_stdin(&num_records, sizeof(num_records));
+    num_records = ntohl(num_records);
+    if (!num_records || num_records > SESSION_FRAME_MAX_RECORDS)
+        die("malformed frame of %u productions", num_records);
+
+    for (uint32_t i = 0; i < num_records; i++) {
+        struct session_frame_record rec;
+        read_stdin(&rec, sizeof(rec));
+        struct production* prd = get_production(oid_of_hash(rec.hash));
+        if (parse_production(prd) < 0)
+            die("could not parse production %s", oid_to_hex(&prd->object.oid));
+        complete_steps(prd, get_be64(rec.value));
+    }
+}
+
 static void die_usage(const char* arg0) {
     fprintf(stderr, "usage: %s <session>\n", arg0);
     exit(1);
@@ -122,17 +234,22 @@ int main(int argc, char** argv) {
     if (load_session(session_name) < 0)
         exit(1);
 
-    setlinebuf(stdout);
-
-    int steps_dispatched[num_active_steps];
-    memset(steps_dispatched, 0, sizeof(steps_dispatched));
-
-    while (schedule_steps(steps_dispatched)) {
-        struct production* prd = read_production();
-        complete_steps(prd);
-        if (save_session() < 0)
-            exit(1);
+    // Save each batch of completed steps, including any resolved from the
+    // cache, once before waiting on the scheduler for more. A frame may
+    // complete many steps. The session stays locked throughout.
+    size_t num_saved = 0;
+    while (schedule_steps()) {
+        if (num_completed != num_saved) {
+            if (save_session() < 0)
+                exit(1);
+            num_saved = num_completed;
+        }
+        complete_frame();
     }
 
+    // The session file is hashed when it is closed, so fold in the journal.
+    if (checkpoint_session() < 0)
+        exit(1);
     close_session();
+    save_durations();
 }
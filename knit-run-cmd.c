@@ -0,0 +1,25 @@
+#include "cmd.h"
+#include "job.h"
+#include "spec.h"
+
+static void die_usage(char* arg0) {
+    fprintf(stderr, "usage: %s <job>\n", arg0);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2)
+        die_usage(argv[0]);
+
+    struct job* job = peel_job(argv[1]);
+    if (!job || parse_job(job) < 0)
+        exit(1);
+    if (job->process != JOB_PROCESS_CMD)
+        die("job %s is not cmd", oid_to_hex(&job->object.oid));
+
+    struct production* prd = run_cmd(job);
+    if (!prd)
+        exit(1);
+    puts(oid_to_hex(&prd->object.oid));
+    return 0;
+}
@@ -2,7 +2,7 @@
 
 . knit-bash-setup
 
-usage() { echo "usage: $0 [-f <plan>] [--no-filter] [<plan-job-options>]" >&2; exit 1; }
+usage() { echo "usage: $0 [-f <plan>] [-j <jobs>] [--no-filter] [<plan-job-options>]" >&2; exit 1; }
 
 if [[ -t 1 ]]; then
     filter=--on
@@ -11,9 +11,11 @@ else
 fi
 
 plan=plan.knit
+sched_opts=()
 while [[ $# -gt 0 ]]; do
     case "$1" in
         -f) plan="$2"; shift;;
+        -j) sched_opts=(-j "$2"); shift;;
         --no-filter) filter=--off;;
         *) break;;
     esac
@@ -33,7 +35,7 @@ while read -r word oid; do
     else
         echo "Unrecognized word $word" >&2
     fi
-done < <(knit-filter-status $filter knit-schedule-jobs "$job")
+done < <(knit-filter-status $filter knit-schedule-jobs "${sched_opts[@]}" "$job")
 
 # TODO truncate history
 echo "$prd" | tee -a "$KNIT_DIR/history"
@@ -1,27 +1,41 @@
 // Coordinate and dispatch jobs across sessions.
 //
-// All jobs are initially dispatched through knit-dispatch-job, which handles
-// them in one of two ways:
+// Cmd jobs are dispatched through knit-run-cmd (see cmd.h), unless configured
+// otherwise. Other jobs are initially dispatched through knit-dispatch-job,
+// which handles them in one of two ways:
 // - Flow jobs set up sessions. For each session, we establish read/write pipes
 //   with knit-resume-session to receive job scheduling requests and respond
-//   with their productions. When the session is complete we wrap its invocation
-//   in a production.
+//   with their productions, in frames of object id records (see session.h). When
+//   the session is complete we wrap its invocation in a production.
 // - Simple jobs are executed and return their productions. Each outstanding
 //   job, or dispatch, tracks which flow jobs have requested it. Upon
 //   completion, we notify corresponding sessions of the resulting production.
+//
+// Sessions are throttled to MAX_DISPATCHES_PER_SESSION outstanding jobs each.
+// Across sessions, cmd jobs wait until their requirements fit before they are
+// dispatched: as many job slots as they declare cpus (see jobserver.h), and
+// any memory they declare. Flow jobs do not wait, as their sessions last until
+// every job they request is done. Waiting jobs start by the priority their
+// sessions request them with (the estimated length of the critical path
+// through them), and otherwise in the order requested.
 
 #include "cache.h"
+#include "cmd.h"
+#include "config.h"
+#include "event.h"
 #include "hash.h"
 #include "job.h"
+#include "jobserver.h"
 #include "production.h"
+#include "session.h"
 #include "spec.h"
 #include "util.h"
 
-#include <poll.h>
 #include <signal.h>
+#include <sys/resource.h>
 
-#define MAX_DISPATCHES 1024
 #define MAX_DISPATCHES_PER_SESSION 8
+#define READ_BUFFER_SIZE 4096
 
 static char sched_lockfile[PATH_MAX];
 
@@ -43,6 +57,8 @@ struct notify_list {
 struct job_extra {
     struct notify_list* notify;
     struct production* prd;
+    struct read_buffer* waiting;  // while its dispatch waits to start
+    uint64_t duration;            // nanoseconds it ran, or 0 if it did not
     unsigned requested : 1;
 };
 
@@ -57,7 +73,6 @@ struct job_extra* get_job_extra(struct job* job) {
 enum dispatch_state {
     DS_INITIAL = 0,
     DS_RUNNING,
-    DS_CACHE,
     DS_PENDING_SESSION,
     DS_SESSION,
     DS_LAMEDUCK,
@@ -67,23 +82,41 @@ enum dispatch_state {
 // State for dispatching flow jobs and their sessions. We could simply inline
 // this into struct dispatch, but separating it seems clearer.
 struct dispatch_session {
-    struct pollfd* pfd;  // for throttling reads
+    struct event_source* src;  // for throttling reads
     int writefd;
     int num_outstanding;
+    // Productions to send in the next frame.
+    struct session_frame_record* pending;
+    size_t num_pending;
+    size_t alloc_pending;
+    unsigned is_flush_pending : 1;
 };
 
-// Parallels a pollfd with the state of an outstanding job.
+// The state of an outstanding job, whose output is read through a read_buffer.
+// Each of its processes is finished once it has both closed its output and
+// exited, in either order.
 struct dispatch {
     enum dispatch_state state;
-    pid_t pid;
+    pid_t pid;                    // 0 once reaped
+    int status;
+    struct event_source exit_src; // data points to the read_buffer
     struct job* job;
     struct dispatch_session* session;  // for DS_SESSION
+    struct job_requirements req;       // for cmd jobs, held while running
+    uint64_t priority;                 // while waiting
+    uint64_t seq;                      // while waiting
+    size_t waiting_pos;                // while waiting
+    uint64_t start_ns;
 };
 
+// Output is lines, except for sessions which send frames of job requests.
 struct read_buffer {
+    struct event_source src;    // data points back to the read_buffer
     struct dispatch* dispatch;  // NULL iff on stdin
+    size_t start;               // of unprocessed data in buf
     size_t size;
-    char buf[KNIT_HASH_HEXSZ + 1];
+    uint32_t frame_records;     // left to read in the current frame
+    char buf[READ_BUFFER_SIZE];
 };
 
 void free_dispatch(struct dispatch* d) {
@@ -134,13 +167,73 @@ static int spawn(char** argv, int* readfd, int* writefd) {
     return pid;
 }
 
-static int write_production_to_session(const struct dispatch_session* session,
-                                       const struct production* prd) {
-    if (dprintf(session->writefd, "%s\n", oid_to_hex(&prd->object.oid)) < 0)
+static size_t num_dispatches;
+
+// Dispatches of cmd jobs waiting for their requirements, in a binary heap with
+// the next to start on top.
+static struct read_buffer** waiting;
+static size_t num_waiting;
+static size_t alloc_waiting;
+static uint64_t next_waiting_seq;
+// Set when waiting dispatches may be able to start.
+static int should_start_waiting;
+static struct event_source* jobserver_src;  // NULL if slots are unlimited
+
+// Job slots we hold that no cmd job is using, and memory no cmd job is using.
+static uint32_t num_free_slots;
+static uint64_t free_memory;
+static uint64_t memory_capacity;
+static size_t num_running_cmds;
+
+// Sessions with productions to send at the end of this event loop iteration.
+static struct dispatch_session** flush_sessions;
+static size_t num_flush_sessions;
+static size_t alloc_flush_sessions;
+
+// Productions are sent to a session together by flush_session().
+static void write_production_to_session(struct dispatch_session* session,
+                                        const struct production* prd,
+                                        uint64_t duration) {
+    if (!session->is_flush_pending) {
+        if (num_flush_sessions == alloc_flush_sessions) {
+            alloc_flush_sessions = (alloc_flush_sessions + 16) * 2;
+            flush_sessions = xrealloc(flush_sessions,
+                                      alloc_flush_sessions * sizeof(*flush_sessions));
+        }
+        flush_sessions[num_flush_sessions++] = session;
+        session->is_flush_pending = 1;
+    }
+    if (session->num_pending == session->alloc_pending) {
+        session->alloc_pending = (session->alloc_pending + 16) * 2;
+        session->pending = xrealloc(session->pending,
+                                    session->alloc_pending * sizeof(*session->pending));
+    }
+    struct session_frame_record* rec = &session->pending[session->num_pending++];
+    memcpy(rec->hash, prd->object.oid.hash, KNIT_HASH_RAWSZ);
+    put_be64(rec->value, duration);
+}
+
+static int flush_session(struct dispatch_session* session) {
+    session->is_flush_pending = 0;
+    if (!session->num_pending)
+        return 0;
+    int rc = write_session_frames(session->writefd, session->pending,
+                                  session->num_pending);
+    session->num_pending = 0;
+    if (rc < 0)
         return error_errno("cannot notify session of completion");
     return 0;
 }
 
+static int flush_all_sessions() {
+    int rc = 0;
+    for (size_t i = 0; i < num_flush_sessions; i++)
+        if (flush_session(flush_sessions[i]) < 0)
+            rc = -1;
+    num_flush_sessions = 0;
+    return rc;
+}
+
 static int complete_job(struct job* job, struct production* prd) {
     struct notify_list** list_p = &get_job_extra(job)->notify;
 
@@ -151,22 +244,18 @@ static int complete_job(struct job* job, struct production* prd) {
     assert(!get_job_extra(job)->prd);
     get_job_extra(job)->prd = prd;
 
-    int ret = 0;
     while (*list_p) {
         struct dispatch_session* session = (*list_p)->session;
-        if (write_production_to_session(session, prd) < 0)
-            ret = -1;
+        write_production_to_session(session, prd, get_job_extra(job)->duration);
 
-        if (session->num_outstanding-- == MAX_DISPATCHES_PER_SESSION) {
-            assert(session->pfd->fd < 0);
-            session->pfd->fd = ~session->pfd->fd;  // enable pollfd
-        }
+        if (session->num_outstanding-- == MAX_DISPATCHES_PER_SESSION)
+            enable_event_source(session->src, 1);
 
         struct notify_list* tmp = (*list_p)->next;
         free(*list_p);
         *list_p = tmp;
     }
-    return ret;
+    return 0;
 }
 
 static void notify_when_complete(struct dispatch_session* session,
@@ -178,25 +267,170 @@ static void notify_when_complete(struct dispatch_session* session,
     session->num_outstanding++;
 }
 
-static void start_dispatch(struct dispatch* dispatch, int* fd) {
-    assert(dispatch->state == DS_INITIAL);
-    dispatch->state = DS_CACHE;
-
-    *fd = open_cache_file(dispatch->job);
-    if (*fd < 0) {
-        dispatch->state = DS_RUNNING;
+// Spawn the next process for a dispatch, and watch its output and exit.
+static void spawn_dispatch(struct read_buffer* readbuf, char** argv,
+                           int* writefd);
 
-        // Copy from job_process_name() for const correctness.
-        char process[20];
-        if (!memccpy(process, job_process_name(dispatch->job->process),
-                     '\0', sizeof(process)))
-            die("process name overflow");
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
+static void start_dispatch(struct read_buffer* readbuf) {
+    struct dispatch* dispatch = readbuf->dispatch;
+    assert(dispatch->state == DS_INITIAL);
+    dispatch->state = DS_RUNNING;
+    dispatch->start_ns = monotonic_ns();
+    if (dispatch->job->process == JOB_PROCESS_CMD && is_native_dispatch()) {
         char* argv[] = {
-            "knit-dispatch-job", process,
-            oid_to_hex(&dispatch->job->object.oid), NULL
+            "knit-run-cmd", oid_to_hex(&dispatch->job->object.oid), NULL
         };
-        dispatch->pid = spawn(argv, fd, NULL);
+        spawn_dispatch(readbuf, argv, NULL);
+        return;
+    }
+
+    // Copy from job_process_name() for const correctness.
+    char process[20];
+    if (!memccpy(process, job_process_name(dispatch->job->process),
+                 '\0', sizeof(process)))
+        die("process name overflow");
+
+    char* argv[] = {
+        "knit-dispatch-job", process,
+        oid_to_hex(&dispatch->job->object.oid), NULL
+    };
+    spawn_dispatch(readbuf, argv, NULL);
+}
+
+static int waits_before(const struct dispatch* a, const struct dispatch* b) {
+    if (a->priority != b->priority)
+        return a->priority > b->priority;
+    return a->seq < b->seq;
+}
+
+static void set_waiting(size_t pos, struct read_buffer* readbuf) {
+    waiting[pos] = readbuf;
+    readbuf->dispatch->waiting_pos = pos;
+}
+
+static void sift_up_waiting(size_t pos) {
+    struct read_buffer* readbuf = waiting[pos];
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (!waits_before(readbuf->dispatch, waiting[parent]->dispatch))
+            break;
+        set_waiting(pos, waiting[parent]);
+        pos = parent;
+    }
+    set_waiting(pos, readbuf);
+}
+
+static void push_waiting(struct read_buffer* readbuf) {
+    if (num_waiting == alloc_waiting) {
+        alloc_waiting = (alloc_waiting + 16) * 2;
+        waiting = xrealloc(waiting, alloc_waiting * sizeof(*waiting));
+    }
+    waiting[num_waiting] = readbuf;
+    sift_up_waiting(num_waiting++);
+}
+
+static struct read_buffer* pop_waiting() {
+    assert(num_waiting > 0);
+    struct read_buffer* top = waiting[0];
+    struct read_buffer* readbuf = waiting[--num_waiting];
+    size_t pos = 0;
+    for (;;) {
+        size_t child = 2 * pos + 1;
+        if (child >= num_waiting)
+            break;
+        if (child + 1 < num_waiting &&
+                waits_before(waiting[child + 1]->dispatch, waiting[child]->dispatch))
+            child++;
+        if (!waits_before(waiting[child]->dispatch, readbuf->dispatch))
+            break;
+        set_waiting(pos, waiting[child]);
+        pos = child;
+    }
+    if (num_waiting > 0)
+        set_waiting(pos, readbuf);
+    return top;
+}
+
+// Start waiting dispatches in turn while their requirements fit. A job waiting
+// for job slots keeps those it has and holds back all later jobs, so it is not
+// starved by smaller ones. A job waiting for memory holds back only later jobs
+// that also need memory, so the rest can fill the gap.
+static void start_waiting_dispatches() {
+    static struct read_buffer** held;
+    static size_t alloc_held;
+    size_t num_held = 0;
+    uint32_t blocked_cpus = 0;
+    should_start_waiting = 0;
+    while (num_waiting > 0) {
+        struct read_buffer* readbuf = waiting[0];
+        struct job_requirements* req = &readbuf->dispatch->req;
+        if (req->memory && (num_held > 0 || req->memory > free_memory)) {
+            if (num_held == alloc_held) {
+                alloc_held = (alloc_held + 16) * 2;
+                held = xrealloc(held, alloc_held * sizeof(*held));
+            }
+            held[num_held++] = pop_waiting();
+            continue;
+        }
+        while (num_free_slots < req->cpus && acquire_job_slot())
+            num_free_slots++;
+        if (num_free_slots < req->cpus) {
+            // Without knowing how many slots there are, a job may need more
+            // than ever come free, so it runs alone with what we have.
+            if (max_job_slots() || num_running_cmds) {
+                blocked_cpus = req->cpus;
+                break;
+            }
+            req->cpus = num_free_slots;
+        }
+        pop_waiting();
+        get_job_extra(readbuf->dispatch->job)->waiting = NULL;
+        num_free_slots -= req->cpus;
+        free_memory -= req->memory;
+        num_running_cmds++;
+        start_dispatch(readbuf);
+    }
+    for (size_t i = 0; i < num_held; i++)
+        push_waiting(held[i]);
+
+    // Give back any slots not kept for a waiting job.
+    while (num_free_slots > blocked_cpus) {
+        release_job_slot();
+        num_free_slots--;
+    }
+    if (jobserver_src)
+        enable_event_source(jobserver_src, blocked_cpus > 0);
+}
+
+static void start_dispatch_when_ready(struct read_buffer* readbuf) {
+    readbuf->dispatch->seq = next_waiting_seq++;
+    get_job_extra(readbuf->dispatch->job)->waiting = readbuf;
+    push_waiting(readbuf);
+    should_start_waiting = 1;
+}
+
+// A job requested again may be more urgent than before.
+static void raise_priority(struct job* job, uint64_t priority) {
+    struct read_buffer* readbuf = get_job_extra(job)->waiting;
+    if (!readbuf || priority <= readbuf->dispatch->priority)
+        return;
+    readbuf->dispatch->priority = priority;
+    sift_up_waiting(readbuf->dispatch->waiting_pos);
+}
+
+// Called once a dispatch is done, before it is freed.
+static void finish_dispatch(struct dispatch* dispatch) {
+    if (dispatch->job->process == JOB_PROCESS_CMD) {
+        num_free_slots += dispatch->req.cpus;
+        free_memory += dispatch->req.memory;
+        num_running_cmds--;
+        should_start_waiting = 1;
     }
 }
 
@@ -210,33 +444,21 @@ static struct production* get_production_hex(const char* hex) {
     return prd;
 }
 
-// Process a line of output from a dispatch process. Sets *req_job to request a
-// job to be scheduled.
-static int dispatch_line(struct dispatch* dispatch, const char* line,
-                         struct job** req_job) {
+// Process a line of output from a dispatch process.
+static int dispatch_line(struct dispatch* dispatch, const char* line) {
     if (dispatch->state == DS_RUNNING) {
         if (!strcmp(line, "session")) {
             dispatch->state = DS_PENDING_SESSION;
         } else {
             struct production* prd = get_production_hex(line);
+            get_job_extra(dispatch->job)->duration =
+                monotonic_ns() - dispatch->start_ns;
             if (!prd ||
                     write_cache(dispatch->job, prd) < 0 ||
                     complete_job(dispatch->job, prd) < 0)
                 return -1;
             dispatch->state = DS_LAMEDUCK;
         }
-    } else if (dispatch->state == DS_CACHE) {
-        fprintf(stderr, "!!cache-hit\t%s\t%s\n",
-                oid_to_hex(&dispatch->job->object.oid), line);
-        struct production* prd = get_production_hex(line);
-        if (!prd || complete_job(dispatch->job, prd) < 0)
-            return -1;
-        dispatch->state = DS_LAMEDUCK;
-    } else if (dispatch->state == DS_SESSION) {
-        struct object_id oid;
-        if (strlen(line) != KNIT_HASH_HEXSZ || hex_to_oid(line, &oid) < 0)
-            return error("invalid job hash");
-        *req_job = get_job(&oid);
     } else {
         return error("unexpected output");
     }
@@ -258,55 +480,112 @@ static int stdin_line(const char* line) {
     return complete_job(prd->job, prd);
 }
 
-// Returns -1 on error, or the number of bytes processed. Notably, returns 0 if
-// the buffer has no complete lines.
-static ssize_t handle_read(struct read_buffer* readbuf, struct job** req_job) {
-    char* nl = memchr(readbuf->buf, '\n', readbuf->size);
-    if (!nl) {
-        if (readbuf->size >= sizeof(readbuf->buf))
-            return error("subprocess output line too long");
-        return 0;
+// Process a frame header or job request from a session. Sets *req_job (and
+// *priority) to request a job to be scheduled.
+static ssize_t handle_frame_read(struct read_buffer* readbuf,
+                                 struct job** req_job, uint64_t* priority) {
+    const char* p = readbuf->buf + readbuf->start;
+    size_t avail = readbuf->size - readbuf->start;
+    if (!readbuf->frame_records) {
+        uint32_t num_records;
+        if (avail < sizeof(num_records))
+            return 0;
+        memcpy(&num_records, p, sizeof(num_records));
+        num_records = ntohl(num_records);
+        if (!num_records || num_records > SESSION_FRAME_MAX_RECORDS)
+            return error("malformed frame of %u jobs", num_records);
+        readbuf->frame_records = num_records;
+        return sizeof(num_records);
     }
-    *nl = '\0';
 
-    if (readbuf->dispatch) {
-        if (dispatch_line(readbuf->dispatch, readbuf->buf, req_job) < 0)
-            return -1;
+    struct session_frame_record rec;
+    if (avail < sizeof(rec))
+        return 0;
+    memcpy(&rec, p, sizeof(rec));
+    *req_job = get_job(oid_of_hash(rec.hash));
+    *priority = get_be64(rec.value);
+    readbuf->frame_records--;
+    return sizeof(rec);
+}
+
+// Returns -1 on error, or the number of bytes processed. Notably, returns 0 if
+// the buffer has no complete lines (or frame records).
+static ssize_t handle_read(struct read_buffer* readbuf, struct job** req_job,
+                           uint64_t* priority) {
+    ssize_t off;
+    if (readbuf->dispatch && readbuf->dispatch->state == DS_SESSION) {
+        off = handle_frame_read(readbuf, req_job, priority);
     } else {
-        if (stdin_line(readbuf->buf) < 0)
-            return -1;
-    }
+        char* line = readbuf->buf + readbuf->start;
+        char* nl = memchr(line, '\n', readbuf->size - readbuf->start);
+        if (!nl) {
+            if (readbuf->size >= sizeof(readbuf->buf) && !readbuf->start)
+                return error("subprocess output line too long");
+            return 0;
+        }
+        *nl = '\0';
 
-    size_t off = nl + 1 - readbuf->buf;
-    memmove(readbuf->buf, readbuf->buf + off, readbuf->size - off);
-    readbuf->size -= off;
+        if (readbuf->dispatch) {
+            if (dispatch_line(readbuf->dispatch, line) < 0)
+                return -1;
+        } else {
+            if (stdin_line(line) < 0)
+                return -1;
+        }
+        off = nl + 1 - line;
+    }
+    if (off > 0)
+        readbuf->start += off;
     return off;
 }
 
 static void cleanup_dispatch_session(struct dispatch_session** session) {
+    if ((*session)->is_flush_pending) {
+        for (size_t i = 0; i < num_flush_sessions; i++) {
+            if (flush_sessions[i] == *session) {
+                flush_sessions[i] = flush_sessions[--num_flush_sessions];
+                break;
+            }
+        }
+    }
     close((*session)->writefd);
+    free((*session)->pending);
     free(*session);
     *session = NULL;
 }
 
-static void cleanup_pollfd(struct pollfd* pfd) {
-    close(pfd->fd);
-    pfd->fd = -1;
+static void cleanup_event_source(struct event_source* src) {
+    remove_event_source(src);
+    close(src->fd);
+    src->fd = -1;
 }
 
-static int cleanup_subprocess(struct dispatch* dispatch) {
-    if (!dispatch->pid)  // no process (read from cache file)
-        return 0;
+static void spawn_dispatch(struct read_buffer* readbuf, char** argv,
+                           int* writefd) {
+    struct dispatch* dispatch = readbuf->dispatch;
+    dispatch->pid = spawn(argv, &readbuf->src.fd, writefd);
+    add_event_source(&readbuf->src);
+    dispatch->exit_src.data = readbuf;
+    add_child_event_source(&dispatch->exit_src, dispatch->pid);
+}
 
-    int status;
+// Reap the dispatch's process if it has exited, without blocking. Returns
+// whether it has.
+static int reap_subprocess(struct dispatch* dispatch) {
     int rc;
     do {
-        rc = waitpid(dispatch->pid, &status, 0);
+        rc = waitpid(dispatch->pid, &dispatch->status, WNOHANG);
     } while (rc < 0 && errno == EINTR);
     if (rc < 0)
         die_errno("waitpid failed");
+    if (!rc)
+        return 0;
+    remove_event_source(&dispatch->exit_src);
     dispatch->pid = 0;
+    return 1;
+}
 
+static int check_exit_status(int status) {
     if (WIFEXITED(status)) {
         int code = WEXITSTATUS(status);
         if (code)
@@ -317,11 +596,13 @@ static int cleanup_subprocess(struct dispatch* dispatch) {
     return 0;
 }
 
-static int handle_eof(struct dispatch* dispatch, struct pollfd* pfd) {
-    if (dispatch->session)
-        cleanup_dispatch_session(&dispatch->session);
-    cleanup_pollfd(pfd);
-    if (cleanup_subprocess(dispatch) < 0)
+// Once the dispatch's process is finished, move on to its next process (or
+// finish the dispatch).
+static int advance_dispatch(struct read_buffer* readbuf) {
+    struct dispatch* dispatch = readbuf->dispatch;
+    if (readbuf->src.fd >= 0 || dispatch->pid)
+        return 0;
+    if (check_exit_status(dispatch->status) < 0)
         return -1;
 
     if (dispatch->state == DS_PENDING_SESSION) {
@@ -331,8 +612,8 @@ static int handle_eof(struct dispatch* dispatch, struct pollfd* pfd) {
 
         dispatch->session = malloc(sizeof(*dispatch->session));
         memset(dispatch->session, 0, sizeof(*dispatch->session));
-        dispatch->session->pfd = pfd;
-        dispatch->pid = spawn(argv, &pfd->fd, &dispatch->session->writefd);
+        dispatch->session->src = &readbuf->src;
+        spawn_dispatch(readbuf, argv, &dispatch->session->writefd);
         dispatch->state = DS_SESSION;
     } else if (dispatch->state == DS_SESSION) {
         // Somewhat awkward script to wrap invocation in a production.
@@ -343,7 +624,7 @@ static int handle_eof(struct dispatch* dispatch, struct pollfd* pfd) {
                  " --wrap-invocation `knit-close-session %1$s`",
                  oid_to_hex(&dispatch->job->object.oid));
         char* argv[] = { "sh", "-c", script, NULL };
-        dispatch->pid = spawn(argv, &pfd->fd, NULL);
+        spawn_dispatch(readbuf, argv, NULL);
         dispatch->state = DS_RUNNING;
     } else if (dispatch->state == DS_LAMEDUCK) {
         assert(!get_job_extra(dispatch->job)->notify);
@@ -354,105 +635,209 @@ static int handle_eof(struct dispatch* dispatch, struct pollfd* pfd) {
     return 0;
 }
 
-static int pollfd_ready(struct pollfd* pfd, struct read_buffer* readbuf) {
-    if (!pfd->revents)
-        return 0;
-    assert(!(pfd->revents & POLLNVAL));
-
-    // On EOF we observe POLLHUP without POLLIN.
-    if (pfd->revents & (POLLIN | POLLHUP)) {
-        ssize_t nr = xread(pfd->fd, readbuf->buf + readbuf->size,
-                           sizeof(readbuf->buf) - readbuf->size);
-        if (nr < 0)
-            die_errno("read failed");
-        readbuf->size += nr;
-        return 1;
-    } else {
-        die("unhandled poll revent");
+static int handle_eof(struct read_buffer* readbuf) {
+    struct dispatch* dispatch = readbuf->dispatch;
+    if (dispatch->session)
+        cleanup_dispatch_session(&dispatch->session);
+    cleanup_event_source(&readbuf->src);
+    return advance_dispatch(readbuf);
+}
+
+// Read as much as fits in the buffer from a ready source. Returns the number
+// of bytes read, which is 0 at EOF.
+static ssize_t read_ready(struct read_buffer* readbuf) {
+    // Move any partial line or record to the front first.
+    if (readbuf->start > 0) {
+        memmove(readbuf->buf, readbuf->buf + readbuf->start,
+                readbuf->size - readbuf->start);
+        readbuf->size -= readbuf->start;
+        readbuf->start = 0;
     }
+    ssize_t nr = xread(readbuf->src.fd, readbuf->buf + readbuf->size,
+                       sizeof(readbuf->buf) - readbuf->size);
+    if (nr < 0)
+        die_errno("read failed");
+    readbuf->size += nr;
+    return nr;
 }
 
-static void setup_stdin_pollfd(struct pollfd* pfds,
-                               struct read_buffer** readbufs,
-                               nfds_t* nfds) {
-    struct read_buffer* readbuf = malloc(sizeof(*readbuf));
-    readbuf->dispatch = NULL;
-    readbuf->size = 0;
+static struct read_buffer* new_read_buffer(struct dispatch* dispatch) {
+    struct read_buffer* readbuf = xmalloc(sizeof(*readbuf));
+    readbuf->src.data = readbuf;
+    readbuf->dispatch = dispatch;
+    readbuf->start = readbuf->size = 0;
+    readbuf->frame_records = 0;
+    return readbuf;
+}
 
-    readbufs[*nfds] = readbuf;
-    pfds[*nfds].fd = STDIN_FILENO;
-    pfds[*nfds].events = POLLIN;
-    (*nfds)++;
+static void setup_stdin_source() {
+    struct read_buffer* readbuf = new_read_buffer(NULL);
+    readbuf->src.fd = STDIN_FILENO;
+    add_event_source(&readbuf->src);
 }
 
-static void setup_dispatch(struct job* job,
-                           struct pollfd* pfds,
-                           struct read_buffer** readbufs,
-                           nfds_t* nfds) {
+// Cache hits complete the job immediately, without a dispatch.
+static int setup_dispatch(struct job* job, uint64_t priority) {
     assert(!get_job_extra(job)->prd);
-    if (get_job_extra(job)->requested)
-        return;
+    if (get_job_extra(job)->requested) {
+        raise_priority(job, priority);
+        return 0;
+    }
     get_job_extra(job)->requested = 1;
 
     if (job->process == JOB_PROCESS_EXTERNAL) {
         printf("external %s\n", oid_to_hex(&job->object.oid));
-        return;
+        return 0;
     }
 
-    if (*nfds + 1 >= MAX_DISPATCHES)
-        die("too many dispatches");
+    struct production* prd = read_cache(job);
+    if (prd) {
+        fprintf(stderr, "!!cache-hit\t%s\t%s\n",
+                oid_to_hex(&job->object.oid), oid_to_hex(&prd->object.oid));
+        return complete_job(job, prd);
+    }
+
+    struct job_requirements req = {0};
+    if (job->process == JOB_PROCESS_CMD) {
+        if (read_job_requirements(job, &req) < 0)
+            return error("in job %s", oid_to_hex(&job->object.oid));
+        // Jobs needing more than there is at all get everything.
+        int max_slots = max_job_slots();
+        if (max_slots && req.cpus > (uint32_t)max_slots)
+            req.cpus = max_slots;
+        if (req.memory > memory_capacity)
+            req.memory = memory_capacity;
+    }
 
     struct dispatch* dispatch = malloc(sizeof(*dispatch));
     memset(dispatch, 0, sizeof(*dispatch));
     dispatch->job = job;
-
-    struct read_buffer* readbuf = malloc(sizeof(*readbuf));
-    readbuf->dispatch = dispatch;
-    readbuf->size = 0;
-
-    readbufs[*nfds] = readbuf;
-    pfds[*nfds].events = POLLIN;
-    pfds[*nfds].revents = 0;
-    start_dispatch(dispatch, &pfds[*nfds].fd);
-    (*nfds)++;
+    dispatch->req = req;
+    dispatch->priority = priority;
+
+    struct read_buffer* readbuf = new_read_buffer(dispatch);
+    if (job->process == JOB_PROCESS_CMD)
+        start_dispatch_when_ready(readbuf);
+    else
+        start_dispatch(readbuf);
+    num_dispatches++;
+    return 0;
 }
 
 static int setup_dispatch_and_notify(struct job* job,
                                      struct dispatch_session* session,
-                                     struct pollfd* pfds,
-                                     struct read_buffer** readbufs,
-                                     nfds_t* nfds) {
+                                     uint64_t priority) {
     if (parse_job(job) < 0)
         return -1;
 
+    if (!get_job_extra(job)->prd && setup_dispatch(job, priority) < 0)
+        return -1;
+
+    // A job that already finished did not run on this session's behalf.
     const struct production* prd = get_job_extra(job)->prd;
     if (prd)
-        return write_production_to_session(session, prd);
-
-    setup_dispatch(job, pfds, readbufs, nfds);
-    notify_when_complete(session, job);
+        write_production_to_session(session, prd, 0);
+    else
+        notify_when_complete(session, job);
     return 0;
 }
 
-static void maybe_throttle_pollfd(struct dispatch* dispatch,
-                                  struct pollfd* pfd) {
+static void maybe_throttle_session(struct dispatch* dispatch) {
     if (dispatch->session &&
-            dispatch->session->num_outstanding >= MAX_DISPATCHES_PER_SESSION) {
-        assert(pfd->fd >= 0);
-        pfd->fd = ~pfd->fd;  // disable pollfd
+            dispatch->session->num_outstanding >= MAX_DISPATCHES_PER_SESSION)
+        enable_event_source(dispatch->session->src, 0);
+}
+
+// Process everything read from a ready source. Returns whether the dispatch is
+// finished, so it and its read_buffer can be freed.
+static int handle_ready(struct read_buffer* readbuf) {
+    ssize_t nr_read = read_ready(readbuf);
+    if (nr_read > 0) {
+        // Process lines (or frame records) until we run out.
+        int nr;
+        do {
+            struct job* req_job = NULL;
+            uint64_t priority = 0;
+            nr = handle_read(readbuf, &req_job, &priority);
+            if (nr < 0)
+                exit(1);
+
+            if (req_job) {
+                assert(readbuf->dispatch);
+                assert(readbuf->dispatch->session);
+                if (setup_dispatch_and_notify(req_job,
+                                              readbuf->dispatch->session,
+                                              priority) < 0)
+                    exit(1);
+            }
+        } while (nr > 0);
+        // Since we throttle after draining the subprocess buffer, it is
+        // possible to exceed MAX_DISPATCHES_PER_SESSION by as many requests as
+        // fit in our read buffer.
+        if (readbuf->dispatch)
+            maybe_throttle_session(readbuf->dispatch);
+        return 0;
     }
+
+    if (readbuf->size > readbuf->start || readbuf->frame_records)
+        die("unterminated line or frame");
+    readbuf->start = readbuf->size = 0;
+
+    // If our fd is ready with no data then we've reached EOF. There is
+    // nothing more to read from stdin, but it need not be closed.
+    if (!readbuf->dispatch) {
+        remove_event_source(&readbuf->src);
+        return 0;
+    }
+    if (handle_eof(readbuf) < 0)
+        exit(1);
+    return dispatch_is_dead(readbuf->dispatch);
+}
+
+// Handle a dispatch's process that may have exited. Returns whether the
+// dispatch is finished.
+static int handle_exit(struct read_buffer* readbuf) {
+    if (!reap_subprocess(readbuf->dispatch))
+        return 0;
+    if (advance_dispatch(readbuf) < 0)
+        exit(1);
+    return dispatch_is_dead(readbuf->dispatch);
+}
+
+static uint64_t physical_memory() {
+#ifdef _SC_PHYS_PAGES
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0)
+        return (uint64_t)pages * page_size;
+#endif
+    return UINT64_MAX;
 }
 
 static void die_usage(char* arg0) {
-    fprintf(stderr, "usage: %s <job>\n", arg0);
+    fprintf(stderr, "usage: %s [-j <jobs>] <job>\n", arg0);
     exit(1);
 }
 
 int main(int argc, char** argv) {
-    if (argc != 2)
+    int max_jobs = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        char* end;
+        switch (opt) {
+        case 'j':
+            max_jobs = strtol(optarg, &end, 10);
+            if (*end || max_jobs <= 0)
+                die("invalid number of jobs %s", optarg);
+            break;
+        default:
+            die_usage(argv[0]);
+        }
+    }
+    if (argc != optind + 1)
         die_usage(argv[0]);
 
-    struct job* root_job = peel_job(argv[1]);
+    struct job* root_job = peel_job(argv[optind]);
     if (!root_job || parse_job(root_job) < 0)
         exit(1);
 
@@ -468,87 +853,69 @@ int main(int argc, char** argv) {
     sigaction(SIGINT, &act, NULL);
     sigaction(SIGTERM, &act, NULL);
 
-    struct pollfd pfds[MAX_DISPATCHES];
-    struct read_buffer* readbufs[MAX_DISPATCHES];
-    nfds_t nfds = 0;
+    // Each dispatch holds a pipe (and each session another), so allow as many
+    // open files as we can.
+    struct rlimit rl;
+    if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);  // best effort
+    }
+
+    const char* value;
+    if (!max_jobs && (value = get_config("cpus"))) {
+        char* end;
+        max_jobs = strtol(value, &end, 10);
+        if (*end || max_jobs <= 0)
+            die("invalid config cpus %s", value);
+    }
+    jobserver_src = setup_jobserver(max_jobs);
+    if ((value = get_config("memory"))) {
+        if (parse_size(value, &memory_capacity) < 0)
+            die("invalid config memory %s", value);
+    } else {
+        memory_capacity = physical_memory();
+    }
+    free_memory = memory_capacity;
 
     setlinebuf(stdout);
-    setup_stdin_pollfd(pfds, readbufs, &nfds);
-    setup_dispatch(root_job, pfds, readbufs, &nfds);
+    setup_stdin_source();
+    if (setup_dispatch(root_job, 0) < 0)
+        exit(1);
 
-    nfds_t deletions[MAX_DISPATCHES];
-    size_t ndel = 0;
+    // Run until all child processes complete.
+    while (num_dispatches > 0) {
+        // Jobs requested together compete for slots by priority, so start any
+        // that can once everything ready has been handled.
+        if (should_start_waiting)
+            start_waiting_dispatches();
 
-    // STDIN is always polled; run until all other child processes complete.
-    while (nfds > 1) {
-        if (poll(pfds, nfds, -1) < 0) {
+        struct event_source* ready[64];
+        int num_ready = wait_for_events(ready, 64);
+        if (num_ready < 0) {
             if (errno == EINTR || errno == EAGAIN)
                 continue;
-            die_errno("poll failed");
+            die_errno("wait for events failed");
         }
 
-        for (nfds_t i = 0; i < nfds; i++) {
-            if (!pollfd_ready(&pfds[i], readbufs[i]))
+        for (int i = 0; i < num_ready; i++) {
+            if (ready[i] == jobserver_src) {
+                should_start_waiting = 1;
                 continue;
-
-            if (readbufs[i]->size > 0) {
-                // Process lines until we run out.
-                int nr;
-                do {
-                    struct job* req_job = NULL;
-                    nr = handle_read(readbufs[i], &req_job);
-                    if (nr < 0)
-                        exit(1);
-
-                    if (req_job) {
-                        assert(readbufs[i]->dispatch);
-                        assert(readbufs[i]->dispatch->session);
-                        if (setup_dispatch_and_notify(req_job,
-                                                      readbufs[i]->dispatch->session,
-                                                      pfds, readbufs,
-                                                      &nfds) < 0)
-                            exit(1);
-                    }
-                } while (nr > 0);
-                // Since we throttle after draining the subprocess buffer, it is
-                // possible in theory to exceed MAX_DISPATCHES_PER_SESSION. In
-                // practice this is mitigated by the size of our read buffer.
-                if (readbufs[i]->dispatch)
-                    maybe_throttle_pollfd(readbufs[i]->dispatch, &pfds[i]);
-            } else {
-                if (readbufs[i]->size > 0)
-                    die("unterminated line");
-
-                // If our fd is ready with no data then we've reached EOF.
-                if (readbufs[i]->dispatch &&
-                        handle_eof(readbufs[i]->dispatch, &pfds[i]) < 0)
-                    exit(1);
             }
-
-            if (readbufs[i]->dispatch &&
-                    dispatch_is_dead(readbufs[i]->dispatch)) {
-                assert(ndel < MAX_DISPATCHES);
-                deletions[ndel++] = i;
+            struct read_buffer* readbuf = ready[i]->data;
+            int is_done = ready[i] == &readbuf->src
+                ? handle_ready(readbuf) : handle_exit(readbuf);
+            if (is_done) {
+                finish_dispatch(readbuf->dispatch);
+                free_dispatch(readbuf->dispatch);
+                free(readbuf);
+                num_dispatches--;
             }
         }
 
-        // Defer deletion until after iteration.
-        for (; ndel > 0; ndel--) {
-            size_t i = deletions[ndel - 1];
-            assert(readbufs[i]->dispatch);
-            free_dispatch(readbufs[i]->dispatch);
-            free(readbufs[i]);
-            nfds--;
-            if (i < nfds) {
-                memcpy(&pfds[i], &pfds[nfds], sizeof(*pfds));
-                readbufs[i] = readbufs[nfds];
-                // Update any reference to the moved pollfd.
-                if (readbufs[i]->dispatch->session) {
-                    assert(readbufs[i]->dispatch->session->pfd == &pfds[nfds]);
-                    readbufs[i]->dispatch->session->pfd = &pfds[i];
-                }
-            }
-        }
+        // Send each session the productions completed in this iteration.
+        if (flush_all_sessions() < 0)
+            exit(1);
     }
 
     const struct production* prd = get_job_extra(root_job)->prd;
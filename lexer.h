@@ -15,11 +15,13 @@ enum token {
     TOKEN_SPACE,
 
     TOKEN_CMD,
+    TOKEN_CPUS,
     TOKEN_ENVVAR,
     TOKEN_EXTERNAL,
     TOKEN_FLOW,
     TOKEN_IDENT,
     TOKEN_IDENTITY,
+    TOKEN_MEMORY,
     TOKEN_NOCACHE,
     TOKEN_PARAMS,
     TOKEN_PARTIAL,
@@ -74,9 +74,11 @@ enum token lex_keyword(struct lex_input* in) {
     while (1) {
         /*!use:re2c
             "cmd" { token = TOKEN_CMD; break; }
+            "cpus" { token = TOKEN_CPUS; break; }
             "external" { token = TOKEN_EXTERNAL; break; }
             "flow" { token = TOKEN_FLOW; break; }
             "identity" { token = TOKEN_IDENTITY; break; }
+            "memory" { token = TOKEN_MEMORY; break; }
             "nocache" { token = TOKEN_NOCACHE; break; }
             "params" { token = TOKEN_PARAMS; break; }
             "partial" { token = TOKEN_PARTIAL; break; }
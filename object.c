@@ -1,93 +1,127 @@
 #include "object.h"
 
-#define TRIE_BITS_PER_LEVEL 4
-#define TRIE_LEVELS_PER_BYTE (8 / TRIE_BITS_PER_LEVEL)
-#define TRIE_BRANCHING_FACTOR (1 << TRIE_BITS_PER_LEVEL)
-#define TRIE_MAX_LEVELS (KNIT_HASH_RAWSZ * TRIE_LEVELS_PER_BYTE)
+#include <stdalign.h>
 
-struct object_trie {
-    int num_items;
-    union {
-        struct object* items[TRIE_BRANCHING_FACTOR];
-        struct object_trie* nodes[TRIE_BRANCHING_FACTOR];
-    };
+#define INTERN_INITIAL_SLOTS 1024
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define MAX_ARENAS 8
+
+// Interned objects live in an open-addressing table with linear probing. Oids
+// are uniformly distributed, so the first 8 bytes make a fine hash; each slot
+// keeps them next to the pointer so probes rarely dereference other objects.
+struct intern_slot {
+    uint64_t key;
+    struct object* obj;
 };
 
-static int trie_is_leaf(struct object_trie* trie) { return trie->num_items >= 0; }
+static struct intern_slot* slots;
+static size_t num_slots; // power of 2
+static size_t num_interned;
+
+// Objects of each type are carved out of shared chunks rather than allocated
+// individually, so objects of a type sit together and cost no malloc header.
+struct object_arena {
+    uint32_t typesig;
+    size_t size;
+    char* next;
+    char* end;
+};
 
-static size_t trie_child(size_t level, const struct object_id* oid) {
-    unsigned char byte = oid->hash[level / TRIE_LEVELS_PER_BYTE];
-    int shift = (level % TRIE_LEVELS_PER_BYTE) * TRIE_BITS_PER_LEVEL;
-    return (byte >> shift) % TRIE_BRANCHING_FACTOR;
+static struct object_arena arenas[MAX_ARENAS];
+static size_t num_arenas;
+
+static uint64_t oid_key(const struct object_id* oid) {
+    uint64_t key;
+    memcpy(&key, oid->hash, sizeof(key));
+    return key;
 }
 
-// Do not call with duplicate obj->oid.
-static void trie_insert(struct object_trie** trie_p, size_t level, struct object* obj) {
-    assert(level < TRIE_MAX_LEVELS);
-    struct object_trie* trie;
-    if (!*trie_p) {
-        *trie_p = trie = xmalloc(sizeof(*trie));
-        memset(trie, 0, sizeof(*trie));
+static struct intern_slot* find_slot(struct intern_slot* table, size_t size,
+                                     const struct object_id* oid) {
+    uint64_t key = oid_key(oid);
+    size_t mask = size - 1;
+    for (size_t i = key & mask;; i = (i + 1) & mask) {
+        struct intern_slot* slot = &table[i];
+        if (!slot->obj)
+            return slot;
+        if (slot->key == key &&
+                !memcmp(slot->obj->oid.hash, oid->hash, KNIT_HASH_RAWSZ))
+            return slot;
     }
-    trie = *trie_p;
-    if (trie->num_items == TRIE_BRANCHING_FACTOR) {
-        // Make this node internal and redistribute its children.
-        struct object* items[TRIE_BRANCHING_FACTOR];
-        memcpy(items, trie->items, sizeof(items));
-        trie->num_items = -1;
-        memset(trie->nodes, 0, sizeof(trie->nodes));
-        for (int i = 0; i < TRIE_BRANCHING_FACTOR; i++)
-            trie_insert(trie_p, level, items[i]);
-    } else if (trie_is_leaf(trie)) {
-        trie->items[trie->num_items++] = obj;
-        return;
+}
+
+static void grow_slots() {
+    size_t new_size = num_slots ? num_slots * 2 : INTERN_INITIAL_SLOTS;
+    struct intern_slot* table = xmalloc(new_size * sizeof(*table));
+    memset(table, 0, new_size * sizeof(*table));
+    for (size_t i = 0; i < num_slots; i++) {
+        if (slots[i].obj)
+            *find_slot(table, new_size, &slots[i].obj->oid) = slots[i];
     }
-    assert(!trie_is_leaf(trie));
-    trie_insert(&trie->nodes[trie_child(level, &obj->oid)],
-                level + 1, obj);
+    free(slots);
+    slots = table;
+    num_slots = new_size;
 }
 
-static struct object* trie_find(struct object_trie* trie, const struct object_id* oid) {
-    for (size_t level = 0;; level++) {
-        assert(level < TRIE_MAX_LEVELS);
-        if (!trie)
-            break;
-        if (trie_is_leaf(trie)) {
-            for (int i = 0; i < trie->num_items; i++) {
-                struct object* leaf = trie->items[i];
-                if (!memcmp(leaf->oid.hash, oid->hash, KNIT_HASH_RAWSZ))
-                    return leaf;
-            }
-            break;
+static struct object_arena* get_arena(uint32_t typesig, size_t size) {
+    for (size_t i = 0; i < num_arenas; i++) {
+        if (arenas[i].typesig == typesig) {
+            if (arenas[i].size != size)
+                die("inconsistent size for %s objects", strtypesig(typesig));
+            return &arenas[i];
         }
-        assert(!trie_is_leaf(trie));
-        trie = trie->nodes[trie_child(level, oid)];
     }
-    return NULL;
+    if (num_arenas == MAX_ARENAS)
+        die("too many object types");
+    struct object_arena* arena = &arenas[num_arenas++];
+    arena->typesig = typesig;
+    arena->size = size;
+    return arena;
+}
+
+static void* arena_alloc(uint32_t typesig, size_t size) {
+    size_t align = alignof(max_align_t);
+    size = (size + align - 1) / align * align;
+    struct object_arena* arena = get_arena(typesig, size);
+    if ((size_t)(arena->end - arena->next) < size) {
+        // Retire the rest of the old chunk; objects are never freed.
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        arena->next = xmalloc(chunk_size);
+        arena->end = arena->next + chunk_size;
+        memset(arena->next, 0, chunk_size);
+    }
+    void* ret = arena->next;
+    arena->next += size;
+    return ret;
 }
 
-static struct object_trie* interned_objects;
 static struct object_id empty_oid;
 
-static void* intern_new_object(const struct object_id* oid, uint32_t typesig, size_t size) {
+void* intern_object(const struct object_id* oid, uint32_t typesig, size_t size) {
+    if (!slots)
+        grow_slots();
+    struct intern_slot* slot = find_slot(slots, num_slots, oid);
+    if (slot->obj) {
+        struct object* obj = slot->obj;
+        if (obj->typesig != typesig)
+            die("object %s is type %s, expected %s", oid_to_hex(&obj->oid),
+                strtypesig(obj->typesig), strtypesig(typesig));
+        return obj;
+    }
+
     if (!memcmp(oid->hash, empty_oid.hash, KNIT_HASH_RAWSZ))
         die("attempted to intern the empty oid");
-    struct object* obj = xmalloc(size);
-    memset(obj, 0, size);
+    // Keep the load factor at most 1/2 so probe sequences stay short.
+    if (2 * (num_interned + 1) > num_slots) {
+        grow_slots();
+        slot = find_slot(slots, num_slots, oid);
+    }
+    struct object* obj = arena_alloc(typesig, size);
     memcpy(obj->oid.hash, oid->hash, KNIT_HASH_RAWSZ);
     obj->typesig = typesig;
     obj->is_parsed = 0;
-    trie_insert(&interned_objects, 0, obj);
-    return obj;
-}
-
-void* intern_object(const struct object_id* oid, uint32_t typesig, size_t size) {
-    struct object* obj = trie_find(interned_objects, oid);
-    if (!obj)
-        return intern_new_object(oid, typesig, size);
-
-    if (obj->typesig != typesig)
-        die("object %s is type %s, expected %s", oid_to_hex(&obj->oid),
-            strtypesig(obj->typesig), strtypesig(typesig));
+    slot->key = oid_key(oid);
+    slot->obj = obj;
+    num_interned++;
     return obj;
 }
@@ -0,0 +1,175 @@
+#include "pack.h"
+
+#include <dirent.h>
+
+static struct pack* packs;
+static int packs_prepared;
+
+static int load_pack(const char* idx_filename, struct pack** out) {
+    struct pack* pack = xmalloc(sizeof(*pack));
+    memset(pack, 0, sizeof(*pack));
+
+    if (mmap_file(idx_filename, &pack->idx) < 0)
+        goto fail;
+    const struct pack_idx_header* hdr = pack->idx.data;
+    if (pack->idx.size < sizeof(*hdr) ||
+            ntohl(hdr->signature) != PACK_IDX_SIGNATURE) {
+        error("bad pack index signature %s", idx_filename);
+        goto fail;
+    }
+    if (ntohl(hdr->version) != PACK_VERSION) {
+        error("unsupported pack index version %s", idx_filename);
+        goto fail;
+    }
+    pack->num_objects = ntohl(hdr->num_objects);
+    size_t expected_size = sizeof(*hdr) +
+        PACK_FANOUT_SIZE * sizeof(uint32_t) +
+        (size_t)pack->num_objects * (KNIT_HASH_RAWSZ + sizeof(uint64_t));
+    if (pack->idx.size != expected_size) {
+        error("pack index size mismatch %s", idx_filename);
+        goto fail;
+    }
+    pack->fanout = (const uint32_t*)(hdr + 1);
+    pack->oids = (const uint8_t*)(pack->fanout + PACK_FANOUT_SIZE);
+    pack->offsets = pack->oids + (size_t)pack->num_objects * KNIT_HASH_RAWSZ;
+    if (ntohl(pack->fanout[PACK_FANOUT_SIZE - 1]) != pack->num_objects) {
+        error("pack index fanout mismatch %s", idx_filename);
+        goto fail;
+    }
+
+    size_t len = strlen(idx_filename);
+    pack->filename = xmalloc(len + 2);
+    memcpy(pack->filename, idx_filename, len - 4);
+    strcpy(&pack->filename[len - 4], ".pack");
+    if (mmap_file(pack->filename, &pack->data) < 0)
+        goto fail;
+    const struct pack_header* pack_hdr = pack->data.data;
+    if (pack->data.size < sizeof(*pack_hdr) ||
+            ntohl(pack_hdr->signature) != PACK_SIGNATURE ||
+            ntohl(pack_hdr->version) != PACK_VERSION ||
+            ntohl(pack_hdr->num_objects) != pack->num_objects) {
+        error("bad pack header %s", pack->filename);
+        goto fail;
+    }
+
+    *out = pack;
+    return 0;
+
+fail:
+    cleanup_bytebuf(&pack->idx);
+    cleanup_bytebuf(&pack->data);
+    free(pack->filename);
+    free(pack);
+    return -1;
+}
+
+static int has_suffix(const char* s, const char* suffix) {
+    size_t len = strlen(s);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && !strcmp(s + len - suffix_len, suffix);
+}
+
+static int pack_is_loaded(const char* idx_filename) {
+    size_t len = strlen(idx_filename) - 4;
+    for (struct pack* pack = packs; pack; pack = pack->next) {
+        if (!strncmp(pack->filename, idx_filename, len))
+            return 1;
+    }
+    return 0;
+}
+
+static void prepare_packs() {
+    packs_prepared = 1;
+
+    char dirname[PATH_MAX];
+    if (snprintf(dirname, PATH_MAX, "%s/objects/pack", get_knit_dir()) >= PATH_MAX)
+        die("path too long");
+    DIR* dir = opendir(dirname);
+    if (!dir) {
+        if (errno != ENOENT)
+            warning_errno("cannot open %s", dirname);
+        return;
+    }
+
+    struct dirent* dent;
+    while (errno = 0, (dent = readdir(dir))) {
+        if (strncmp(dent->d_name, "pack-", 5) || !has_suffix(dent->d_name, ".idx"))
+            continue;
+        char filename[PATH_MAX];
+        if (snprintf(filename, PATH_MAX, "%s/%s", dirname, dent->d_name) >= PATH_MAX)
+            die("path too long");
+        // Packs are never unmapped, so views into them remain valid.
+        struct pack* pack;
+        if (pack_is_loaded(filename) || load_pack(filename, &pack) < 0)
+            continue;
+        pack->next = packs;
+        packs = pack;
+    }
+    if (errno != 0)
+        die_errno("readdir");
+    closedir(dir);
+}
+
+struct pack* get_packs() {
+    if (!packs_prepared)
+        prepare_packs();
+    return packs;
+}
+
+void reprepare_packs() {
+    prepare_packs();
+}
+
+ssize_t pack_find_index(const struct pack* pack, const struct object_id* oid) {
+    uint8_t first = oid->hash[0];
+    size_t lo = first ? ntohl(pack->fanout[first - 1]) : 0;
+    size_t hi = ntohl(pack->fanout[first]);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(oid->hash, &pack->oids[mid * KNIT_HASH_RAWSZ],
+                         KNIT_HASH_RAWSZ);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+uint64_t pack_offset_at(const struct pack* pack, size_t i) {
+    return get_be64(&pack->offsets[i * sizeof(uint64_t)]);
+}
+
+int find_packed_object(const struct object_id* oid, struct bytebuf* out) {
+    for (struct pack* pack = get_packs(); pack; pack = pack->next) {
+        ssize_t i = pack_find_index(pack, oid);
+        if (i < 0)
+            continue;
+
+        // Objects are stored in index order, so each extends to the next.
+        uint64_t start = pack_offset_at(pack, i);
+        uint64_t end = (size_t)i + 1 < pack->num_objects
+            ? pack_offset_at(pack, i + 1)
+            : pack->data.size;
+        if (start < sizeof(struct pack_header) || start > end ||
+                end > pack->data.size)
+            return error("corrupt pack offset for %s in %s",
+                         oid_to_hex(oid), pack->filename);
+
+        memset(out, 0, sizeof(*out));
+        out->data = (char*)pack->data.data + start;
+        out->size = end - start;
+        return 0;
+    }
+    return -1;
+}
+
+int has_packed_object(const struct object_id* oid) {
+    for (struct pack* pack = get_packs(); pack; pack = pack->next) {
+        if (pack_find_index(pack, oid) >= 0)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "hash.h"
+
+// A pack concatenates stored objects (exactly as they would appear in loose
+// object files) into objects/pack/pack-<hash>.pack. Its companion .idx file
+// maps object ids to offsets within the pack:
+//
+//   pack_idx_header
+//   uint32_t fanout[256]  cumulative count of oids by first byte
+//   uint8_t  oids[num_objects][KNIT_HASH_RAWSZ]  sorted
+//   uint64_t offsets[num_objects]
+//
+// All integers are big endian.
+
+#define PACK_SIGNATURE 0x4b50434b // "KPCK"
+#define PACK_IDX_SIGNATURE 0x4b494458 // "KIDX"
+#define PACK_VERSION 1
+
+struct pack_header {
+    uint32_t signature;
+    uint32_t version;
+    uint32_t num_objects;
+};
+
+struct pack_idx_header {
+    uint32_t signature;
+    uint32_t version;
+    uint32_t num_objects;
+};
+
+#define PACK_FANOUT_SIZE 256
+
+struct pack {
+    struct pack* next;
+    char* filename;  // of the .pack file
+    struct bytebuf idx;
+    struct bytebuf data;
+    uint32_t num_objects;
+    const uint32_t* fanout;
+    const uint8_t* oids;
+    const uint8_t* offsets;
+};
+
+// Returns the (lazily loaded) list of packs in the knit directory.
+struct pack* get_packs();
+// Rescan for packs; call when an object is unexpectedly missing since it may
+// have been repacked since packs were last loaded.
+void reprepare_packs();
+
+// Returns the index of oid in pack, or -1 if absent.
+ssize_t pack_find_index(const struct pack* pack, const struct object_id* oid);
+uint64_t pack_offset_at(const struct pack* pack, size_t i);
+
+// Find the stored object in any pack. On success out borrows the pack mapping
+// (starting at the object header) and should not be cleaned up.
+int find_packed_object(const struct object_id* oid, struct bytebuf* out);
+int has_packed_object(const struct object_id* oid);
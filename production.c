@@ -24,9 +24,8 @@ struct output {
     char name[];
 };
 
-int parse_production_bytes(struct production* prd, void* data, size_t size) {
-    if (prd->object.is_parsed)
-        return 0;
+static int parse_production_outputs(struct production* prd,
+                                    void* data, size_t size) {
     struct production_header* hdr = (struct production_header*)data;
     size_t off = sizeof(*hdr);
     if (size < off)
@@ -41,7 +40,11 @@ int parse_production_bytes(struct production* prd, void* data, size_t size) {
         off += sizeof(*inv_hdr);
     }
 
-    struct resource_list** list_p = &prd->outputs;
+    // Each output takes at least its hash and a NUL.
+    if (off > size || num_outputs > (size - off) / (sizeof(struct output) + 1))
+        return error("truncated production output");
+    resource_list_reserve(&prd->outputs, num_outputs);
+
     const char* prev_name = "";
     for (uint32_t i = 0; i < num_outputs; i++) {
         struct output* out = (struct output*)((char*)data + off);
@@ -52,22 +55,30 @@ int parse_production_bytes(struct production* prd, void* data, size_t size) {
         if (pathlen == nrem)
             return error("production output not NUL-terminated");
 
-        struct resource_list* list = xmalloc(sizeof(*list));
-        list->res = get_resource(oid_of_hash(out->res_hash));
-        list->name = strdup(out->name);
-        list->next = NULL;
-
-        if (strcmp(prev_name, list->name) >= 0)
+        if (strcmp(prev_name, out->name) >= 0)
             return error("production output names not in strict lexicographical order");
-        prev_name = list->name;
+        char* name = out->name;
+        resource_list_append(&prd->outputs, name,
+                             get_resource(oid_of_hash(out->res_hash)));
+        prev_name = name;
 
         off += sizeof(*out) + pathlen + 1;
-        *list_p = list;
-        list_p = &list->next;
     }
     if (off != size)
         return error("trailing production data");
+    return 0;
+}
 
+int parse_production_bytes(struct production* prd, void* data, size_t size) {
+    if (prd->object.is_parsed)
+        return 0;
+    if (parse_production_outputs(prd, data, size) < 0) {
+        // Do not leave entries pointing into data, which the caller may free.
+        resource_list_clear(&prd->outputs);
+        prd->job = NULL;
+        prd->inv = NULL;
+        return -1;
+    }
     prd->object.is_parsed = 1;
     return 0;
 }
@@ -75,17 +86,19 @@ int parse_production_bytes(struct production* prd, void* data, size_t size) {
 int parse_production(struct production* prd) {
     if (prd->object.is_parsed)
         return 0;
-    size_t size;
-    void* buf = read_object_of_type(&prd->object.oid, OBJ_PRODUCTION, &size);
-    if (!buf)
+    struct bytebuf bb;
+    if (read_object_view_of_type(&prd->object.oid, OBJ_PRODUCTION, &bb) < 0)
         return -1;
-    int ret = parse_production_bytes(prd, buf, size);
-    free(buf);
-    return ret;
+    retain_object_view(&bb);
+    if (parse_production_bytes(prd, bb.data, bb.size) < 0) {
+        cleanup_bytebuf(&bb);
+        return -1;
+    }
+    return 0; // the production now borrows bb
 }
 
 struct production* store_production(struct job* job, struct invocation* inv,
-                                    struct resource_list* outputs) {
+                                    const struct resource_list* outputs) {
     if (parse_job(job) < 0)
         return NULL;
     size_t size = sizeof(struct production_header);
@@ -94,7 +107,8 @@ struct production* store_production(struct job* job, struct invocation* inv,
             return NULL;
         size += sizeof(struct production_invocation);
     }
-    for (const struct resource_list* curr = outputs; curr; curr = curr->next) {
+    for (size_t i = 0; i < outputs->num_entries; i++) {
+        const struct resource_entry* curr = &outputs->entries[i];
         if (parse_resource(curr->res) < 0)
             return NULL;
         size += sizeof(struct output) + strlen(curr->name) + 1;
@@ -111,9 +125,10 @@ struct production* store_production(struct job* job, struct invocation* inv,
         p += sizeof(*inv_hdr);
     }
 
-    uint32_t count = 0;
+    size_t count = outputs->num_entries;
     const char* prev_name = "";
-    for (const struct resource_list* curr = outputs; curr; curr = curr->next) {
+    for (size_t i = 0; i < count; i++) {
+        const struct resource_entry* curr = &outputs->entries[i];
         if (strcmp(prev_name, curr->name) >= 0) {
             error("job input names not in strict lexicographical order");
             return NULL;
@@ -125,7 +140,6 @@ struct production* store_production(struct job* job, struct invocation* inv,
         size_t pathsize = strlen(curr->name) + 1;
         memcpy(out->name, curr->name, pathsize);
         p += sizeof(*out) + pathsize;
-        count++;
     }
     assert(count <= PH_OUTPUTS_MASK);
     hdr->flags = htonl(count | (inv ? PH_INVOCATION : 0));
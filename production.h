@@ -10,14 +10,17 @@ struct production {
     struct object object;
     struct job* job;
     struct invocation* inv;
-    struct resource_list* outputs;
+    struct resource_list outputs;
 };
 
 struct production* get_production(const struct object_id* oid);
 int parse_production(struct production* prd);
+// On success, output names point into data, which must then outlive prd.
 int parse_production_bytes(struct production* prd, void* data, size_t size);
-// Caller should free outputs.
+// Outputs must be sorted. Caller should free outputs.
 struct production* store_production(struct job* job, struct invocation* inv,
-                                    struct resource_list* outputs);
+                                    const struct resource_list* outputs);
 
+#define PRODUCTION_OUTPUT_EXITCODE ".knit/exitcode"
+#define PRODUCTION_OUTPUT_LOG ".knit/log"
 #define PRODUCTION_OUTPUT_OK ".knit/ok"
@@ -1,6 +1,13 @@
 #include "resource.h"
 
+#include "statcache.h"
+
 #include <ftw.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Files are hashed and written by up to this many threads.
+#define MAX_INGEST_THREADS 32
 
 struct resource* get_resource(const struct object_id* oid) {
     return intern_object(oid, OBJ_RESOURCE, sizeof(struct resource));
@@ -9,11 +16,15 @@ struct resource* get_resource(const struct object_id* oid) {
 int parse_resource(struct resource* res) {
     if (res->object.is_parsed)
         return 0;
-    size_t size;
-    void* buf = read_object_of_type(&res->object.oid, OBJ_RESOURCE, &size);
-    if (!buf)
+    // Resources have no structure, so parsing only checks the type.
+    uint32_t typesig;
+    if (stat_object(&res->object.oid, &typesig, NULL) < 0)
         return -1;
-    free(buf);
+    if (typesig != OBJ_RESOURCE)
+        return error("object %s is type %s, expected %s",
+                     oid_to_hex(&res->object.oid), strtypesig(typesig),
+                     strtypesig(OBJ_RESOURCE));
+    res->object.is_parsed = 1;
     return 0;
 }
 
@@ -25,12 +36,30 @@ struct resource* store_resource(const void* data, size_t size) {
 }
 
 struct resource* store_resource_file(const char* filename) {
-    struct bytebuf bb;
-    if (mmap_or_slurp_file(filename, &bb) < 0)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        error_errno("cannot open %s", filename);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        error_errno("cannot stat %s", filename);
+        close(fd);
+        return NULL;
+    }
+    const struct object_id* cached = lookup_statcache(&st);
+    if (cached && has_object(cached)) {
+        close(fd);
+        return get_resource(cached);
+    }
+
+    struct object_id oid;
+    int rc = write_object_fd(OBJ_RESOURCE, fd, &oid);
+    close(fd);
+    if (rc < 0)
         return NULL;
-    struct resource* res = store_resource(bb.data, bb.size);
-    cleanup_bytebuf(&bb);
-    return res;
+    add_statcache(&st, &oid);
+    return get_resource(&oid);
 }
 
 struct resource* get_empty_resource() {
@@ -40,36 +69,82 @@ struct resource* get_empty_resource() {
     return empty_res;
 }
 
-struct resource_list* resource_list_insert(struct resource_list** list_p,
-                                           const char* name,
-                                           struct resource* res) {
-    struct resource_list* list = *list_p;
-    while (list && strcmp(list->name, name) < 0) {
-        list_p = &list->next;
-        list = list->next;
+void resource_list_append(struct resource_list* list, char* name,
+                          struct resource* res) {
+    if (list->num_entries == list->alloc_entries) {
+        list->alloc_entries = (list->alloc_entries + 16) * 2;
+        list->entries = xrealloc(list->entries,
+                                 list->alloc_entries * sizeof(*list->entries));
     }
-    struct resource_list* node = xmalloc(sizeof(*node));
-    node->name = strdup(name);
-    node->res = res;
-    node->next = list;
-    *list_p = node;
-    return node;
+    struct resource_entry* entry = &list->entries[list->num_entries++];
+    entry->name = name;
+    entry->res = res;
+}
+
+void resource_list_reserve(struct resource_list* list, size_t num_entries) {
+    if (num_entries <= list->alloc_entries)
+        return;
+    list->alloc_entries = num_entries;
+    list->entries = xrealloc(list->entries,
+                             list->alloc_entries * sizeof(*list->entries));
 }
 
-void resource_list_remove_and_free(struct resource_list** list_p) {
-    struct resource_list* next = (*list_p)->next;
-    free((*list_p)->name);
-    free(*list_p);
-    *list_p = next;
+static int cmp_resource_entry(const void* a, const void* b) {
+    return strcmp(((const struct resource_entry*)a)->name,
+                  ((const struct resource_entry*)b)->name);
 }
 
-// Global state used by nftw callback each_file().
-static struct resource_list** resources_p;
+void resource_list_sort(struct resource_list* list) {
+    if (list->num_entries > 1)
+        qsort(list->entries, list->num_entries, sizeof(*list->entries),
+              cmp_resource_entry);
+}
+
+size_t resource_list_lower_bound(const struct resource_list* list,
+                                 const char* name) {
+    size_t lo = 0;
+    size_t hi = list->num_entries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(list->entries[mid].name, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+struct resource_entry* resource_list_find(const struct resource_list* list,
+                                          const char* name) {
+    size_t i = resource_list_lower_bound(list, name);
+    if (i == list->num_entries || strcmp(list->entries[i].name, name))
+        return NULL;
+    return &list->entries[i];
+}
+
+void resource_list_clear(struct resource_list* list) {
+    free(list->entries);
+    memset(list, 0, sizeof(*list));
+}
+
+struct dir_file {
+    char* filename;
+    char* name;
+    struct stat st;
+    struct object_id oid;
+    unsigned is_cached : 1;
+};
+
+// Global state used by nftw callback each_file() and ingest workers.
+static struct dir_file* dir_files;
+static size_t num_dir_files;
+static size_t alloc_dir_files;
 static size_t filename_offset;
 static const char* name_prefix;
-static int num_inserted;
+static atomic_size_t next_dir_file;
+static atomic_int ingest_failed;
 
-static int each_file(const char* filename, const struct stat* /*st*/,
+static int each_file(const char* filename, const struct stat* st,
                      int type, struct FTW* /*ftwbuf*/) {
     switch (type) {
     case FTW_F:
@@ -92,26 +167,103 @@ static int each_file(const char* filename, const struct stat* /*st*/,
     if (!strncmp(name, ".knit/", 6))
         return 0;
 
-    char buf[PATH_MAX];
-    if (*name_prefix) {
-        if (snprintf(buf, PATH_MAX, "%s%s", name_prefix, name) >= PATH_MAX)
-            die("name too long: %s%s", name_prefix, name);
-        name = buf;
+    if (num_dir_files == alloc_dir_files) {
+        alloc_dir_files = (alloc_dir_files + 16) * 2;
+        dir_files = xrealloc(dir_files, alloc_dir_files * sizeof(*dir_files));
+    }
+    struct dir_file* file = &dir_files[num_dir_files++];
+    memset(file, 0, sizeof(*file));
+    file->filename = strdup(filename);
+    file->name = xmalloc(strlen(name_prefix) + strlen(name) + 1);
+    stpcpy(stpcpy(file->name, name_prefix), name);
+    file->st = *st;
+    // The stat cache is not thread-safe, so consult it here.
+    const struct object_id* cached = lookup_statcache(st);
+    if (cached) {
+        memcpy(file->oid.hash, cached->hash, KNIT_HASH_RAWSZ);
+        file->is_cached = 1;
     }
+    return 0;
+}
 
-    struct resource* res = store_resource_file(filename);
-    if (!res) {
-        errno = EIO;
-        return 1;
+// Workers claim files in order until none are left. Only thread-safe object
+// store functions may be called here; interning happens afterwards.
+static void* ingest_worker(void* /*arg*/) {
+    size_t i;
+    while (!ingest_failed &&
+           (i = atomic_fetch_add(&next_dir_file, 1)) < num_dir_files) {
+        struct dir_file* file = &dir_files[i];
+        if (file->is_cached && has_object(&file->oid))
+            continue;
+        file->is_cached = 0;
+
+        int fd = open(file->filename, O_RDONLY);
+        if (fd < 0) {
+            error_errno("cannot open %s", file->filename);
+            ingest_failed = 1;
+            break;
+        }
+        if (fstat(fd, &file->st) < 0) {
+            error_errno("cannot stat %s", file->filename);
+            ingest_failed = 1;
+        } else if (write_object_fd(OBJ_RESOURCE, fd, &file->oid) < 0) {
+            ingest_failed = 1;
+        }
+        close(fd);
     }
+    return NULL;
+}
 
-    // We expect resource lists to be short, but building them may be quadratic.
-    resource_list_insert(resources_p, name, res);
-    num_inserted++;
-    return 0;
+static size_t num_ingest_threads() {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1)
+        ncpus = 1;
+    if (ncpus > MAX_INGEST_THREADS)
+        ncpus = MAX_INGEST_THREADS;
+    // Each thread should have a few files to amortize its startup.
+    size_t num_threads = num_dir_files / 4;
+    if (num_threads > (size_t)ncpus)
+        num_threads = ncpus;
+    return num_threads ? num_threads : 1;
 }
 
-int resource_list_insert_dir_files(struct resource_list** list_p,
+static int ingest_dir_files() {
+    prepare_object_writes();
+
+    next_dir_file = 0;
+    ingest_failed = 0;
+    size_t num_threads = num_ingest_threads();
+    pthread_t threads[MAX_INGEST_THREADS];
+    size_t num_started = 0;
+    for (; num_started + 1 < num_threads; num_started++) {
+        if (pthread_create(&threads[num_started], NULL, ingest_worker, NULL))
+            break; // proceed with fewer threads
+    }
+    ingest_worker(NULL);
+    for (size_t i = 0; i < num_started; i++)
+        pthread_join(threads[i], NULL);
+    return ingest_failed ? -1 : 0;
+}
+
+static void append_dir_files(struct resource_list* list) {
+    for (size_t i = 0; i < num_dir_files; i++) {
+        struct dir_file* file = &dir_files[i];
+        resource_list_append(list, file->name, get_resource(&file->oid));
+        file->name = NULL;
+    }
+}
+
+static void free_dir_files() {
+    for (size_t i = 0; i < num_dir_files; i++) {
+        free(dir_files[i].filename);
+        free(dir_files[i].name);
+    }
+    free(dir_files);
+    dir_files = NULL;
+    num_dir_files = alloc_dir_files = 0;
+}
+
+int resource_list_append_dir_files(struct resource_list* list,
                                    const char* dir, const char* prefix) {
     // Assume a reasonable implementation of nftw that preserves dir as the
     // callback filename prefix.
@@ -119,13 +271,23 @@ int resource_list_insert_dir_files(struct resource_list** list_p,
     if (dir[filename_offset - 1] != '/')
         filename_offset++;
 
-    resources_p = list_p;
     name_prefix = prefix;
-    num_inserted = 0;
-    if (nftw(dir, each_file, 16, 0) != 0) {
-        while (*resources_p)
-            resource_list_remove_and_free(resources_p);
+    int rc = nftw(dir, each_file, 16, 0);
+    if (rc == 0 && ingest_dir_files() < 0) {
+        errno = EIO;
+        rc = -1;
+    }
+    if (rc != 0) {
+        free_dir_files();
         return -1;
     }
+
+    for (size_t i = 0; i < num_dir_files; i++) {
+        if (!dir_files[i].is_cached)
+            add_statcache(&dir_files[i].st, &dir_files[i].oid);
+    }
+    append_dir_files(list);
+    int num_inserted = num_dir_files;
+    free_dir_files();
     return num_inserted;
 }
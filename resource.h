@@ -13,21 +13,42 @@ struct resource* store_resource_file(const char* filename);
 
 struct resource* get_empty_resource();
 
-struct resource_list {
+struct resource_entry {
     char* name;
     struct resource* res;
-    struct resource_list* next;
 };
 
-struct resource_list* resource_list_insert(struct resource_list** list_p,
-                                           const char* name,
-                                           struct resource* res);
-void resource_list_remove_and_free(struct resource_list** list_p);
+// A contiguous array of named resources. Lists are built by appending in any
+// order and then sorting once; jobs and productions require sorted lists with
+// unique names. Names are not owned by the list.
+struct resource_list {
+    struct resource_entry* entries;
+    size_t num_entries;
+    size_t alloc_entries;
+};
 
-// Recursively walk dir and add all files to *list_p. The name will be relative
+void resource_list_append(struct resource_list* list, char* name,
+                          struct resource* res);
+// Make room for num_entries in total without further reallocation.
+void resource_list_reserve(struct resource_list* list, size_t num_entries);
+// Sort entries by name. Entries with equal names are left adjacent.
+void resource_list_sort(struct resource_list* list);
+// Index of the first entry whose name is not less than name in a sorted list.
+size_t resource_list_lower_bound(const struct resource_list* list,
+                                 const char* name);
+// Binary search a sorted list; returns NULL if name is missing.
+struct resource_entry* resource_list_find(const struct resource_list* list,
+                                          const char* name);
+// Free the entries (but not their names) and reset the list to empty.
+void resource_list_clear(struct resource_list* list);
+
+// Recursively walk dir and append all files to list. The name will be relative
 // to dir and prepended with prefix.
 //
+// Files are read, hashed and stored by a pool of threads. Entries are appended
+// in traversal order, so the list needs resource_list_sort() afterwards.
+//
 // Returns the number of files added; on error, returns -1 and sets errno.
 // Not thread-safe.
-int resource_list_insert_dir_files(struct resource_list** list_p,
+int resource_list_append_dir_files(struct resource_list* list,
                                    const char* dir, const char* prefix);
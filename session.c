@@ -7,58 +7,165 @@
 static struct bytebuf session_bb;
 static struct bump_list* session_bump;
 
-static void* bmalloc(size_t size) {
-    size_t* raw = bump_alloc(&session_bump, sizeof(size) + size);
-    *raw = size;
-    return raw + 1;
-}
-
-static void* brealloc(void* ptr, size_t size) {
-    void* copy = bmalloc(size);
-    if (ptr)
-        memcpy(copy, ptr, ((size_t*)ptr)[-1]); // ptr is leaked
-    return copy;
-}
-
 #define MAX_SESSION_NUM (~(uint32_t)0)
 static_assert(MAX_SESSION_NUM <= SIZE_MAX);
 
-struct session_step** active_steps;
+// Arrays may point into session_bb until they grow; alloc is 0 until then.
+struct session_step* active_steps;
 size_t num_active_steps;
 static size_t alloc_active_steps;
 
 size_t num_active_fanout;
 
-struct session_input** active_inputs;
+struct session_input* active_inputs;
 size_t num_active_inputs;
 static size_t alloc_active_inputs;
 
-struct session_dependency** active_deps;
+struct session_dependency* active_deps;
 size_t num_active_deps;
 static size_t alloc_active_deps;
 static int deps_dirty; // may not be ordered
 
+// Dependencies are ordered by step, so the dependencies on step_pos's outputs
+// are active_deps[dep_offsets[step_pos]] up to dep_offsets[step_pos + 1]. The
+// offsets are built when first needed; num_dep_offsets is 0 until then.
+static uint32_t* dep_offsets;
+static size_t num_dep_offsets;
+static size_t alloc_dep_offsets;
+
+// Steps whose jobs were compiled but that next_ready_step() has not yet
+// returned, in order.
+static uint32_t* ready_steps;
+static size_t ready_head;
+static size_t ready_tail;
+static size_t alloc_ready_steps;
+
+static char* session_strings;
+static size_t strings_size;
+static size_t alloc_strings;
+
 static size_t realloc_size(size_t alloc) { return (alloc + 16) * 2; }
 
-static void ensure_alloc_steps() {
-    if (num_active_steps < alloc_active_steps)
+// Grow an array of num elements of size elem_size. The old array is either
+// mapped or bump allocated, so it is not freed.
+static void ensure_alloc(void** array, size_t* alloc, size_t num,
+                         size_t elem_size) {
+    if (num < *alloc)
         return;
-    alloc_active_steps = realloc_size(alloc_active_steps);
-    active_steps = brealloc(active_steps, alloc_active_steps * sizeof(*active_steps));
+    *alloc = realloc_size(num);
+    void* copy = bump_alloc(&session_bump, *alloc * elem_size);
+    if (num)
+        memcpy(copy, *array, num * elem_size);
+    *array = copy;
+}
+
+static void ensure_alloc_steps() {
+    ensure_alloc((void**)&active_steps, &alloc_active_steps,
+                 num_active_steps, sizeof(*active_steps));
 }
 
 static void ensure_alloc_inputs() {
-    if (num_active_inputs < alloc_active_inputs)
-        return;
-    alloc_active_inputs = realloc_size(alloc_active_inputs);
-    active_inputs = brealloc(active_inputs, alloc_active_inputs * sizeof(*active_inputs));
+    ensure_alloc((void**)&active_inputs, &alloc_active_inputs,
+                 num_active_inputs, sizeof(*active_inputs));
 }
 
 static void ensure_alloc_deps() {
-    if (num_active_deps < alloc_active_deps)
+    ensure_alloc((void**)&active_deps, &alloc_active_deps,
+                 num_active_deps, sizeof(*active_deps));
+}
+
+// Returns the big endian offset of a copy of s in the string table.
+static uint32_t add_session_string(const char* s) {
+    size_t len = strlen(s) + 1;
+    if (strings_size + len > MAX_SESSION_NUM)
+        die("session strings too large");
+    if (strings_size + len > alloc_strings) {
+        size_t alloc = realloc_size(strings_size + len);
+        char* copy = bump_alloc(&session_bump, alloc);
+        if (strings_size)
+            memcpy(copy, session_strings, strings_size);
+        session_strings = copy;
+        alloc_strings = alloc;
+    }
+    memcpy(session_strings + strings_size, s, len);
+    uint32_t offset = htonl(strings_size);
+    strings_size += len;
+    return offset;
+}
+
+const char* session_string(uint32_t offset) {
+    // The string table is NUL-terminated when loaded, so any offset within it
+    // is a valid string.
+    size_t off = ntohl(offset);
+    if (off >= strings_size)
+        die("session string offset %zu out of bounds", off);
+    return session_strings + off;
+}
+
+// A session loaded with its lock is changed in place, and save_session()
+// appends the changes to <session>.journal instead of rewriting the session.
+// Loading replays the journal. Each record holds the whole of a changed step
+// or input (and the input name, since fanout creates inputs), and later
+// records override earlier ones. A record torn by a crash is dropped. Records
+// only apply to the session file they were appended to, so checkpoint_session()
+// removes the journal before replacing the session.
+struct journal_record {
+    uint32_t type;
+    uint32_t pos;
+    uint32_t size;  // of the payload that follows
+};
+
+#define JR_STEP   1  // payload is the step
+#define JR_INPUT  2  // payload is the input then its name; pos may be new
+#define JR_FANOUT 3  // pos is num_active_fanout; no payload
+
+static int is_journaled;
+static int journal_fd = -1;
+static size_t journal_size;  // bytes of whole records in the journal
+static size_t base_size;     // bytes in the session file
+static size_t journaled_fanout;
+
+// Positions changed since the last save; they may repeat.
+static uint32_t* dirty_steps;
+static size_t num_dirty_steps;
+static size_t alloc_dirty_steps;
+static uint32_t* dirty_inputs;
+static size_t num_dirty_inputs;
+static size_t alloc_dirty_inputs;
+
+static void mark_dirty(uint32_t** list, size_t* num, size_t* alloc, size_t pos) {
+    if (!is_journaled)
         return;
-    alloc_active_deps = realloc_size(alloc_active_deps);
-    active_deps = brealloc(active_deps, alloc_active_deps * sizeof(*active_deps));
+    if (*num == *alloc) {
+        *alloc = realloc_size(*alloc);
+        *list = xrealloc(*list, *alloc * sizeof(**list));
+    }
+    (*list)[(*num)++] = pos;
+}
+
+void mark_step_dirty(size_t step_pos) {
+    mark_dirty(&dirty_steps, &num_dirty_steps, &alloc_dirty_steps, step_pos);
+}
+
+static void mark_input_dirty(size_t input_pos) {
+    mark_dirty(&dirty_inputs, &num_dirty_inputs, &alloc_dirty_inputs, input_pos);
+}
+
+static void push_ready_step(size_t step_pos) {
+    if (ready_tail == alloc_ready_steps) {
+        alloc_ready_steps = realloc_size(alloc_ready_steps);
+        ready_steps = xrealloc(ready_steps,
+                               alloc_ready_steps * sizeof(*ready_steps));
+    }
+    ready_steps[ready_tail++] = step_pos;
+}
+
+ssize_t next_ready_step() {
+    if (ready_head == ready_tail) {
+        ready_head = ready_tail = 0;
+        return -1;
+    }
+    return ready_steps[ready_head++];
 }
 
 size_t create_session_step(const char* name) {
@@ -67,16 +174,11 @@ size_t create_session_step(const char* name) {
     if (num_active_fanout > 0)
         die("step created after fanout started");
 
-    size_t namelen = strlen(name);
-    struct session_step* ss = bmalloc(sizeof(struct session_step) + namelen + 1);
-    memset(ss, 0, sizeof(*ss));
-    if (namelen > SS_NAMEMASK)
-        die("step name too long %s", name);
-    ss_init_flags(ss, namelen, 0);
-    strcpy(ss->name, name);
-
     ensure_alloc_steps();
-    active_steps[num_active_steps] = ss;
+    num_dep_offsets = 0;
+    struct session_step* ss = &active_steps[num_active_steps];
+    memset(ss, 0, sizeof(*ss));
+    ss->name = add_session_string(name);
     return num_active_steps++;
 }
 
@@ -87,31 +189,27 @@ size_t create_session_input(size_t step_pos, const char* name) {
 
     // Maintain session inputs in strictly monotonic order.
     if (num_active_inputs > 0) {
-        struct session_input* prev_si = active_inputs[num_active_inputs - 1];
+        struct session_input* prev_si = &active_inputs[num_active_inputs - 1];
         size_t prev_step_pos = ntohl(prev_si->step_pos);
         if (step_pos < prev_step_pos ||
-                (step_pos == prev_step_pos && strcmp(name, prev_si->name) <= 0))
+                (step_pos == prev_step_pos && strcmp(name, si_name(prev_si)) <= 0))
             die("step %zu input %s <= previous step %zu input %s",
-                step_pos, name, prev_step_pos, prev_si->name);
+                step_pos, name, prev_step_pos, si_name(prev_si));
     }
 
-    size_t namelen = strlen(name);
-    struct session_input* si = bmalloc(sizeof(struct session_input) + namelen + 1);
+    uint32_t name_offset = add_session_string(name);
+    ensure_alloc_inputs();
+    struct session_input* si = &active_inputs[num_active_inputs];
     memset(si, 0, sizeof(*si));
     si->step_pos = htonl(step_pos);
-    if (namelen > SI_PATHMASK)
-        die("input name too long %s", name);
-    si_init_flags(si, namelen, 0);
-    strcpy(si->name, name);
-
-    ensure_alloc_inputs();
-    active_inputs[num_active_inputs] = si;
+    si->name = name_offset;
+    mark_input_dirty(num_active_inputs);
     return num_active_inputs++;
 }
 
 size_t create_session_dependency(size_t input_pos,
                                  size_t step_pos, const char* output,
-                                 uint16_t flags) {
+                                 uint32_t flags) {
     if (num_active_deps == MAX_SESSION_NUM)
         die("too many dependencies");
 
@@ -120,26 +218,22 @@ size_t create_session_dependency(size_t input_pos,
         dependent_pos = input_pos;
     } else {
         assert(input_pos < num_active_inputs);
-        struct session_input* si = active_inputs[input_pos];
-        dependent_pos = ntohl(si->step_pos);
+        dependent_pos = ntohl(active_inputs[input_pos].step_pos);
     }
     if (dependent_pos >= num_active_steps)
         die("dependent out of bounds");
-    ss_inc_unresolved(active_steps[dependent_pos]);
+    ss_inc_unresolved(&active_steps[dependent_pos]);
 
-    size_t outlen = strlen(output);
-    struct session_dependency* sd = bmalloc(sizeof(struct session_dependency) + outlen + 1);
-    memset(sd, 0, sizeof(*sd));
+    uint32_t output_offset = add_session_string(output);
+    ensure_alloc_deps();
+    struct session_dependency* sd = &active_deps[num_active_deps];
     sd->input_pos = htonl(input_pos);
     sd->step_pos = htonl(step_pos);
-    if (outlen > SD_OUTPUTMASK)
-        die("output name too long %s", output);
-    sd_init_flags(sd, outlen, flags);
-    strcpy(sd->output, output);
+    sd->sd_flags = htonl(flags);
+    sd->output = output_offset;
 
     deps_dirty = 1;
-    ensure_alloc_deps();
-    active_deps[num_active_deps] = sd;
+    num_dep_offsets = 0;
     return num_active_deps++;
 }
 
@@ -153,6 +247,7 @@ size_t add_session_fanout_step() {
 
 static char session_filepath[PATH_MAX];
 static char session_lockfile[PATH_MAX];
+static char journal_filepath[PATH_MAX];
 static const char* session_name;
 
 static int unlock_session_atexit;
@@ -175,6 +270,9 @@ static int set_session_name(const char* sessname) {
             return error("session path too long");
         session_name = session_filepath + len - strlen(sessname);
     }
+    if (snprintf(journal_filepath, PATH_MAX,
+                 "%s.journal", session_filepath) >= PATH_MAX)
+        return error("journal path too long");
 
     return 0;
 }
@@ -198,13 +296,6 @@ static int set_session_name_and_lock(const char* sessname) {
     return 0;
 }
 
-struct session_header {
-    uint32_t num_steps;
-    uint32_t num_inputs;
-    uint32_t num_deps;
-    uint32_t num_fanout;
-};
-
 int new_session(const char* sessname) {
     if (set_session_name_and_lock(sessname) < 0)
         return -1;
@@ -215,62 +306,237 @@ int new_session(const char* sessname) {
     return 0;
 }
 
-int load_current_session() {
-    if (mmap_or_slurp_file(session_filepath, &session_bb) < 0)
-        return -1;
+static int replay_journal() {
+    struct bytebuf bb;
+    int fd = open(journal_filepath, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return 0;
+        return error_errno("cannot open %s", journal_filepath);
+    }
+    if (slurp_fd(fd, &bb) < 0) {
+        close(fd);
+        return error_errno("cannot read %s", journal_filepath);
+    }
+    close(fd);
 
-    if (session_bb.size < sizeof(struct session_header))
-        return error("truncated session header");
-    struct session_header* hdr = session_bb.data;
+    int rc = 0;
+    size_t off = 0;
+    while (bb.size - off >= sizeof(struct journal_record)) {
+        struct journal_record jr;
+        memcpy(&jr, (char*)bb.data + off, sizeof(jr));
+        size_t pos = ntohl(jr.pos);
+        size_t size = ntohl(jr.size);
+        if (bb.size - off - sizeof(jr) < size)
+            break;  // torn
+        const char* payload = (char*)bb.data + off + sizeof(jr);
+
+        if (ntohl(jr.type) == JR_STEP) {
+            struct session_step ss;
+            if (size != sizeof(ss) || pos >= num_active_steps) {
+                rc = error("invalid journal step");
+                break;
+            }
+            memcpy(&ss, payload, size);
+            if (ss.name != active_steps[pos].name) {
+                rc = error("journal step %zu does not match", pos);
+                break;
+            }
+            active_steps[pos] = ss;
+        } else if (ntohl(jr.type) == JR_INPUT) {
+            struct session_input si;
+            const char* name = payload + sizeof(si);
+            if (size <= sizeof(si) || payload[size - 1] != '\0' ||
+                    strlen(name) != size - sizeof(si) - 1 ||
+                    pos > num_active_inputs) {
+                rc = error("invalid journal input");
+                break;
+            }
+            memcpy(&si, payload, sizeof(si));
+            if (pos == num_active_inputs) {
+                si.name = add_session_string(name);
+                ensure_alloc_inputs();
+                num_active_inputs++;
+            } else if (strcmp(name, si_name(&active_inputs[pos]))) {
+                rc = error("journal input %zu does not match", pos);
+                break;
+            } else {
+                si.name = active_inputs[pos].name;
+            }
+            active_inputs[pos] = si;
+        } else if (ntohl(jr.type) == JR_FANOUT && !size) {
+            num_active_fanout = pos;
+        } else {
+            rc = error("invalid journal record");
+            break;
+        }
+        off += sizeof(jr) + size;
+    }
+    journal_size = off;
+    cleanup_bytebuf(&bb);
+    return rc;
+}
 
-    alloc_active_steps = num_active_steps = ntohl(hdr->num_steps);
-    active_steps = bmalloc(alloc_active_steps * sizeof(struct session_step*));
-    alloc_active_inputs = num_active_inputs = ntohl(hdr->num_inputs);
-    active_inputs = bmalloc(alloc_active_inputs * sizeof(struct session_input*));
-    alloc_active_deps = num_active_deps = ntohl(hdr->num_deps);
-    active_deps = bmalloc(alloc_active_deps * sizeof(struct session_dependency*));
-    num_active_fanout = ntohl(hdr->num_fanout);
+// Version 1 sessions had a header of just the counts, followed by records
+// with 16-bit counters and flags whose low 12 bits were the length of the
+// name inlined after them.
+struct session_header_v1 {
+    uint32_t num_steps;
+    uint32_t num_inputs;
+    uint32_t num_deps;
+    uint32_t num_fanout;
+};
+
+struct session_step_v1 {
+    uint8_t job_hash[KNIT_HASH_RAWSZ];
+    uint8_t prd_hash[KNIT_HASH_RAWSZ];
+    uint16_t num_unresolved;
+    uint16_t ss_flags;
+    char name[];
+};
+
+struct session_input_v1 {
+    union {
+        uint8_t res_hash[KNIT_HASH_RAWSZ];
+        uint32_t fanout_step_pos;
+    };
+    uint32_t step_pos;
+    uint16_t padding;
+    uint16_t si_flags;
+    char name[];
+};
+
+struct session_dependency_v1 {
+    uint32_t input_pos;
+    uint32_t step_pos;
+    uint16_t padding;
+    uint16_t sd_flags;
+    char output[];
+};
+
+#define V1_FLAGMASK 0xf000
+#define V1_NAMEMASK 0x0fff
+
+// Parse the name after a version 1 record at *p and advance *p past it.
+static const char* parse_v1_name(char** p, const char* end,
+                                 size_t record_size, uint16_t flags) {
+    size_t name_len = ntohs(flags) & V1_NAMEMASK;
+    const char* name = *p + record_size;
+    if ((size_t)(end - *p) < record_size + name_len + 1 || name[name_len] != '\0')
+        return NULL;
+    *p += record_size + name_len + 1;
+    return name;
+}
+
+static int load_session_v1() {
+    if (session_bb.size < sizeof(struct session_header_v1))
+        return error("truncated session header");
+    struct session_header_v1* hdr = session_bb.data;
 
     char* end = (char*)session_bb.data + session_bb.size;
-    char* p = (char*)hdr + sizeof(*hdr);
-    for (size_t i = 0; i < num_active_steps; i++) {
-        struct session_step* ss = (struct session_step*)p;
-        active_steps[i] = ss;
-        p += ss_size(ss);
-        if (p > end)
+    char* p = (char*)(hdr + 1);
+    for (size_t i = 0; i < ntohl(hdr->num_steps); i++) {
+        struct session_step_v1* old = (struct session_step_v1*)p;
+        const char* name = parse_v1_name(&p, end, sizeof(*old), old->ss_flags);
+        if (!name)
             return error("session EOF in steps");
-        if (ss->name[ss_name_len(ss)] != '\0')
-            return error("step name not NUL-terminated");
-    }
-    for (size_t i = 0; i < num_active_inputs; i++) {
-        struct session_input* si = (struct session_input*)p;
-        active_inputs[i] = si;
-        p += si_size(si);
-        if (p > end)
+        size_t pos = create_session_step(name);
+        struct session_step* ss = &active_steps[pos];
+        memcpy(ss->job_hash, old->job_hash, KNIT_HASH_RAWSZ);
+        memcpy(ss->prd_hash, old->prd_hash, KNIT_HASH_RAWSZ);
+        ss->num_unresolved = htonl(ntohs(old->num_unresolved));
+        ss->ss_flags = htonl(ntohs(old->ss_flags) & V1_FLAGMASK);
+    }
+    num_active_fanout = ntohl(hdr->num_fanout);
+    for (size_t i = 0; i < ntohl(hdr->num_inputs); i++) {
+        struct session_input_v1* old = (struct session_input_v1*)p;
+        const char* name = parse_v1_name(&p, end, sizeof(*old), old->si_flags);
+        if (!name)
             return error("session EOF in inputs");
-        if (si->name[si_name_len(si)] != '\0')
-            return error("input name not NUL-terminated");
-    }
-    for (size_t i = 0; i < num_active_deps; i++) {
-        struct session_dependency* sd = (struct session_dependency*)p;
-        active_deps[i] = sd;
-        p += sd_size(sd);
-        if (p > end)
+        ensure_alloc_inputs();
+        struct session_input* si = &active_inputs[num_active_inputs++];
+        memcpy(si->res_hash, old->res_hash, KNIT_HASH_RAWSZ);
+        si->step_pos = old->step_pos;
+        si->si_flags = htonl(ntohs(old->si_flags) & V1_FLAGMASK);
+        si->name = add_session_string(name);
+    }
+    for (size_t i = 0; i < ntohl(hdr->num_deps); i++) {
+        struct session_dependency_v1* old = (struct session_dependency_v1*)p;
+        const char* output = parse_v1_name(&p, end, sizeof(*old), old->sd_flags);
+        if (!output)
             return error("session EOF in dependencies");
-        if (sd->output[sd_output_len(sd)] != '\0')
-            return error("dependency output not NUL-terminated");
+        ensure_alloc_deps();
+        struct session_dependency* sd = &active_deps[num_active_deps++];
+        sd->input_pos = old->input_pos;
+        sd->step_pos = old->step_pos;
+        sd->sd_flags = htonl(ntohs(old->sd_flags) & V1_FLAGMASK);
+        sd->output = add_session_string(output);
     }
     if (p != end)
         return error("trailing session data");
+    return 0;
+}
+
+static int load_current_session() {
+    if (mmap_or_slurp_file(session_filepath, &session_bb) < 0)
+        return -1;
+
+    struct session_header* hdr = session_bb.data;
+    if (session_bb.size < sizeof(*hdr) ||
+            ntohl(hdr->signature) != SESSION_SIGNATURE) {
+        if (load_session_v1() < 0)
+            return -1;
+    } else {
+        if (ntohl(hdr->version) != SESSION_VERSION)
+            return error("unsupported session version %u", ntohl(hdr->version));
+
+        // Records are used in place, so only sizes need to be checked.
+        num_active_steps = ntohl(hdr->num_steps);
+        num_active_inputs = ntohl(hdr->num_inputs);
+        num_active_deps = ntohl(hdr->num_deps);
+        num_active_fanout = ntohl(hdr->num_fanout);
+        strings_size = ntohl(hdr->strings_size);
+        uint64_t size = sizeof(*hdr) +
+            (uint64_t)num_active_steps * sizeof(struct session_step) +
+            (uint64_t)num_active_inputs * sizeof(struct session_input) +
+            (uint64_t)num_active_deps * sizeof(struct session_dependency) +
+            strings_size;
+        if (session_bb.size != size)
+            return error("session size mismatch");
+
+        active_steps = (struct session_step*)(hdr + 1);
+        active_inputs = (struct session_input*)(active_steps + num_active_steps);
+        active_deps = (struct session_dependency*)(active_inputs + num_active_inputs);
+        session_strings = (char*)(active_deps + num_active_deps);
+        if (strings_size && session_strings[strings_size - 1] != '\0')
+            return error("session string table not NUL-terminated");
+    }
 
     deps_dirty = 0;
+    base_size = session_bb.size;
+    if (replay_journal() < 0)
+        return -1;
+
+    for (size_t i = 0; i < num_active_steps; i++) {
+        struct session_step* ss = &active_steps[i];
+        if (ss_hasflag(ss, SS_JOB) && !ss_hasflag(ss, SS_FINAL))
+            push_ready_step(i);
+    }
     return 0;
 }
 
 int load_session(const char* sessname) {
-    if (set_session_name_and_lock(sessname) < 0)
+    if (set_session_name_and_lock(sessname) < 0 || load_current_session() < 0)
         return -1;
-    return load_current_session();
+
+    // Drop any torn record so that new records are appended after whole ones.
+    struct stat st;
+    if (stat(journal_filepath, &st) == 0 && (size_t)st.st_size != journal_size &&
+            truncate(journal_filepath, journal_size) < 0)
+        return error_errno("cannot truncate %s", journal_filepath);
+    is_journaled = 1;
+    journaled_fanout = num_active_fanout;
+    return 0;
 }
 
 int load_session_nolock(const char* sessname) {
@@ -290,29 +556,41 @@ void close_session() {
     num_active_deps = alloc_active_deps = 0;
 
     deps_dirty = 0;
+    num_dep_offsets = 0;
+    ready_head = ready_tail = 0;
+
+    session_strings = NULL;
+    strings_size = alloc_strings = 0;
+
+    if (journal_fd >= 0)
+        close(journal_fd);
+    journal_fd = -1;
+    is_journaled = 0;
+    journal_size = base_size = journaled_fanout = 0;
+    num_dirty_steps = num_dirty_inputs = 0;
 
     free_bump_list(&session_bump);
     cleanup_bytebuf(&session_bb);
 
     unlock_session();
 
-    session_filepath[0] = session_lockfile[0] = '\0';
+    session_filepath[0] = session_lockfile[0] = journal_filepath[0] = '\0';
     session_name = NULL;
 }
 
 static int cmp_dep(const void* a, const void* b) {
-    const struct session_dependency* pa = *(const struct session_dependency**)a;
-    const struct session_dependency* pb = *(const struct session_dependency**)b;
+    const struct session_dependency* pa = a;
+    const struct session_dependency* pb = b;
     size_t a_step = ntohl(pa->step_pos);
     size_t b_step = ntohl(pb->step_pos);
     if (a_step != b_step)
         return a_step < b_step ? -1 : 1;
-    int rc = strcmp(pa->output, pb->output);
+    int rc = strcmp(sd_output(pa), sd_output(pb));
     if (rc != 0)
         return rc;
     // Ordering by flags and input is not essential but determinism is nice.
-    size_t a_flags = ntohs(pa->sd_flags);
-    size_t b_flags = ntohs(pb->sd_flags);
+    size_t a_flags = ntohl(pa->sd_flags);
+    size_t b_flags = ntohl(pb->sd_flags);
     if (a_flags != b_flags)
         return a_flags < b_flags ? -1 : 1;
     size_t a_input = ntohl(pa->input_pos);
@@ -322,12 +600,18 @@ static int cmp_dep(const void* a, const void* b) {
     return 0;
 }
 
-int save_session() {
+static void sort_deps() {
+    if (deps_dirty)
+        qsort(active_deps, num_active_deps, sizeof(*active_deps), cmp_dep);
+    deps_dirty = 0;
+}
+
+int checkpoint_session() {
     assert(session_name);
     assert(*session_lockfile);
+    report_bump_stats("session", session_bump);
 
-    if (deps_dirty)
-        qsort(active_deps, num_active_deps, sizeof(*active_deps), cmp_dep);
+    sort_deps();
 
     char tempfile[PATH_MAX];
     if (snprintf(tempfile, PATH_MAX, "%s.tmp", session_filepath) >= PATH_MAX)
@@ -338,41 +622,58 @@ int save_session() {
         return error_errno("open error %s", tempfile);
 
     struct session_header hdr = {
+        .signature = htonl(SESSION_SIGNATURE),
+        .version = htonl(SESSION_VERSION),
         .num_steps = htonl(num_active_steps),
         .num_inputs = htonl(num_active_inputs),
         .num_deps = htonl(num_active_deps),
         .num_fanout = htonl(num_active_fanout),
+        .strings_size = htonl(strings_size),
     };
-
-    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+    size_t steps_size = num_active_steps * sizeof(*active_steps);
+    size_t inputs_size = num_active_inputs * sizeof(*active_inputs);
+    size_t deps_size = num_active_deps * sizeof(*active_deps);
+    if (write_fully(fd, &hdr, sizeof(hdr)) < 0 ||
+            write_fully(fd, active_steps, steps_size) < 0 ||
+            write_fully(fd, active_inputs, inputs_size) < 0 ||
+            write_fully(fd, active_deps, deps_size) < 0 ||
+            write_fully(fd, session_strings, strings_size) < 0)
         goto write_fail;
 
-    for (size_t i = 0; i < num_active_steps; i++) {
-        struct session_step* ss = active_steps[i];
-        if (write(fd, ss, ss_size(ss)) != (ssize_t)ss_size(ss))
-            goto write_fail;
-    }
-    for (size_t i = 0; i < num_active_inputs; i++) {
-        struct session_input* si = active_inputs[i];
-        if (write(fd, si, si_size(si)) != (ssize_t)si_size(si))
-            goto write_fail;
-    }
-    for (size_t i = 0; i < num_active_deps; i++) {
-        struct session_dependency* sd = active_deps[i];
-        if (write(fd, sd, sd_size(sd)) != (ssize_t)sd_size(sd))
-            goto write_fail;
-    }
-
+    if (fsync(fd) < 0)
+        goto write_fail;
     if (close(fd) < 0) {
         error_errno("close error %s", tempfile);
         goto fail_and_unlink;
     }
 
+    // The journal only applies to the old session: replayed over the new one,
+    // its stale records would revert changes made since. Remove it durably
+    // before the rename. Should we crash in between, the old session without
+    // its journal is still a consistent earlier state.
+    if (journal_fd >= 0)
+        close(journal_fd);
+    journal_fd = -1;
+    if (unlink(journal_filepath) < 0 && errno != ENOENT) {
+        error_errno("cannot remove %s", journal_filepath);
+        goto fail_and_unlink;
+    }
+    char session_dir[PATH_MAX];
+    strcpy(session_dir, session_filepath);
+    if (fsync_dir(dirname(session_dir)) < 0) {
+        error_errno("cannot sync %s", session_dir);
+        goto fail_and_unlink;
+    }
+    journal_size = 0;
+
     if (rename(tempfile, session_filepath) < 0) {
         error_errno("rename error to %s", session_filepath);
         goto fail_and_unlink;
     }
 
+    base_size = sizeof(hdr) + steps_size + inputs_size + deps_size + strings_size;
+    journaled_fanout = num_active_fanout;
+    num_dirty_steps = num_dirty_inputs = 0;
     return 0;
 
 write_fail:
@@ -384,10 +685,113 @@ fail_and_unlink:
     return -1;
 }
 
+static void append_journal_record(struct bytebuf* buf, size_t* alloc,
+                                  uint32_t type, size_t pos,
+                                  const void* payload, size_t size,
+                                  const char* name) {
+    size_t name_size = name ? strlen(name) + 1 : 0;
+    struct journal_record jr = {
+        .type = htonl(type),
+        .pos = htonl(pos),
+        .size = htonl(size + name_size),
+    };
+    size_t record_size = sizeof(jr) + size + name_size;
+    if (buf->size + record_size > *alloc) {
+        *alloc = (buf->size + record_size) * 2;
+        buf->data = xrealloc(buf->data, *alloc);
+    }
+    char* p = (char*)buf->data + buf->size;
+    memcpy(p, &jr, sizeof(jr));
+    if (size)
+        memcpy(p + sizeof(jr), payload, size);
+    if (name_size)
+        memcpy(p + sizeof(jr) + size, name, name_size);
+    buf->size += record_size;
+}
+
+int save_session() {
+    if (!is_journaled)
+        return checkpoint_session();
+    assert(!deps_dirty);
+
+    struct bytebuf buf = { .should_free = 1 };
+    size_t alloc = 0;
+    if (num_active_fanout != journaled_fanout)
+        append_journal_record(&buf, &alloc, JR_FANOUT, num_active_fanout,
+                              NULL, 0, NULL);
+    for (size_t i = 0; i < num_dirty_steps; i++) {
+        size_t pos = dirty_steps[i];
+        append_journal_record(&buf, &alloc, JR_STEP, pos,
+                              &active_steps[pos], sizeof(*active_steps), NULL);
+    }
+    for (size_t i = 0; i < num_dirty_inputs; i++) {
+        const struct session_input* si = &active_inputs[dirty_inputs[i]];
+        append_journal_record(&buf, &alloc, JR_INPUT, dirty_inputs[i],
+                              si, sizeof(*si), si_name(si));
+    }
+
+    // Rewrite the session once the journal outgrows it, so replay stays
+    // cheap and total I/O stays linear in the number of changes.
+    if (journal_size + buf.size > base_size) {
+        cleanup_bytebuf(&buf);
+        return checkpoint_session();
+    }
+
+    int rc = 0;
+    if (buf.size > 0) {
+        if (journal_fd < 0)
+            journal_fd = open(journal_filepath,
+                              O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+        if (journal_fd < 0) {
+            rc = error_errno("cannot open %s", journal_filepath);
+        } else if (write_fully(journal_fd, buf.data, buf.size) < 0) {
+            rc = error_errno("write error %s", journal_filepath);
+        } else {
+            journal_size += buf.size;
+            journaled_fanout = num_active_fanout;
+            num_dirty_steps = num_dirty_inputs = 0;
+        }
+    }
+    cleanup_bytebuf(&buf);
+    return rc;
+}
+
+static void index_deps() {
+    sort_deps();
+    if (num_active_steps + 1 > alloc_dep_offsets) {
+        alloc_dep_offsets = num_active_steps + 1;
+        dep_offsets = xrealloc(dep_offsets,
+                               alloc_dep_offsets * sizeof(*dep_offsets));
+    }
+    size_t dep_pos = 0;
+    for (size_t i = 0; i < num_active_steps; i++) {
+        dep_offsets[i] = dep_pos;
+        while (dep_pos < num_active_deps &&
+               ntohl(active_deps[dep_pos].step_pos) == i)
+            dep_pos++;
+    }
+    if (dep_pos != num_active_deps)
+        die("dependency on step out of bounds");
+    dep_offsets[num_active_steps] = dep_pos;
+    num_dep_offsets = num_active_steps + 1;
+}
+
+void step_dependencies(size_t step_pos, size_t* start, size_t* end) {
+    // Fanout steps have no dependencies.
+    if (step_pos >= num_active_steps) {
+        *start = *end = 0;
+        return;
+    }
+    if (!num_dep_offsets)
+        index_deps();
+    *start = dep_offsets[step_pos];
+    *end = dep_offsets[step_pos + 1];
+}
+
 size_t first_step_input(size_t step_pos, size_t start, size_t end) {
     while (start < end) {
         size_t mid = (start + end) / 2;
-        if (step_pos <= ntohl(active_inputs[mid]->step_pos)) {
+        if (step_pos <= ntohl(active_inputs[mid].step_pos)) {
             end = mid;
         } else {
             start = mid + 1;
@@ -396,73 +800,67 @@ size_t first_step_input(size_t step_pos, size_t start, size_t end) {
     return start;
 }
 
-static struct resource_list* step_inputs_to_resource_list(struct bump_list** bump_p,
-                                                          size_t step_pos,
-                                                          const char* prefix) {
-    struct resource_list* head = NULL;
-    struct resource_list** list_p = &head;
-
+static void append_step_inputs(struct bump_list** bump_p,
+                               struct resource_list* list,
+                               size_t step_pos, const char* prefix) {
     for (size_t i = first_step_input(step_pos, 0, num_active_inputs);
          i < num_active_inputs; i++) {
-        struct session_input* si = active_inputs[i];
+        struct session_input* si = &active_inputs[i];
         if (ntohl(si->step_pos) != step_pos)
             break;
 
         assert(si_hasflag(si, SI_FINAL));
         if (si_hasflag(si, SI_FANOUT)) {
             assert(!prefix); // recursive SI_FANOUT is not supported
-            *list_p = step_inputs_to_resource_list(bump_p, ntohl(si->fanout_step_pos),
-                                                   si->name);
-            assert(*list_p);
-            while (*list_p)
-                list_p = &(*list_p)->next;
+            [[maybe_unused]] size_t num_entries = list->num_entries;
+            append_step_inputs(bump_p, list, ntohl(si->fanout_step_pos), si_name(si));
+            assert(list->num_entries > num_entries);
             continue;
         }
         if (!si_hasflag(si, SI_RESOURCE))
             continue;
 
-        struct resource_list* list = bump_alloc(bump_p, sizeof(*list));
+        char* name = (char*)si_name(si);
         if (prefix) {
-            char name[PATH_MAX];
-            int len = snprintf(name, PATH_MAX, "%s%s", prefix, si->name);
+            char buf[PATH_MAX];
+            int len = snprintf(buf, PATH_MAX, "%s%s", prefix, si_name(si));
             if (len >= PATH_MAX)
                 die("input name too long");
-            list->name = bump_alloc(bump_p, len + 1);
-            memcpy(list->name, name, len + 1);
-        } else {
-            list->name = si->name;
+            name = bump_alloc(bump_p, len + 1);
+            memcpy(name, buf, len + 1);
         }
 
-        list->res = get_resource(oid_of_hash(si->res_hash));
-        list->next = NULL;
-        *list_p = list;
-        list_p = &list->next;
+        resource_list_append(list, name, get_resource(oid_of_hash(si->res_hash)));
     }
-
-    return head;
 }
 
 int compile_job_for_step(size_t step_pos) {
-    struct session_step* ss = active_steps[step_pos];
+    struct session_step* ss = &active_steps[step_pos];
     if (ss_hasflag(ss, SS_JOB))
         return error("step already has job");
     if (ss_hasflag(ss, SS_FINAL))
         return error("step has unmet requirements");
     if (ss->num_unresolved)
-        return error("step blocked on %u dependencies", ntohs(ss->num_unresolved));
-
-    struct bump_list* bump = NULL;
-    struct resource_list* inputs = step_inputs_to_resource_list(&bump, step_pos, NULL);
-    if (!inputs)
+        return error("step blocked on %u dependencies", ntohl(ss->num_unresolved));
+
+    // Session inputs are sorted by name (and fanout inputs by their suffix),
+    // so the list is built in order. Prefixed names are scratch allocations.
+    struct bump_mark mark = bump_mark(&session_bump);
+    struct resource_list inputs = {0};
+    append_step_inputs(&session_bump, &inputs, step_pos, NULL);
+    if (!inputs.num_entries)
         warning("empty job at step_pos %zu", step_pos);
 
-    struct job* job = store_job(inputs);
-    free_bump_list(&bump);
+    struct job* job = store_job(&inputs);
+    resource_list_clear(&inputs);
+    bump_rewind(&session_bump, mark);
     if (!job)
         return -1;
 
     memcpy(ss->job_hash, job->object.oid.hash, KNIT_HASH_RAWSZ);
     ss_setflag(ss, SS_JOB);
+    mark_step_dirty(step_pos);
+    push_ready_step(step_pos);
     return 0;
 }
 
@@ -471,48 +869,48 @@ static void set_input_resource(struct session_input* si, struct resource* res) {
     si_setflag(si, SI_RESOURCE | SI_FINAL);
 }
 
-// Create a session_input for each output with a matching prefix; outputs should
-// be positioned at the first match. The prefix will be removed from the input.
+// Create a session_input for each output with a matching prefix; out should be
+// the first match. The prefix will be removed from the input.
 static void create_fanout_inputs(size_t fanout_step_pos,
-                                 const struct resource_list* outputs,
+                                 const struct resource_entry* out,
+                                 const struct resource_entry* end,
                                  const char* prefix) {
     do {
         // When depending on an entire production, skip special .knit/ outputs.
-        if (!*prefix && !strncmp(outputs->name, ".knit/", 6)) {
-            outputs = outputs->next;
+        if (!*prefix && !strncmp(out->name, ".knit/", 6)) {
+            out++;
             continue;
         }
 
-        char* name = outputs->name + strlen(prefix);
+        const char* name = out->name + strlen(prefix);
         size_t input_pos = create_session_input(fanout_step_pos, name);
-        struct session_input* si = active_inputs[input_pos];
-        set_input_resource(si, outputs->res);
-        outputs = outputs->next;
-    } while (outputs && !strncmp(outputs->name, prefix, strlen(prefix)));
+        struct session_input* si = &active_inputs[input_pos];
+        set_input_resource(si, out->res);
+        out++;
+    } while (out < end && !strncmp(out->name, prefix, strlen(prefix)));
 }
 
 void resolve_dependencies(size_t step_pos, const struct resource_list* outputs) {
-    size_t dep_pos = 0;
-    while (dep_pos < num_active_deps && ntohl(active_deps[dep_pos]->step_pos) < step_pos)
-        dep_pos++;
+    size_t dep_pos, dep_end;
+    step_dependencies(step_pos, &dep_pos, &dep_end);
 
-    while (dep_pos < num_active_deps) {
-        struct session_dependency* dep = active_deps[dep_pos];
-        if (dep->step_pos != htonl(step_pos))
-            break;
+    const struct resource_entry* out = outputs ? outputs->entries : NULL;
+    const struct resource_entry* end = outputs ? out + outputs->num_entries : NULL;
+    while (dep_pos < dep_end) {
+        struct session_dependency* dep = &active_deps[dep_pos];
 
         // Iterate production outputs in parallel with the dependencies waiting
         // on this step. Compare their paths to find matching dependencies.
         int cmp = 1;
-        if (outputs) {
+        if (out < end) {
             cmp = sd_hasflag(dep, SD_PREFIX)
-                ? strncmp(outputs->name, dep->output, strlen(dep->output))
-                : strcmp(outputs->name, dep->output);
+                ? strncmp(out->name, sd_output(dep), strlen(sd_output(dep)))
+                : strcmp(out->name, sd_output(dep));
         }
 
         // If a production output has no dependencies on it, we can skip it.
         if (cmp < 0) {
-            outputs = outputs->next;
+            out++;
             continue;
         }
 
@@ -527,14 +925,16 @@ void resolve_dependencies(size_t step_pos, const struct resource_list* outputs)
             size_t input_pos = ntohl(dep->input_pos);
             if (input_pos >= num_active_inputs)
                 die("input out of bounds");
-            input = active_inputs[input_pos];
+            input = &active_inputs[input_pos];
             dependent_pos = ntohl(input->step_pos);
+            mark_input_dirty(input_pos);
         }
         if (dependent_pos >= num_active_steps)
             die("dependent out of bounds");
         if (dependent_pos <= step_pos)
             die("step later than its dependent");
-        struct session_step* dependent = active_steps[dependent_pos];
+        struct session_step* dependent = &active_steps[dependent_pos];
+        mark_step_dirty(dependent_pos);
 
         // Otherwise, we have a dependency to resolve. If we have no matching
         // production output, then the dependency is missing.
@@ -563,18 +963,21 @@ void resolve_dependencies(size_t step_pos, const struct resource_list* outputs)
         // all matching production outputs.
         if (sd_hasflag(dep, SD_PREFIX)) {
             assert(input);
+            size_t input_pos = input - active_inputs;
             size_t fanout_step_pos = add_session_fanout_step();
-            create_fanout_inputs(fanout_step_pos, outputs, dep->output);
+            create_fanout_inputs(fanout_step_pos, out, end, sd_output(dep));
+            // Creating inputs may have moved them.
+            input = &active_inputs[input_pos];
             si_setflag(input, SI_FANOUT | SI_FINAL);
             input->fanout_step_pos = htonl(fanout_step_pos);
         } else if (input) {
             // Set a single matching resource for the input.
-            set_input_resource(input, outputs->res);
+            set_input_resource(input, out->res);
         }
 
 mark_resolved:
         if (!dependent->num_unresolved)
-            die("num_unresolved underflow on step %s", dependent->name);
+            die("num_unresolved underflow on step %s", ss_name(dependent));
         ss_dec_unresolved(dependent);
         if (!dependent->num_unresolved)
             if (compile_job_for_step(dependent_pos) < 0)
@@ -584,3 +987,26 @@ mark_resolved:
         // leave it for the next iteration.
     }
 }
+
+int write_session_frames(int fd, const struct session_frame_record* records,
+                         size_t num_records) {
+    size_t num_frames =
+        (num_records + SESSION_FRAME_MAX_RECORDS - 1) / SESSION_FRAME_MAX_RECORDS;
+    size_t size = num_frames * sizeof(uint32_t) + num_records * sizeof(*records);
+    uint8_t* buf = xmalloc(size);
+    uint8_t* p = buf;
+    while (num_records > 0) {
+        size_t n = num_records < SESSION_FRAME_MAX_RECORDS
+            ? num_records : SESSION_FRAME_MAX_RECORDS;
+        uint32_t num_be = htonl(n);
+        memcpy(p, &num_be, sizeof(num_be));
+        p += sizeof(num_be);
+        memcpy(p, records, n * sizeof(*records));
+        p += n * sizeof(*records);
+        records += n;
+        num_records -= n;
+    }
+    int rc = write_fully(fd, buf, size);
+    free(buf);
+    return rc;
+}
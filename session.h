@@ -3,30 +3,53 @@
 #include "hash.h"
 #include "resource.h"
 
+// A session file is laid out as
+//
+//   session_header
+//   struct session_step       steps[num_steps]
+//   struct session_input      inputs[num_inputs]
+//   struct session_dependency deps[num_deps]
+//   char                      strings[strings_size]
+//
+// Records have a fixed stride, so a session is used in place once mapped.
+// Names are offsets of NUL-terminated strings in the string table. All
+// integers are big endian. Version 1 sessions (with names inline in
+// variable-length records) are converted when loaded.
+
+#define SESSION_SIGNATURE 0x4b534553 // "KSES"
+#define SESSION_VERSION 2
+
+struct session_header {
+    uint32_t signature;
+    uint32_t version;
+    uint32_t num_steps;
+    uint32_t num_inputs;
+    uint32_t num_deps;
+    uint32_t num_fanout;
+    uint32_t strings_size;
+};
+
 struct session_step {
     uint8_t job_hash[KNIT_HASH_RAWSZ];
     uint8_t prd_hash[KNIT_HASH_RAWSZ];
-    uint16_t num_unresolved;
-    uint16_t ss_flags;
-    char name[];
+    uint32_t num_unresolved;
+    uint32_t ss_flags;
+    uint32_t name;
 };
 
 size_t create_session_step(const char* name);
 
 #define SS_FINAL    0x8000
 #define SS_JOB      0x4000
-#define SS_NAMEMASK 0x0fff
 
-#define ss_init_flags(ss, name_len, flags) ((void)((ss)->ss_flags = htons(((name_len) & SS_NAMEMASK) | (flags))))
-#define ss_setflag(ss, flag) ((void)((ss)->ss_flags |= htons(flag)))
-#define ss_hasflag(ss, flag) (ntohs((ss)->ss_flags) & (flag))
-#define ss_name_len(ss) (ntohs((ss)->ss_flags) & SS_NAMEMASK)
-#define ss_size(ss) (sizeof(struct session_step) + ss_name_len(ss) + 1)
+#define ss_setflag(ss, flag) ((void)((ss)->ss_flags |= htonl(flag)))
+#define ss_hasflag(ss, flag) (ntohl((ss)->ss_flags) & (flag))
+#define ss_name(ss) session_string((ss)->name)
 static inline void ss_inc_unresolved(struct session_step* ss) {
-    ss->num_unresolved = htons(ntohs(ss->num_unresolved) + 1);
+    ss->num_unresolved = htonl(ntohl(ss->num_unresolved) + 1);
 }
 static inline void ss_dec_unresolved(struct session_step* ss) {
-    ss->num_unresolved = htons(ntohs(ss->num_unresolved) - 1);
+    ss->num_unresolved = htonl(ntohl(ss->num_unresolved) - 1);
 }
 
 struct session_input {
@@ -35,62 +58,66 @@ struct session_input {
         uint32_t fanout_step_pos;
     };
     uint32_t step_pos;
-    // TODO remove padding?
-    uint16_t padding;
-    uint16_t si_flags;
-    char name[];
+    uint32_t si_flags;
+    uint32_t name;
 };
 
 // SI_FINAL is technically redundant since it is implied by !ss->num_unresolved.
 #define SI_FINAL    0x8000
 #define SI_RESOURCE 0x4000
 #define SI_FANOUT   0x2000
-#define SI_PATHMASK 0x0fff
 
-#define si_init_flags(si, name_len, flags) ((void)((si)->si_flags = htons(((name_len) & SI_PATHMASK) | (flags))))
-#define si_setflag(si, flag) ((void)((si)->si_flags |= htons(flag)))
-#define si_hasflag(si, flag) (ntohs((si)->si_flags) & (flag))
-#define si_name_len(si) (ntohs((si)->si_flags) & SI_PATHMASK)
-#define si_size(si) (sizeof(struct session_input) + si_name_len(si) + 1)
+#define si_setflag(si, flag) ((void)((si)->si_flags |= htonl(flag)))
+#define si_hasflag(si, flag) (ntohl((si)->si_flags) & (flag))
+#define si_name(si) session_string((si)->name)
 
 size_t create_session_input(size_t step_pos, const char* name);
 
 struct session_dependency {
     uint32_t input_pos;
     uint32_t step_pos;
-    // TODO remove padding?
-    uint16_t padding;
-    uint16_t sd_flags;
-    char output[];
+    uint32_t sd_flags;
+    uint32_t output;
 };
 
 #define SD_REQUIRED    0x8000
 #define SD_PREFIX      0x4000
 #define SD_INPUTISSTEP 0x2000
-#define SD_OUTPUTMASK  0x0fff
 
-#define sd_init_flags(sd, output_len, flags) ((void)((sd)->sd_flags = htons(((output_len) & SD_OUTPUTMASK) | (flags))))
-#define sd_setflag(sd, flag) ((void)((sd)->sd_flags |= htons(flag)))
-#define sd_hasflag(sd, flag) (ntohs((sd)->sd_flags) & (flag))
-#define sd_output_len(sd) (ntohs((sd)->sd_flags) & SD_OUTPUTMASK)
-#define sd_size(sd) (sizeof(struct session_dependency) + sd_output_len(sd) + 1)
+#define sd_setflag(sd, flag) ((void)((sd)->sd_flags |= htonl(flag)))
+#define sd_hasflag(sd, flag) (ntohl((sd)->sd_flags) & (flag))
+#define sd_output(sd) session_string((sd)->output)
 
 size_t create_session_dependency(size_t input_pos,
                                  size_t step_pos, const char* output,
-                                 uint16_t flags);
+                                 uint32_t flags);
+
+// Dependencies on the outputs of step_pos are active_deps[*start] up to
+// active_deps[*end].
+void step_dependencies(size_t step_pos, size_t* start, size_t* end);
+
+// Returns the string at the (big endian) offset in the string table.
+const char* session_string(uint32_t offset);
 
-extern struct session_step** active_steps;
+extern struct session_step* active_steps;
 extern size_t num_active_steps;
 extern size_t num_active_fanout;
-extern struct session_input** active_inputs;
+extern struct session_input* active_inputs;
 extern size_t num_active_inputs;
-extern struct session_dependency** active_deps;
+extern struct session_dependency* active_deps;
 extern size_t num_active_deps;
 
 int new_session(const char* sessname);
 int load_session(const char* sessname);
 void close_session();
+// A session loaded by load_session() saves by appending its changes to a
+// journal; otherwise, and once the journal grows past the session, this
+// checkpoints the session.
 int save_session();
+// Rewrite the session file with all changes and remove the journal.
+int checkpoint_session();
+// Steps changed outside of session.c must be marked for save_session().
+void mark_step_dirty(size_t step_pos);
 // Cannot be used to save_session() later.
 int load_session_nolock(const char* sessname);
 
@@ -99,6 +126,33 @@ int load_session_nolock(const char* sessname);
 // resolving dependencies for a completed step.
 int compile_job_for_step(size_t step_pos);
 
+// Returns the next step to become available to run, or -1 if there is none.
+// Steps are available once compile_job_for_step() succeeds, or when a session
+// is loaded with their jobs compiled but unfinished.
+ssize_t next_ready_step();
+
+// knit-resume-session sends the jobs it wants run to knit-schedule-jobs, which
+// replies with their productions. Each direction is a stream of frames that
+// batch as many records as are available:
+//
+//   uint32_t                     num_records (big endian, nonzero)
+//   struct session_frame_record  records[num_records]
+//
+// Each request carries the job's priority: the estimated nanoseconds from
+// starting it until every step depending on it is done, so that jobs on the
+// critical path run first. Each reply carries how many nanoseconds the job ran,
+// or 0 if it did not run (as for cache hits).
+struct session_frame_record {
+    uint8_t hash[KNIT_HASH_RAWSZ];
+    uint8_t value[8];  // big endian
+};
+
+#define SESSION_FRAME_MAX_RECORDS 4096
+
+// Write records as frames in a single write where possible.
+int write_session_frames(int fd, const struct session_frame_record* records,
+                         size_t num_records);
+
 // Match production outputs to dependencies and finalize corresponding inputs
 // and dependent steps. This effectively copies output resources to inputs. When
 // all of a step's dependencies are fulfilled, we compile its job; if a required
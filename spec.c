@@ -9,13 +9,20 @@
 #include "util.h"
 
 static struct object* get_object(const struct object_id* oid, uint32_t typesig) {
-    size_t size;
-    void* buf = NULL;
+    struct bytebuf bb = {0};
 
     if (typesig == OBJ_UNKNOWN) {
-        buf = read_object(oid, &typesig, &size);
-        if (!buf)
+        if (stat_object(oid, &typesig, NULL) < 0)
             return NULL;
+        // We will probably use a typed structured object, so incur the
+        // overhead of reading and parsing it now. Resources are not read.
+        if (typesig != OBJ_RESOURCE) {
+            if (read_object_view(oid, &typesig, &bb) < 0)
+                return NULL;
+            // Parsed jobs and productions borrow names from the buffer.
+            if (typesig == OBJ_JOB || typesig == OBJ_PRODUCTION)
+                retain_object_view(&bb);
+        }
     }
 
     struct object* ret = NULL;
@@ -25,24 +32,30 @@ static struct object* get_object(const struct object_id* oid, uint32_t typesig)
     } else if (typesig == OBJ_JOB) {
         struct job* job = get_job(oid);
         ret = &job->object;
-        // We will probably use the typed object, so incur the overhead of
-        // parsing it if buf has already been read.
-        if (buf && parse_job_bytes(job, buf, size) < 0)
-            warning("failed to parse job %s", oid_to_hex(oid));
+        if (bb.data && !job->object.is_parsed) {
+            if (parse_job_bytes(job, bb.data, bb.size) < 0)
+                warning("failed to parse job %s", oid_to_hex(oid));
+            else
+                memset(&bb, 0, sizeof(bb)); // now borrowed by job
+        }
     } else if (typesig == OBJ_PRODUCTION) {
         struct production* prd = get_production(oid);
         ret = &prd->object;
-        if (buf && parse_production_bytes(prd, buf, size) < 0)
-            warning("failed to parse production %s", oid_to_hex(oid));
+        if (bb.data && !prd->object.is_parsed) {
+            if (parse_production_bytes(prd, bb.data, bb.size) < 0)
+                warning("failed to parse production %s", oid_to_hex(oid));
+            else
+                memset(&bb, 0, sizeof(bb)); // now borrowed by prd
+        }
     } else if (typesig == OBJ_INVOCATION) {
         struct invocation* inv = get_invocation(oid);
         ret = &inv->object;
-        if (buf && parse_invocation_bytes(inv, buf, size) < 0)
+        if (bb.data && parse_invocation_bytes(inv, bb.data, bb.size) < 0)
             warning("failed to parse invocation %s", oid_to_hex(oid));
     } else {
         warning("unknown object type %s", strtypesig(typesig));
     }
-    free(buf);
+    cleanup_bytebuf(&bb);
     return ret;
 }
 
@@ -211,24 +224,23 @@ static struct object* peel_path(char* spec, size_t len) {
     if (delim + 1 == spec + len)
         return inner;
 
-    struct resource_list* resources;
+    const struct resource_list* resources;
     if (inner->typesig == OBJ_JOB) {
         struct job* job = (struct job*)inner;
         if (parse_job(job) < 0)
             return NULL;
-        resources = job->inputs;
+        resources = &job->inputs;
     } else {
         assert(inner->typesig == OBJ_PRODUCTION);
         struct production* prd = (struct production*)inner;
         if (parse_production(prd) < 0)
             return NULL;
-        resources = prd->outputs;
+        resources = &prd->outputs;
     }
 
-    for (; resources; resources = resources->next) {
-        if (!strcmp(resources->name, delim + 1))
-            return &resources->res->object;
-    }
+    struct resource_entry* entry = resource_list_find(resources, delim + 1);
+    if (entry)
+        return &entry->res->object;
     die("'%s' not found in %s %s",
         delim + 1, strtypesig(inner->typesig), oid_to_hex(&inner->oid));
 }
@@ -0,0 +1,200 @@
+#include "statcache.h"
+
+#include "table.h"
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#define st_ctim st_ctimespec
+#endif
+
+#define STATCACHE_SIGNATURE 0x4b535443 // "KSTC"
+#define STATCACHE_VERSION 2
+
+// Once the cache grows past this many entries, only entries used by the
+// current process are saved.
+#define STATCACHE_MAX_ENTRIES (1 << 20)
+
+struct statcache_header {
+    uint32_t signature;
+    uint32_t version;
+    uint32_t num_entries;
+};
+
+// On disk, all integers are big endian.
+struct statcache_record {
+    uint8_t dev[8];
+    uint8_t ino[8];
+    uint8_t size[8];
+    uint8_t mtime_sec[8];
+    uint8_t mtime_nsec[8];
+    uint8_t ctime_sec[8];
+    uint8_t ctime_nsec[8];
+    uint32_t mode;
+    uint32_t reserved;
+    uint8_t oid[KNIT_HASH_RAWSZ];
+};
+
+// Keyed by dev and ino.
+struct statcache_entry {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_sec;
+    uint64_t mtime_nsec;
+    uint64_t ctime_sec;
+    uint64_t ctime_nsec;
+    uint32_t mode;
+    unsigned is_used : 1;
+    struct object_id oid;
+};
+
+static struct table entries;
+static int is_loaded;
+static int is_dirty;
+
+static struct statcache_entry* insert_entry(uint64_t dev, uint64_t ino) {
+    uint64_t key[2] = { dev, ino };
+    return table_insert(&entries, key, NULL);
+}
+
+static char* statcache_path() {
+    static char filename[PATH_MAX];
+    if (snprintf(filename, PATH_MAX, "%s/statcache", get_knit_dir()) >= PATH_MAX)
+        die("path too long");
+    return filename;
+}
+
+static void load_statcache() {
+    is_loaded = 1;
+    init_table(&entries, sizeof(struct statcache_entry), 2 * sizeof(uint64_t));
+
+    struct bytebuf bb;
+    int fd = open(statcache_path(), O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            warning_errno("cannot open %s", statcache_path());
+        return;
+    }
+    if (mmap_fd(fd, &bb) < 0) {
+        warning_errno("cannot mmap %s", statcache_path());
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    // Start over from caches written by other versions.
+    const struct statcache_header* hdr = bb.data;
+    if (bb.size >= sizeof(*hdr) &&
+            ntohl(hdr->signature) == STATCACHE_SIGNATURE &&
+            ntohl(hdr->version) != STATCACHE_VERSION) {
+        cleanup_bytebuf(&bb);
+        return;
+    }
+    if (bb.size < sizeof(*hdr) ||
+            ntohl(hdr->signature) != STATCACHE_SIGNATURE ||
+            bb.size != sizeof(*hdr) +
+                ntohl(hdr->num_entries) * sizeof(struct statcache_record)) {
+        warning("ignoring invalid %s", statcache_path());
+        cleanup_bytebuf(&bb);
+        return;
+    }
+
+    const struct statcache_record* rec = (const void*)(hdr + 1);
+    for (size_t i = 0; i < ntohl(hdr->num_entries); i++, rec++) {
+        struct statcache_entry* entry =
+            insert_entry(get_be64(rec->dev), get_be64(rec->ino));
+        entry->size = get_be64(rec->size);
+        entry->mtime_sec = get_be64(rec->mtime_sec);
+        entry->mtime_nsec = get_be64(rec->mtime_nsec);
+        entry->ctime_sec = get_be64(rec->ctime_sec);
+        entry->ctime_nsec = get_be64(rec->ctime_nsec);
+        entry->mode = ntohl(rec->mode);
+        memcpy(entry->oid.hash, rec->oid, KNIT_HASH_RAWSZ);
+    }
+    cleanup_bytebuf(&bb);
+}
+
+const struct object_id* lookup_statcache(const struct stat* st) {
+    if (!is_loaded)
+        load_statcache();
+    uint64_t key[2] = { st->st_dev, st->st_ino };
+    struct statcache_entry* entry = table_find(&entries, key);
+    if (!entry ||
+            entry->size != (uint64_t)st->st_size ||
+            entry->mtime_sec != (uint64_t)st->st_mtim.tv_sec ||
+            entry->mtime_nsec != (uint64_t)st->st_mtim.tv_nsec ||
+            entry->ctime_sec != (uint64_t)st->st_ctim.tv_sec ||
+            entry->ctime_nsec != (uint64_t)st->st_ctim.tv_nsec ||
+            entry->mode != st->st_mode)
+        return NULL;
+    entry->is_used = 1;
+    return &entry->oid;
+}
+
+void add_statcache(const struct stat* st, const struct object_id* oid) {
+    if (!is_loaded)
+        load_statcache();
+    // The file may still be changing without its mtime advancing.
+    if (st->st_mtim.tv_sec + 2 > time(NULL))
+        return;
+    struct statcache_entry* entry = insert_entry(st->st_dev, st->st_ino);
+    entry->size = st->st_size;
+    entry->mtime_sec = st->st_mtim.tv_sec;
+    entry->mtime_nsec = st->st_mtim.tv_nsec;
+    entry->ctime_sec = st->st_ctim.tv_sec;
+    entry->ctime_nsec = st->st_ctim.tv_nsec;
+    entry->mode = st->st_mode;
+    entry->is_used = 1;
+    memcpy(entry->oid.hash, oid->hash, KNIT_HASH_RAWSZ);
+    is_dirty = 1;
+}
+
+static int write_statcache(FILE* fh) {
+    int only_used = entries.num_entries > STATCACHE_MAX_ENTRIES;
+    size_t num_written = 0;
+    for (size_t i = 0; i < entries.alloc_entries; i++) {
+        const struct statcache_entry* entry = table_slot(&entries, i);
+        if (entry && (!only_used || entry->is_used))
+            num_written++;
+    }
+
+    struct statcache_header hdr = {
+        .signature = htonl(STATCACHE_SIGNATURE),
+        .version = htonl(STATCACHE_VERSION),
+        .num_entries = htonl(num_written),
+    };
+    if (fwrite(&hdr, sizeof(hdr), 1, fh) != 1)
+        return -1;
+    for (size_t i = 0; i < entries.alloc_entries; i++) {
+        const struct statcache_entry* entry = table_slot(&entries, i);
+        if (!entry || (only_used && !entry->is_used))
+            continue;
+        struct statcache_record rec = {
+            .mode = htonl(entry->mode),
+        };
+        put_be64(rec.dev, entry->dev);
+        put_be64(rec.ino, entry->ino);
+        put_be64(rec.size, entry->size);
+        put_be64(rec.mtime_sec, entry->mtime_sec);
+        put_be64(rec.mtime_nsec, entry->mtime_nsec);
+        put_be64(rec.ctime_sec, entry->ctime_sec);
+        put_be64(rec.ctime_nsec, entry->ctime_nsec);
+        memcpy(rec.oid, entry->oid.hash, KNIT_HASH_RAWSZ);
+        if (fwrite(&rec, sizeof(rec), 1, fh) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+void save_statcache() {
+    if (!is_dirty)
+        return;
+
+    // Concurrent writers each replace the whole file, so the last one wins
+    // and entries added by the others are merely lost.
+    if (replace_file(statcache_path(), 0600, write_statcache, 0) < 0) {
+        warning_errno("cannot write %s", statcache_path());
+        return;
+    }
+    is_dirty = 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "hash.h"
+
+// A persistent cache in $KNIT_DIR/statcache from file identity to the object
+// id of its contents, so unchanged files need not be read and hashed again.
+//
+// Entries are keyed on (st_dev, st_ino) rather than path so a file reached by
+// different paths (relative or absolute, from a plan or a -P param, or linked
+// into a job directory) shares one entry. They are validated against st_size,
+// st_mtim, st_ctim and st_mode, as git does. Comparing ctime catches a reused
+// inode or a rewrite with the mtime restored (as by tar or cp -p), at the
+// cost of a miss after the file gains a link, as with hardlink materialize.
+// Files modified within the last couple of seconds are not cached, since a
+// further write within the timestamp granularity would go unnoticed.
+
+// Returns the cached object id for the file described by st, or NULL.
+const struct object_id* lookup_statcache(const struct stat* st);
+void add_statcache(const struct stat* st, const struct object_id* oid);
+
+// Write back the cache if anything was added. Failures are only warnings.
+void save_statcache();
@@ -0,0 +1,81 @@
+#include "table.h"
+
+static size_t hash_key(const struct table* table, const void* key) {
+    const uint8_t* p = key;
+    uint64_t h = 0;
+    size_t i = 0;
+    for (; i + 8 <= table->key_size; i += 8)
+        h = (h ^ get_be64(p + i)) * 0x9e3779b97f4a7c15ull;
+    for (; i < table->key_size; i++)
+        h = (h ^ p[i]) * 0x9e3779b97f4a7c15ull;
+    return h >> 32;
+}
+
+// Returns the slot holding key, or the empty slot where it belongs.
+static size_t find_slot(const struct table* table, const void* key) {
+    size_t mask = table->alloc_entries - 1;
+    for (size_t i = hash_key(table, key) & mask;; i = (i + 1) & mask) {
+        if (!table->is_occupied[i] ||
+                !memcmp(table->entries + i * table->entry_size, key, table->key_size))
+            return i;
+    }
+}
+
+static void alloc_slots(struct table* table, size_t alloc) {
+    table->alloc_entries = alloc;
+    table->entries = xmalloc(alloc * table->entry_size);
+    table->is_occupied = xmalloc(alloc);
+    memset(table->is_occupied, 0, alloc);
+}
+
+static void grow_table(struct table* table) {
+    char* old_entries = table->entries;
+    uint8_t* old_is_occupied = table->is_occupied;
+    size_t old_alloc = table->alloc_entries;
+    alloc_slots(table, old_alloc * 2);
+    for (size_t i = 0; i < old_alloc; i++) {
+        if (!old_is_occupied[i])
+            continue;
+        const char* entry = old_entries + i * table->entry_size;
+        size_t j = find_slot(table, entry);
+        memcpy(table->entries + j * table->entry_size, entry, table->entry_size);
+        table->is_occupied[j] = 1;
+    }
+    free(old_entries);
+    free(old_is_occupied);
+}
+
+void init_table(struct table* table, size_t entry_size, size_t key_size) {
+    assert(key_size <= entry_size);
+    table->entry_size = entry_size;
+    table->key_size = key_size;
+    table->num_entries = 0;
+    alloc_slots(table, 1024);
+}
+
+void clear_table(struct table* table) {
+    free(table->entries);
+    free(table->is_occupied);
+    init_table(table, table->entry_size, table->key_size);
+}
+
+void* table_find(const struct table* table, const void* key) {
+    return table_slot(table, find_slot(table, key));
+}
+
+void* table_insert(struct table* table, const void* key, int* is_new) {
+    // Keep the load factor under 3/4.
+    if (4 * (table->num_entries + 1) > 3 * table->alloc_entries)
+        grow_table(table);
+    size_t i = find_slot(table, key);
+    char* entry = table->entries + i * table->entry_size;
+    if (is_new)
+        *is_new = !table->is_occupied[i];
+    if (!table->is_occupied[i]) {
+        memset(entry, 0, table->entry_size);
+        memcpy(entry, key, table->key_size);
+        table->is_occupied[i] = 1;
+        table->num_entries++;
+    }
+    return entry;
+}
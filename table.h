@@ -0,0 +1,31 @@
+#pragma once
+
+#include "util.h"
+
+// A hash table of fixed-size entries, each starting with a key of key_size
+// bytes, with open addressing and linear probing. Entries are zeroed when
+// inserted and move when the table grows, so pointers to them are only valid
+// until the next insert.
+struct table {
+    size_t entry_size;
+    size_t key_size;
+    char* entries;
+    uint8_t* is_occupied;
+    size_t num_entries;
+    size_t alloc_entries;  // a power of 2
+};
+
+void init_table(struct table* table, size_t entry_size, size_t key_size);
+// Remove every entry.
+void clear_table(struct table* table);
+
+// Returns the entry with key, or NULL.
+void* table_find(const struct table* table, const void* key);
+// Returns the entry with key, inserting it if needed; *is_new (optional) is
+// set if it was.
+void* table_insert(struct table* table, const void* key, int* is_new);
+
+// Returns the entry in slot i (below alloc_entries), or NULL if it is empty.
+static inline void* table_slot(const struct table* table, size_t i) {
+    return table->is_occupied[i] ? table->entries + i * table->entry_size : NULL;
+}
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+. test-setup.sh
+
+cat <<'EOF' > plan.knit
+step a: cmd "bash" "-c" "echo a > out/a"
+
+step b: cmd "bash" "-c" "cat in/a > out/b"
+    a = a:a
+EOF
+
+prd=$(expect_ok knit-run-plan)
+expect_ok test -s .knit/cache/log
+read job hit <<< "$(knit-run-plan --no-filter 2>&1 | grep ^!!cache-hit | cut -f2,3)"
+expect_ok test $hit == $prd
+
+# Per-file entries from older versions are still read.
+rm -rf .knit/cache
+mkdir .knit/cache
+mkdir .knit/cache/${job:0:2}
+echo $prd > .knit/cache/${job:0:2}/${job:2}
+expect_ok test $(knit-run-plan --no-filter 2>&1 | grep -c ^!!cache-hit) -eq 1
+
+# Compaction folds them into the index.
+expect_ok knit-cache --compact
+expect_ok test -s .knit/cache/index
+expect_fail test -s .knit/cache/log
+expect_ok test $(ls .knit/cache | wc -l) -eq 2
+expect_ok test "$(knit-cache $job)" == $prd
+
+# Records after a torn one are still read, and override the index.
+echo 'step c: cmd "bash" "-c" "echo c > out/c"' > plan2.knit
+prd2=$(expect_ok knit-run-plan -f plan2.knit)
+printf 'KCLG torn' >> .knit/cache/log
+expect_ok knit-cache $job $prd2
+expect_ok test "$(knit-cache $job)" == $prd2
+expect_ok knit-cache --compact
+expect_ok test "$(knit-cache $job)" == $prd2
@@ -0,0 +1,44 @@
+#!/bin/bash
+
+. test-setup.sh
+
+seq 10000 > big
+echo small > small
+raw_big=$(expect_ok knit-hash-object -t resource -w big)
+raw_small=$(expect_ok knit-hash-object -t resource -w small)
+raw_size=$(wc -c < .knit/objects/${raw_big:0:2}/${raw_big:2})
+
+echo 'compression = zlib' > .knit/config
+seq 10001 20000 > big2
+big2=$(expect_ok knit-hash-object -t resource -w big2)
+echo small2 > small2
+small2=$(expect_ok knit-hash-object -t resource -w small2)
+
+# Compression does not change object ids.
+rm .knit/objects/${raw_big:0:2}/${raw_big:2}
+expect_ok test "$(knit-hash-object -t resource -w big)" == $raw_big
+expect_ok test $(wc -c < .knit/objects/${raw_big:0:2}/${raw_big:2}) -lt $raw_size
+
+# Small objects stay raw.
+expect_ok test $(wc -c < .knit/objects/${small2:0:2}/${small2:2}) -eq 15
+
+# Raw and compressed objects coexist, loose and packed.
+expect_ok cmp <(knit-cat-file resource $raw_big) big
+expect_ok cmp <(knit-cat-file resource $big2) big2
+expect_ok test "$(knit-cat-file resource $raw_small)" == small
+expect_ok knit-repack > /dev/null
+expect_ok cmp <(knit-cat-file resource $raw_big) big
+expect_ok cmp <(knit-cat-file resource $big2) big2
+expect_ok test "$(knit-cat-file resource $small2)" == small2
+
+# Large files are streamed, with or without compression.
+seq 500000 > large
+large=$(expect_ok knit-hash-object -t resource -w large)
+expect_ok test "$(knit-hash-object -t resource -w --stdin < large)" == $large
+expect_ok test $(wc -c < .knit/objects/${large:0:2}/${large:2}) -lt $(wc -c < large)
+expect_ok cmp <(knit-cat-file resource $large) large
+rm .knit/config .knit/objects/${large:0:2}/${large:2}
+expect_ok test "$(cat large | knit-hash-object -t resource -w --stdin)" == $large
+rm .knit/objects/${large:0:2}/${large:2}
+expect_ok test "$(knit-hash-object -t resource -w large)" == $large
+expect_ok cmp <(knit-cat-file resource $large) large
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+. test-setup.sh
+
+# Cmd jobs run by knit-run-cmd produce the same productions as
+# knit-dispatch-job.
+cat <<'EOF2' > plan.knit
+step a: cmd "bash" "-c" "echo $FOO; echo err >&2; mkdir -p out/d out/.knit; echo 1 > out/d/x; echo 2 > out/.knit/x; exit 3"
+    $FOO = "bar"
+step b: cmd "sh" "-c" "kill -TERM $$"
+step c: cmd "bash" "in/script"
+    script = "printf %s \"$(pwd)\" | tail -c 5 > out/cwd"
+step d: cmd "nonexistent-command"
+EOF2
+# execvp() runs an executable without #! using /bin/sh.
+printf 'echo no shebang > out/x\n' > noshebang
+chmod +x noshebang
+echo "step e: cmd \"$PWD/noshebang\"" >> plan.knit
+for mode in native script; do
+    mkdir $mode
+    (
+        cd $mode
+        knit init > /dev/null 2>&1
+        echo "dispatch = $mode" > .knit/config
+        expect_ok knit-run-plan -f ../plan.knit > /dev/null 2>&1
+        knit-cat-file -p @^{invocation} | grep -v ^session | sort > ../$mode.steps
+    )
+done
+diff native.steps script.steps || die "productions differ from knit-dispatch-job"
+
+cd native
+prd=$(grep ' a$' ../native.steps | cut -d' ' -f2)
+[[ $(knit-cat-file -p $prd:.knit/log) == $'bar\nerr' ]] || die "missing log"
+[[ $(knit-cat-file -p $prd:.knit/exitcode) == 3 ]] || die "wrong exit code"
+[[ $(knit-cat-file -p $prd:d/x) == 1 ]] || die "missing output"
+prd=$(grep ' c$' ../native.steps | cut -d' ' -f2)
+[[ $(knit-cat-file -p $prd:cwd) == /work ]] || die "wrong working directory"
+prd=$(grep ' e$' ../native.steps | cut -d' ' -f2)
+[[ $(knit-cat-file -p $prd:x) == "no shebang" ]] || die "script without #! not run"
+expect_ok test -z "$(ls .knit/scratch)"
@@ -0,0 +1,46 @@
+#!/bin/bash
+
+. test-setup.sh
+
+unset MAKEFLAGS
+
+# Steps log their names in $LOG as they start. The nonce changes every job, so
+# later runs only have the history of their step names to go on.
+export LOG="$PWD/log"
+echo -n 1 > nonce
+cat <<'EOF2' > plan.knit
+step params: params
+    nonce = ./nonce
+
+partial run: cmd "bash" "-c" "echo $name >> $LOG; sleep $time; cp in/nonce out/done"
+    nonce = params:nonce
+
+step a: partial run
+    $name = "a"
+    $time = "0"
+step b: partial run
+    $name = "b"
+    $time = "0"
+step long: partial run
+    $name = "long"
+    $time = "0.5"
+step after: partial run
+    $name = "after"
+    $time = "0.3"
+    long = long:done
+
+step all: identity
+    a = a:done
+    b = b:done
+    after = after:done
+EOF2
+
+# Without history, steps start in order.
+expect_ok knit-run-plan -j 1 > /dev/null
+expect_ok test -s .knit/durations
+[[ $(head -n1 log) == a ]] || die "steps did not start in order"
+
+# The long chain is the critical path, so it starts first.
+rm log
+expect_ok knit-run-plan -j 1 -p nonce=2 > /dev/null
+[[ $(head -n1 log) == long ]] || die "critical path did not start first"
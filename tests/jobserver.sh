@@ -0,0 +1,52 @@
+#!/bin/bash
+
+. test-setup.sh
+
+# Tests may run under make, whose jobserver we would otherwise join.
+unset MAKEFLAGS
+
+# Each step holds a lock while it runs, so fails if any run concurrently.
+export LOCK="$PWD/lock"
+cat <<'EOF' > plan.knit
+partial locked: cmd "bash" "-c" "mkdir $LOCK && sleep 0.2 && rmdir $LOCK && echo > out/$name"
+
+step a: partial locked
+    $name = "a"
+step b: partial locked
+    $name = "b"
+step c: partial locked
+    $name = "c"
+
+step all: identity
+    a = a:a
+    b = b:b
+    c = c:c
+EOF
+expect_ok knit-run-plan -j 1
+expect_ok knit-cat-file -p @:c
+
+# Jobs see our jobserver, and so does make run in them.
+cat <<'EOF' > inner.mk
+all: x y
+x y:
+	@echo $$MAKEFLAGS > out/$@
+EOF
+cat <<'EOF' > make.knit
+step make: cmd "make" "-s" "-f" "in/Makefile"
+    Makefile = ./inner.mk
+EOF
+expect_ok knit-run-plan -f make.knit -j 3 2> stderr
+[[ $(knit-cat-file -p @:x) == *"-j3 --jobserver-auth="* ]] || die "make did not see jobserver"
+expect_fail grep -q jobserver stderr
+
+# Under make with a jobserver, we join it as a client.
+echo "step make: cmd \"make\" \"-s\" \"-f\" \"in/Makefile\" \"nonce=$RANDOM\"" > make.knit
+echo '    Makefile = ./inner.mk' >> make.knit
+cat <<'EOF' > outer.mk
+all:
+	+@knit-run-plan -f make.knit -j 3
+EOF
+expect_ok make -s -j2 -f outer.mk 2> stderr
+expect_ok grep -q -- '-j3 ignored under make jobserver' stderr
+flags=$(knit-cat-file -p @:y)
+[[ $flags == *-j2*--jobserver-auth=* && $flags != *-j3* ]] || die "make did not see outer jobserver"
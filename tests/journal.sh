@@ -0,0 +1,39 @@
+#!/bin/bash
+
+. test-setup.sh
+
+cat <<'EOF' > plan.knit
+step a: external
+    x = "1"
+
+step c: cmd "bash" "-c" "echo 3 > out/z"
+
+step b: identity
+    y = a:y
+    z = c:z
+EOF
+
+expect_ok knit-run-plan 2>&1 > prd | while read -r stderr; do
+    if [[ $stderr != "External job "* ]]; then
+        echo "$stderr" >&2
+        continue
+    fi
+
+    # While the session waits on the external job, step c's completion is
+    # only in the journal.
+    for ((i = 0; i < 100; i++)); do
+        ls .knit/sessions/*.journal > /dev/null 2>&1 && break
+        sleep 0.1
+    done
+    journal=$(ls .knit/sessions/*.journal)
+    session=${journal%.journal}
+    expect_ok test "$(knit-list-steps --fulfilled $session)" == c
+
+    job="${stderr#External job }"
+    echo 2 > y
+    knit-complete-job --job $job --file y
+done
+
+expect_ok test "$(knit-cat-file -p $(< prd):y)" == 2
+expect_ok test "$(knit-cat-file -p $(< prd):z)" == 3
+expect_ok test -z "$(ls .knit/sessions)"
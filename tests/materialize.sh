@@ -0,0 +1,38 @@
+#!/bin/bash
+
+. test-setup.sh
+
+seq 3 > data
+head -c 2000000 /dev/zero > large
+
+cat <<'EOF' > plan.knit
+partial bash: cmd "bash" "in/script"
+    script = !
+
+step a: partial bash
+    script = "ls -l in/data | awk '{print $2}' > out/links\n[[ -L in/data ]] && echo symlink > out/kind\ncat in/data in/large | wc -c | tr -d ' ' > out/size\ncp in/large out/large"
+    data = ./data
+    large = ./large
+EOF
+
+large=$(expect_ok knit-hash-object -t resource -w large)
+
+for mode in copy hardlink symlink reflink; do
+    echo "materialize = $mode" > .knit/config
+    rm -rf .knit/objects .knit/cache
+    mkdir .knit/objects .knit/cache
+    prd=$(expect_ok knit-run-plan)
+    # Object ids do not depend on how objects are stored.
+    expect_ok test "$(knit-peel-spec $prd:large)" == $large
+    expect_ok test "$(knit-cat-file -p $prd:size)" == 2000006
+    expect_ok cmp <(knit-cat-file -p $prd:large) large
+    case $mode in
+        copy)
+            expect_ok test "$(knit-cat-file -p $prd:links)" -eq 1
+            expect_ok test ! -e .knit/objects/payload;;
+        hardlink)
+            expect_ok test "$(knit-cat-file -p $prd:links)" -gt 1;;
+        symlink)
+            expect_ok test "$(knit-cat-file -p $prd:kind)" == symlink;;
+    esac
+done
@@ -0,0 +1,26 @@
+#!/bin/bash
+
+. test-setup.sh
+
+cat <<'EOF' > plan.knit
+step a: cmd "bash" "-c" "seq 3 > out/data"
+
+step b: cmd "bash" "-c" "wc -l < in/data > out/count"
+    data = a:data
+EOF
+
+prd=$(expect_ok knit-run-plan)
+expect_ok knit-repack > /dev/null
+expect_ok test -z "$(find .knit/objects -path .knit/objects/pack -prune -o -type f -print)"
+expect_ok test "$(knit-cat-file -p $prd:count)" == 3
+
+# Packed objects satisfy lookups and existence checks.
+expect_ok test "$(knit-run-plan)" == "$prd"
+expect_ok test -z "$(find .knit/objects -path .knit/objects/pack -prune -o -type f -print)"
+
+echo new > new
+res=$(expect_ok knit-hash-object -t resource -w new)
+expect_ok knit-repack -a > /dev/null
+expect_ok test $(ls .knit/objects/pack/*.idx | wc -l) -eq 1
+expect_ok test "$(knit-cat-file resource $res)" == new
+expect_ok test "$(knit-cat-file -p $prd:count)" == 3
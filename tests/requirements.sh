@@ -0,0 +1,51 @@
+#!/bin/bash
+
+. test-setup.sh
+
+unset MAKEFLAGS
+
+# Steps register in $RUN while they run, and fail if any other step matching
+# $exclusive runs alongside them.
+export RUN="$PWD/run"
+mkdir run
+cat <<'EOF' > plan.knit
+partial run: cmd "bash" "-c" "mkdir $RUN/$name; check() { [[ -z $exclusive || $(cd $RUN && ls -d $exclusive | wc -l) -eq 1 ]]; }; check && sleep 0.3 && check && cp -R in/.knit out/knit; rc=$?; rmdir $RUN/$name; exit $rc"
+
+step heavy: cpus=4 memory=1G partial run
+    $name = "mem-heavy"
+    $exclusive = "*"
+step a: partial run
+    $name = "a"
+step b: partial run
+    $name = "b"
+step c: memory=600M partial run
+    $name = "mem-c"
+    $exclusive = "mem-*"
+step d: memory=600M partial run
+    $name = "mem-d"
+    $exclusive = "mem-*"
+
+step all: identity
+    heavy/ = heavy:knit/
+    a/ = a:knit/
+    b/ = b:knit/
+    c/ = c:knit/
+    d/ = d:knit/
+EOF
+echo 'memory = 1G' >> .knit/config
+expect_ok knit-run-plan -j 4
+[[ $(knit-cat-file -p @:heavy/cpus) == 4 ]] || die "heavy step did not see cpus"
+[[ $(knit-cat-file -p @:heavy/memory) == 1073741824 ]] || die "heavy step did not see memory"
+expect_ok knit-cat-file -p @:b/cmd > /dev/null
+expect_ok knit-cat-file -p @:d/memory > /dev/null
+
+# A step needing more than there is at all still runs.
+cat <<'EOF' > plan.knit
+step huge: cpus=64 memory=1T cmd "bash" "-c" "cp in/.knit/cpus out/cpus"
+EOF
+expect_ok knit-run-plan -j 2
+[[ $(knit-cat-file -p @:cpus) == 64 ]] || die "huge step did not run"
+
+# Only cmd steps have requirements.
+echo 'step p: cpus=2 identity' > plan.knit
+expect_fail knit-run-plan 2> /dev/null
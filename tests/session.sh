@@ -0,0 +1,18 @@
+#!/bin/bash
+
+. test-setup.sh
+
+# Names are not limited to 12-bit lengths.
+name=$(printf 'd/%.0s' {1..2500})x
+cat <<EOF > plan.knit
+step a: identity
+    $name = "1"
+
+step b: identity
+    y = a:$name
+EOF
+
+prd=$(expect_ok knit-run-plan)
+expect_ok test "$(knit-cat-file -p $prd:y)" == 1
+session=$(knit-cat-file -p $prd^{invocation} | grep '^session ' | cut -d' ' -f2)
+expect_ok knit-list-steps --debug <(knit-cat-file -p $session) | grep -q "$name$"
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+. test-setup.sh
+
+mkdir data
+for i in 1 2 3; do echo $i > data/$i; done
+touch -t 202001010000 data/*
+
+cat <<'EOF' > plan.knit
+step a: cmd "bash" "-c" "cat in/data/* > out/all"
+    data/ = ./data/
+EOF
+
+prd=$(expect_ok knit-run-plan)
+expect_ok test -s .knit/statcache
+expect_ok test "$(knit-cat-file -p $prd:all)" == "$(printf '1\n2\n3')"
+
+# Cached ids are only trusted while the objects exist.
+rm -rf .knit/objects .knit/cache
+mkdir .knit/objects .knit/cache
+expect_ok test "$(knit-run-plan)" == $prd
+
+# Modified files are rehashed.
+echo 20 > data/2
+touch -t 202001020000 data/2
+prd=$(expect_ok knit-run-plan)
+expect_ok test "$(knit-cat-file -p $prd:all)" == "$(printf '1\n20\n3')"
+
+# So are files rewritten with their size and mtime restored.
+echo 4 > data/3
+touch -t 202001010000 data/3
+prd=$(expect_ok knit-run-plan)
+expect_ok test "$(knit-cat-file -p $prd:all)" == "$(printf '1\n20\n4')"
@@ -0,0 +1,165 @@
+#include "unpack.h"
+
+#include "hash.h"
+
+static int mkparents(const char* path) {
+    char subdir[strlen(path) + 1];
+    strcpy(subdir, path);
+    // Skip the root of an absolute path.
+    for (char* p = subdir + (*subdir == '/'); *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(subdir, 0777) < 0 && errno != EEXIST)
+                return error_errno("cannot mkdir %s", subdir);
+            *p = '/';
+        }
+    }
+    return 0;
+}
+
+static int write_environ(int fd, const char* name, const char* buf, size_t size) {
+    if (memchr(buf, '\0', size))
+        die("NUL in environment variable %s", name);
+    if (write_fully(fd, name, strlen(name)) < 0 ||
+        write_fully(fd, "=", 1) < 0 ||
+        write_fully(fd, buf, size) < 0 ||
+        write_fully(fd, "", 1) < 0)
+        die_errno("write failed to environ");
+    return 0;
+}
+
+static int write_file(const char* path, const char* buf, size_t size) {
+    if (mkparents(path) < 0)
+        return -1;
+    int fd = creat(path, 0666);
+    if (fd < 0)
+        return error_errno("cannot open %s", path);
+    if (write_fully(fd, buf, size) < 0)
+        return error_errno("write failed %s", path);
+    if (close(fd) < 0)
+        return error_errno("close failed %s", path);
+    return 0;
+}
+
+// Share the stored payload file at path if the materialize mode allows,
+// returning 1 on success or 0 to fall back to writing a copy. Once a mode
+// fails for lack of support, stop trying it.
+static int link_payload(const char* path, const struct object_id* oid) {
+    static int unsupported;
+    enum materialize_mode mode = get_materialize_mode();
+    if (mode == MATERIALIZE_COPY || unsupported)
+        return 0;
+    const char* payload = find_object_payload(oid);
+    if (!payload)
+        return 0; // packed or stored with a header
+    if (mkparents(path) < 0)
+        return 0; // for write_file() to report
+
+    if (mode == MATERIALIZE_HARDLINK) {
+        if (!link(payload, path))
+            return 1;
+        if (errno != EXDEV && errno != EPERM && errno != EMLINK)
+            die_errno("cannot link %s", path);
+    } else if (mode == MATERIALIZE_SYMLINK) {
+        char abspath[PATH_MAX];
+        if (!realpath(payload, abspath))
+            die_errno("cannot resolve %s", payload);
+        if (!symlink(abspath, path))
+            return 1;
+        if (errno != EPERM)
+            die_errno("cannot symlink %s", path);
+    } else {
+        assert(mode == MATERIALIZE_REFLINK);
+        int src_fd = open(payload, O_RDONLY);
+        if (src_fd < 0)
+            die_errno("cannot open %s", payload);
+        int fd = creat(path, 0666);
+        if (fd < 0)
+            die_errno("cannot open %s", path);
+        int rc = reflink_fd(fd, src_fd);
+        int saved_errno = errno;
+        close(src_fd);
+        if (close(fd) < 0)
+            die_errno("close failed %s", path);
+        if (!rc)
+            return 1;
+        errno = saved_errno;
+        if (errno != EOPNOTSUPP && errno != ENOTSUP && errno != EXDEV &&
+                errno != EINVAL && errno != ENOTTY)
+            die_errno("cannot reflink %s", path);
+    }
+    unsupported = 1;
+    return 0;
+}
+
+// path is the full output path including basedir. Remove the prefix from path
+// (after basedir) and return 1 iff this path should be output.
+static int transform_path(char* path, const char* basedir,
+                          const char* remove_prefix) {
+    if (!remove_prefix)
+        return 1;
+
+    size_t basedir_len = strlen(basedir);
+    if (strncmp(path, basedir, basedir_len) || path[basedir_len] != '/')
+        return 0;
+
+    path += basedir_len + 1;
+    if (!strncmp(path, remove_prefix, strlen(remove_prefix))) {
+        char* suffix = path + strlen(remove_prefix);
+        memmove(path, suffix, strlen(suffix) + 1);  // include terminating NUL
+        return 1;
+    }
+    return 0;
+}
+
+int unpack_resources(const struct resource_list* list, uint32_t typesig,
+                     const char* dir, const char* remove_prefix) {
+    const char* res_dir = typesig == OBJ_JOB ? "in" : "out";
+    int env_fd = -1;
+    for (size_t i = 0; i < list->num_entries; i++) {
+        const struct resource_entry* entry = &list->entries[i];
+        const struct object_id* oid = &entry->res->object.oid;
+        struct bytebuf bb;
+
+        if (typesig == OBJ_JOB && *entry->name == '$') {
+            char path[strlen(dir) + strlen("/environ") + 1];
+            stpcpy(stpcpy(path, dir), "/environ");
+
+            if (!transform_path(path, dir, remove_prefix))
+                continue;
+
+            if (env_fd == -1) {
+                env_fd = creat(path, 0666);
+                if (env_fd < 0)
+                    return error_errno("cannot open %s", path);
+            }
+
+            if (read_object_view_of_type(oid, OBJ_RESOURCE, &bb) < 0 ||
+                    write_environ(env_fd, entry->name + 1, bb.data, bb.size)) {
+                close(env_fd);
+                return -1;
+            }
+            cleanup_bytebuf(&bb);
+        } else {
+            char path[PATH_MAX];
+            if (snprintf(path, PATH_MAX, "%s/%s/%s",
+                         dir, res_dir, entry->name) >= PATH_MAX)
+                die("path too long: %s/%s/%s", dir, res_dir, entry->name);
+
+            if (!transform_path(path, dir, remove_prefix) ||
+                    link_payload(path, oid))
+                continue;
+
+            if (read_object_view_of_type(oid, OBJ_RESOURCE, &bb) < 0 ||
+                    write_file(path, bb.data, bb.size) < 0) {
+                if (env_fd >= 0)
+                    close(env_fd);
+                return -1;
+            }
+            cleanup_bytebuf(&bb);
+        }
+    }
+    if (env_fd >= 0 && close(env_fd) < 0)
+        return error_errno("close failed %s/environ", dir);
+    return 0;
+}
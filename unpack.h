@@ -0,0 +1,12 @@
+#pragma once
+
+#include "resource.h"
+
+// Write a job's inputs (typesig OBJ_JOB) or a production's outputs
+// (OBJ_PRODUCTION) into the existing directory dir, as files under in/ or out/
+// respectively. Files are materialized per the materialize mode (see hash.h).
+// Job inputs naming environment variables ($<name>) are instead written to
+// dir/environ as NUL-terminated <name>=<value> strings. With remove_prefix,
+// only paths under dir starting with it are written, with it removed.
+int unpack_resources(const struct resource_list* list, uint32_t typesig,
+                     const char* dir, const char* remove_prefix);
@@ -3,6 +3,12 @@
 #include <dirent.h>
 #include <sys/mman.h>
 
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 static void emit_stderr(const char* prefix, int with_errno,
                         const char* fmt, va_list argp) {
     fputs(prefix, stderr);
@@ -110,11 +116,33 @@ const char* get_knit_dir() {
     return knit_dir;
 }
 
+int parse_size(const char* s, uint64_t* size) {
+    if (!isdigit(*s))
+        return -1;
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    if (errno)
+        return -1;
+    int shift = 0;
+    switch (*end) {
+    case 'T': shift += 10; // fall through
+    case 'G': shift += 10; // fall through
+    case 'M': shift += 10; // fall through
+    case 'K': shift += 10; end++; break;
+    }
+    if (*end || n > UINT64_MAX >> shift)
+        return -1;
+    *size = (uint64_t)n << shift;
+    return 0;
+}
+
 void cleanup_bytebuf(struct bytebuf* bbuf) {
     if (bbuf->should_free)
         free(bbuf->data);
     if (bbuf->should_munmap)
-        munmap(bbuf->data, bbuf->size);
+        munmap((char*)bbuf->data - bbuf->map_offset,
+               bbuf->size + bbuf->map_offset);
     memset(bbuf, 0, sizeof(*bbuf));
 }
 
@@ -125,13 +153,15 @@ void ensure_bytebuf_null_terminated(struct bytebuf* bb) {
         bb->data = xrealloc(bb->data, bb->size + 1);
         ((char*)bb->data)[bb->size] = '\0';
     } else {
-        assert(bb->should_munmap);
         char* buf = xmalloc(bb->size + 1);
         memcpy(buf, bb->data, bb->size);
         buf[bb->size] = '\0';
-        if (munmap(bb->data, bb->size) < 0)
+        if (bb->should_munmap &&
+                munmap((char*)bb->data - bb->map_offset,
+                       bb->size + bb->map_offset) < 0)
             warning_errno("munmap");
         bb->data = buf;
+        bb->map_offset = 0;
         bb->should_munmap = 0;
         bb->should_free = 1;
     }
@@ -233,6 +263,115 @@ int mmap_or_slurp_file(const char* filename, struct bytebuf* out) {
     return 0;
 }
 
+int reflink_fd(int dst_fd, int src_fd) {
+#ifdef FICLONE
+    return ioctl(dst_fd, FICLONE, src_fd);
+#else
+    (void)dst_fd;
+    (void)src_fd;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int copy_fd_range(int dst_fd, int src_fd, off_t offset, size_t size) {
+    size_t off = 0;
+#if defined(__linux__) && defined(SYS_copy_file_range)
+    // Let the kernel copy (or share extents) without a trip through userspace.
+    // Fall back to reading and writing if it cannot for these files.
+    while (off < size) {
+        loff_t off_in = offset + off;
+        ssize_t n = syscall(SYS_copy_file_range, src_fd, &off_in, dst_fd, NULL,
+                            size - off, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && off == 0 &&
+                (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                 errno == EOPNOTSUPP || errno == EBADF))
+            break;
+        if (n < 0)
+            return -1;
+        if (n == 0) {
+            errno = EIO; // source shrank
+            return -1;
+        }
+        off += n;
+    }
+#endif
+    char buf[64 * 1024];
+    while (off < size) {
+        size_t len = size - off < sizeof(buf) ? size - off : sizeof(buf);
+        ssize_t n = pread(src_fd, buf, len, offset + off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0) {
+            errno = EIO; // source shrank
+            return -1;
+        }
+        if (write_fully(dst_fd, buf, n) < 0)
+            return -1;
+        off += n;
+    }
+    return 0;
+}
+
+int fsync_dir(const char* dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    int rc = fsync(fd);
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return rc;
+}
+
+int replace_file(const char* path, mode_t mode, int (*write_fn)(FILE* fh),
+                 int is_durable) {
+    char tmpfile[PATH_MAX];
+    if (snprintf(tmpfile, PATH_MAX, "%s-XXXXXX", path) >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = mkstemp(tmpfile);
+    if (fd < 0)
+        return -1;
+    FILE* fh = fdopen(fd, "w");
+    if (!fh)
+        die_errno("fdopen");
+
+    int rc = fchmod(fd, mode);
+    if (!rc)
+        rc = write_fn(fh);
+    if (!rc && fflush(fh) != 0)
+        rc = -1;
+    if (!rc && is_durable)
+        rc = fsync(fd);
+    int saved_errno = errno;
+    if (fclose(fh) != 0 && !rc) {
+        rc = -1;
+        saved_errno = errno;
+    }
+    if (!rc && rename(tmpfile, path) < 0) {
+        rc = -1;
+        saved_errno = errno;
+    }
+    if (rc < 0) {
+        unlink(tmpfile);
+        errno = saved_errno;
+        return -1;
+    }
+
+    if (is_durable) {
+        char dir[PATH_MAX];
+        strcpy(dir, path);
+        return fsync_dir(dirname(dir));
+    }
+    return 0;
+}
+
 int acquire_lockfile(const char* lockfile) {
     static int is_rand_seeded = 0;
     if (!is_rand_seeded) {
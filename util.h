@@ -64,11 +64,34 @@ static inline ssize_t write_fully(int fd, const void* buf, size_t size) {
     return 0;
 }
 
+static inline uint64_t get_be64(const void* p) {
+    const uint8_t* b = p;
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v = (v << 8) | b[i];
+    return v;
+}
+
+static inline void put_be64(void* p, uint64_t v) {
+    uint8_t* b = p;
+    for (int i = 7; i >= 0; i--, v >>= 8)
+        b[i] = v & 0xff;
+}
+
 const char* get_knit_dir();
 
+// Parse a decimal number of bytes with an optional binary suffix (K, M, G or
+// T), such as 512M. Returns -1 if s is malformed or overflows.
+int parse_size(const char* s, uint64_t* size);
+
+// A buffer that is either owned (should_free or should_munmap) or borrowed
+// (neither, as for views into a mapping that outlives the bytebuf).
 struct bytebuf {
     void* data;
     size_t size;
+    // Distance of data past the start of the mapping, for views that skip a
+    // header but must still unmap the whole thing.
+    size_t map_offset;
     unsigned should_free : 1;
     unsigned should_munmap : 1;
     unsigned null_terminated : 1;
@@ -86,5 +109,22 @@ int slurp_fd(int fd, struct bytebuf* out);
 
 int mmap_or_slurp_file(const char* filename, struct bytebuf* out);
 
+// Share the contents of src_fd with dst_fd (FICLONE), or fail with errno set
+// if the platform or filesystem does not support it.
+int reflink_fd(int dst_fd, int src_fd);
+// Copy size bytes of src_fd starting at offset to the current offset of
+// dst_fd, using copy_file_range() where available.
+int copy_fd_range(int dst_fd, int src_fd, off_t offset, size_t size);
+
+// Sync a directory, so entries just created or renamed in it are durable.
+int fsync_dir(const char* dir);
+
+// Replace path with what write_fn writes, through a temporary file renamed
+// over it, so readers only ever see a whole file. The new file has the given
+// mode. With is_durable, the file and its directory are synced so the
+// replacement survives a crash. Returns -1 with errno set on failure.
+int replace_file(const char* path, mode_t mode, int (*write_fn)(FILE* fh),
+                 int is_durable);
+
 // Atomically open a lock file and return its file descriptor, or -1 on error.
 int acquire_lockfile(const char* lockfile);